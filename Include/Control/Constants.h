@@ -8,17 +8,127 @@ const int kIter = 20;
 */
 const float dDiff = 0.0;
 const float vDiff = 0.000001;
+/* below this diffusion rate k (see FluidClass::diffuse) a
+ * single explicit step gives the same result as the iter
+ * solver, the two differ by about k*k of the curvature
+ * and the explicit step is stable up to k = 0.25
+*/
+const float kExplicitLimit = 0.01;
+/* above this diffusion rate the kIter sweeps of the iter
+ * solver are far from converged and the line implicit (ADI)
+ * solve is more accurate (and cheaper)
+*/
+const float kADILimit = 2.0;
 /* grid size for simulation N*N
  * NOTE: N+2 has to be an even number
 */
 const int N = 128;
+/* the velocity grid can be coarser than the density grid
+ * by this integer factor, density is advected using the
+ * bilinear upsampled velocity. Most of the cost is in the
+ * velocity solve, so N = 254 with vFactor = 2 renders dye
+ * at 4x the resolution for roughly the cost of N = 128
+ * NOTE: (N-2) has to be divisible by vFactor
+*/
+const int vFactor = 1;
 /* time step
+ * With adaptive time stepping this is the interval between
+ * two rendered frames, each frame is split into as few
+ * substeps as the CFL target allows
 */
 const float dt = 0.2;
+/* CFL target, the max number of cells the fastest fluid
+ * is allowed to move in one substep, and the max number of
+ * substeps in a frame (if the flow is faster than that, the
+ * substeps become larger than the CFL target)
+*/
+const float cflTarget = 2.0;
+const int kMaxSubsteps = 8;
+/* stages of a simulation step, a preset or a comma
+ * separated list of stages (see FluidClass::setPipeline)
+*/
+const char* const pipelineSpec = "fused";
+/* solvers of a simulation step by name, role=backend pairs
+ * (see FluidClass::setBackends and Backend.h). The dye is
+ * what we see, so it gets the second order advection to keep
+ * its detail on a coarser grid
+*/
+const char* const backendSpec = "poisson=sor, diffusion=auto, advection-velocity=semi-lagrangian, "
+                                "advection-density=maccormack";
+/* memory layout of the fields, padStrides pads every row
+ * to a whole number of cache lines (plus one line when that
+ * is a power of two), useHugePages backs the field arena with
+ * huge pages when the OS supports it
+*/
+const bool padStrides = true;
+const bool useHugePages = true;
+/* print the step plan of FluidClass (diffusion modes, skipped
+ * stages) every time it changes, see printPlan
+*/
+const bool reportStepPlans = false;
 /* scale render window size, changing this factor resizes 
  * everything inside the window and no special calculation
  * is necessary
 */
 const int scale = 4;
+/* AMR engine (AMRFluidClass), cells per patch side, the
+ * uniform base level and the finest level the quadtree is
+ * allowed to refine to. With 16 cells per patch, level 9
+ * gives an effective resolution of 8192 x 8192
+*/
+const int amrPatchSize = 16;
+const int amrMinLevel = 3;
+const int amrMaxLevel = 9;
+/* a patch is refined when the velocity jump (vorticity * h)
+ * or the density jump across one of its cells goes above
+ * these fractions of the largest speed and density in the
+ * domain, and merged back into its parent when all 4
+ * siblings are below amrCoarsenRatio of them
+*/
+const float amrRefineVort = 0.1;
+const float amrRefineGrad = 0.25;
+const float amrCoarsenRatio = 0.25;
+/* max number of leaf cells, 1024 * 1024 costs the same as
+ * a 1024 x 1024 uniform grid
+*/
+const int amrCellBudget = 1024 * 1024;
+/* number of time steps between two regrids
+*/
+const int amrRegridInterval = 4;
+/* pressure solve of the AMR engine, V-cycles per projection,
+ * Gauss-Seidel sweeps on the root patch and on every other
+ * level of a cycle
+*/
+const int amrVCycles = 2;
+const int amrCoarseIter = 50;
+const int amrSmoothIter = 4;
+/* tracer particles (ParticleClass) and the particles of the
+ * PIC/FLIP engine, the number of threads that move them (0 for
+ * one per hardware thread), the fewest particles worth a thread
+ * of their own, and the number of steps between two sorts of
+ * the tracers by position
+*/
+const int kParticleThreads = 0;
+const int kParticlesPerThread = 16384;
+const int kParticleSortInterval = 16;
+/* PIC/FLIP engine (FLIPFluidClass), particles per cell at the
+ * start and when an empty cell is reseeded, and the share of
+ * FLIP in the particle velocity update (1 is pure FLIP, 0 is
+ * pure PIC)
+*/
+const int kFlipParticlesPerCell = 4;
+const float kFlipRatio = 0.95;
+/* lattice Boltzmann engine (LBMFluidClass), the fastest the
+ * flow may move in lattice units (cells per lattice step, the
+ * lattice speed of sound is 0.577) before a time step is split
+ * into more lattice steps, the most lattice steps per time
+ * step, the lowest relaxation time (0.5 is no viscosity at
+ * all) and the number of threads (0 for one per hardware
+ * thread)
+*/
+const float kLbmMaxSpeed = 0.1;
+const int kLbmMaxSubsteps = 64;
+const float kLbmMinTau = 0.505;
+const int kLbmThreads = 0;
 #endif /* CONTROL_CONSTANTS_H
 */
\ No newline at end of file
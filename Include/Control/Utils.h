@@ -46,6 +46,7 @@
 */
 #include <GLFW/glfw3.h>
 #include <vector>
+#include "Constants.h"
 
 /* externs, since these are used in main
 */
@@ -73,6 +74,26 @@ void processInput(GLFWwindow* window);
 void genCellVerticesWrapper(int i, int j);
 void genCellColor(int i, int j, float r, float g, float b, float alpha);
 float getRandomAmount(float start, float end);
-int getIdx(int i, int j);
+
+/* get grid position given the index
+ * positions (i, j)
+ * Usage: if i = 9, j = 9 in a 10x10 grid,
+ * index will be 9 + (9 * 10) = 99
+ *
+ * NOTE: these are called for every cell access in the
+ * simulation kernels, so they are defined here (inline)
+ * instead of in Utils.cpp. The compiler can then fold the
+ * index math into the loops and vectorize them
+*/
+inline int getIdx(int i, int j){
+    return i + (j * N);
+}
+/* same as above for a grid that is n cells wide,
+ * used when the simulation runs grids of different
+ * sizes
+*/
+inline int getIdx(int i, int j, int n){
+    return i + (j * n);
+}
 #endif /* CONTROL_UTILS_H
 */
\ No newline at end of file
@@ -0,0 +1,264 @@
+#ifndef SIMULATION_AMRFLUID_H
+#define SIMULATION_AMRFLUID_H
+
+#include "Fluid.h"
+#include <vector>
+#include <stddef.h>
+
+/* Fields stored in every patch of the quadtree. The _TMP
+ * fields play the role of the prev arrays in FluidClass,
+ * AMR_RES and AMR_E are the residual and the correction of
+ * the multigrid pressure solve
+*/
+typedef enum{
+    AMR_D,
+    AMR_D_TMP,
+    AMR_VX,
+    AMR_VX_TMP,
+    AMR_VY,
+    AMR_VY_TMP,
+    AMR_DIV,
+    AMR_P,
+    AMR_RES,
+    AMR_E,
+    AMR_NUM_FIELDS
+}amrField;
+
+/* A ghost cell of a patch is filled from (at most) 4 cells
+ * of other patches using bilinear weights. When the ghost
+ * cell lies outside the domain, side tells us which wall
+ * it is mirrored across (1 - left/right, 2 - bottom/top) so
+ * that the velocity components can be negated like in
+ * FluidClass::setBoundaries
+*/
+typedef struct{
+    int dst;
+    int node[4];
+    int idx[4];
+    float w[4];
+    int side;
+}ghostStencil;
+
+/* A node of the quadtree. Every node owns a patch of
+ * B x B cells plus one layer of ghost cells around it.
+ * Leaves hold the simulation state, internal nodes hold
+ * the average of their children (restriction) so that
+ * a neighbour at any level can be read directly
+*/
+typedef struct{
+    int level;
+    /* position of the patch in units of patches at its
+     * level, (0,0) is the bottom left patch
+    */
+    int pi, pj;
+    int parent;
+    /* children in the order SW, SE, NW, NE (cx + 2*cy),
+     * -1 if this node is a leaf
+    */
+    int child[4];
+    float *block;
+    float *f[AMR_NUM_FIELDS];
+    std::vector<ghostStencil> ghosts;
+    bool alive;
+}amrNode;
+
+/* Adaptive mesh refinement version of FluidClass
+ *
+ * A uniform grid spends the same amount of work on every
+ * cell, even though most of the domain is smooth and only
+ * the region around the plume has any detail. Here the
+ * domain (unit square) is covered by a block structured
+ * quadtree: every node is a fixed size patch of B x B cells,
+ * and a patch at level l has cells of size 1/(B * 2^l).
+ *
+ *  ---------------------------------
+ *  |               |   |   |       |
+ *  |               |---+---|       |   Patches are split into
+ *  |               |   |   |       |   4 children when the flow
+ *  |---------------+-------+-------|   inside them has a lot of
+ *  |       |   |   |               |   vorticity or a steep
+ *  |       |---+---|               |   density gradient, and
+ *  |       |   |   |               |   merged back when the
+ *  |-------+-------|               |   region becomes smooth
+ *  |       |       |               |
+ *  ---------------------------------
+ *
+ * The steps are the same as in FluidClass (diffuse, clear
+ * divergence, advect), they are run on every leaf patch.
+ * Patches talk to each other only through their ghost cells:
+ * (1) neighbour at the same level - copy the cell
+ * (2) neighbour is coarser - bilinear interpolation from the
+ * coarse patch (coarse-fine interpolation)
+ * (3) neighbour is finer - copy the cell of the refined node
+ * at our level, which holds the average of its children
+ * The tree is kept balanced, leaves that touch (also at a
+ * corner) are at most one level apart.
+ *
+ * The pressure is solved on the composite grid (all the
+ * leaves together) with multigrid V-cycles over the tree:
+ * (1) the residual of the composite equation is computed on
+ * the leaves. Where a coarse leaf touches finer ones the
+ * flux through the shared face is the sum of the fluxes the
+ * fine cells see, so that what leaves one side enters the
+ * other (coarse-fine flux matching)
+ * (2) the residual is averaged up the tree, every node at
+ * every level gets the part of it that it covers
+ * (3) from the root down, the correction is interpolated
+ * from the parent and smoothed with a few sweeps on all the
+ * nodes of the level, the leaves add it to the pressure
+ * (4) post-smoothing on the leaves, a few sweeps of a new
+ * correction against the composite residual of the updated
+ * pressure
+ * There is no smoothing on the way up (the residual is only
+ * restricted), a V(0, amrSmoothIter) cycle. The fine leaves
+ * push their residual up to the coarse levels and the coarse
+ * levels carry it back down, so the cost per cycle is a few
+ * sweeps per patch.
+ *
+ * The public interface (sources, step, density readout) is
+ * the same as FluidClass, and (i,j) always refers to a cell
+ * of the N x N grid that we render
+*/
+class AMRFluidClass{
+    private:
+        /* B, cells per patch side (without ghost cells) and
+         * the width of a patch including ghost cells
+        */
+        int B, BG;
+        int minLevel, maxLevel;
+        /* level whose cells are closest to (and not larger
+         * than) the cells of the render grid
+        */
+        int readLevel;
+        int numSteps;
+        std::vector<amrNode> nodes;
+        std::vector<int> freeNodes;
+        /* leaf patches, and all nodes sorted by level
+        */
+        std::vector<int> leaves;
+        std::vector<std::vector<int>> levels;
+        /* refinement indicator for each node, computed during
+         * regrid
+        */
+        std::vector<float> indicator;
+
+        int getPatchIdx(int i, int j);
+        int allocNode(int level, int pi, int pj, int parent);
+        void freeNode(int n);
+        /* walk the tree from node start to the leaf containing
+         * (x,y), or down to the node at level which contains
+         * cell (ci, cj) of that level
+        */
+        int locate(float x, float y, int start);
+        int locateLevel(int ci, int cj, int level);
+        /* bilinear sample of a field in node n at physical
+         * position (x,y)
+        */
+        float sample(int n, amrField fd, float x, float y);
+        void buildGhostStencils(int n);
+        void rebuildLists(void);
+        /* fill ghost cells of the given set of patches. For
+         * density and the pressure fields atType should be
+         * DENSITY or CLEAR_DIVERGENCE so that the domain walls
+         * assume continuity
+        */
+        void fillGhosts(attribute atType, amrField fd, const std::vector<int> &set);
+        /* average children into their parent, deepest level
+         * first
+        */
+        void restrictNode(int n, amrField fd);
+        void restrictField(amrField fd);
+        /* restrict and then fill the ghost cells of all the
+         * leaves, after this every leaf can read its neighbours
+        */
+        void exchange(attribute atType, amrField fd);
+        void prolongate(int parent, int child, amrField fd);
+
+        void refineNode(int n);
+        void coarsenNode(int n);
+        /* largest jump across a cell of n over the refine
+         * threshold, with the jumps relative to the given
+         * density and speed
+        */
+        float refineIndicator(int n, float dScale, float vScale);
+        /* neighbouring leaves differ by at most one level,
+         * keepsBalance tells if the children of n can be
+         * merged without breaking that
+        */
+        bool keepsBalance(int n);
+        void balanceTree(void);
+        void regrid(void);
+        void addSource(amrField fd, int i, int j, float amount);
+        void addSourceRecursive(int n, amrField fd, float x0, float y0,
+                                float x1, float y1, float amount);
+        /* Gauss-Seidel on a set of patches, one ghost exchange
+         * per sweep. composite is true when set holds the
+         * leaves, the internal nodes are then restricted before
+         * every exchange
+         *
+         * For CLEAR_DIVERGENCE prev holds the divergence and
+         * curr = (s - h*h*div)/4, otherwise it is the diffusion
+         * equation with k = dt * diff / (h*h)
+        */
+        void iterSolve(attribute atType, amrField curr, amrField prev, float diff,
+                       const std::vector<int> &set, int numIter, bool composite);
+        /* AMR_RES = div - laplacian of AMR_P on the leaves, with
+         * the coarse-fine flux matching, and one V-cycle that
+         * adds its correction to AMR_P
+        */
+        void compositeResidual(void);
+        void vCycle(void);
+        /* AMR_P += AMR_E on the leaves
+        */
+        void addCorrection(void);
+        /* every cell of patch n, ghost cells included, set to 0
+        */
+        void clearPatch(int n, amrField fd);
+    public:
+        int N;
+        float dt;
+        float dDiff, vDiff;
+
+        /* same arguments as FluidClass, patch size and the
+         * range of levels are read from Constants.h
+        */
+        AMRFluidClass(int _N, float _dDiff, float _vDiff, float _dt);
+        ~AMRFluidClass(void);
+
+        void addDensitySource(int i, int j, float amount);
+        void addVelocitySource(int i, int j, float amountX, float amountY);
+
+        void diffuse(attribute atType, amrField curr, amrField prev, float diff);
+        void advection(attribute atType, amrField curr, amrField prev,
+                       amrField vX, amrField vY);
+        /* composite grid pressure projection, amrVCycles
+         * V-cycles from the pressure of the last call. div and
+         * p are stored in AMR_DIV and AMR_P
+        */
+        void clearDivergence(amrField vX, amrField vY);
+
+        void densityStep(void);
+        void velocityStep(void);
+        /* one step of the simulation, followed by a regrid
+         * every amrRegridInterval steps
+        */
+        void simulationStep(void);
+        /* density of cell (i,j) in the N x N render grid, the
+         * cell under it at readLevel (or the leaf above it). A
+         * refined node there holds the average of its children,
+         * restricted at the end of every step, a finer leaf is
+         * not read directly
+        */
+        float getDensity(int i, int j);
+        /* number of leaf patches and the total memory held
+         * by all patches, for accounting
+        */
+        int getNumLeaves(void);
+        size_t getMemoryUsage(void);
+        /* deepest level that has a leaf, its cells are
+         * 1/(B * 2^level) wide
+        */
+        int getFinestLevel(void);
+};
+#endif /* SIMULATION_AMRFLUID_H
+*/
@@ -0,0 +1,70 @@
+#ifndef SIMULATION_ARENA_H
+#define SIMULATION_ARENA_H
+
+#include <stddef.h>
+
+/* alignment of every allocation from the arena, one cache
+ * line (and the width of an AVX-512 register)
+*/
+const size_t kArenaAlign = 64;
+
+/* A linear allocator that hands out pieces of one large
+ * block of memory
+ *
+ * All the fields of a simulation are created together and
+ * live as long as the simulation does, so instead of one
+ * calloc per field we reserve a single region up front and
+ * carve the fields out of it:
+ *
+ *  | dCurr | dPrev | vXCurr | vXPrev | ... | scratch |
+ *  ^       ^
+ *  every field starts on a 64 byte boundary
+ *
+ * With huge pages the whole simulation state is covered by
+ * a handful of TLB entries instead of one per 4KB page. The
+ * memory is released all at once when the arena is destroyed
+*/
+class ArenaClass{
+    private:
+        char *base;
+        size_t capacity, used;
+        /* how the region was obtained, so that it can be
+         * released the same way
+        */
+        bool mapped, hugePages;
+        void swap(ArenaClass &other) noexcept;
+        void release(void);
+    public:
+        ArenaClass(void);
+        ~ArenaClass(void);
+        /* the region has a single owner
+        */
+        ArenaClass(const ArenaClass&) = delete;
+        ArenaClass &operator=(const ArenaClass&) = delete;
+        /* moving hands the region over, the fields carved out
+         * of it stay where they are
+        */
+        ArenaClass(ArenaClass &&other) noexcept;
+        ArenaClass &operator=(ArenaClass &&other) noexcept;
+        /* round bytes up to a multiple of kArenaAlign
+        */
+        static size_t align(size_t bytes);
+        /* reserve a zeroed region of (at least) bytes, with
+         * useHugePages it is backed by huge pages when the OS
+         * allows it (MAP_HUGETLB, or transparent huge pages
+         * through madvise). Returns false if the memory could
+         * not be allocated
+        */
+        bool reserve(size_t bytes, bool useHugePages);
+        /* next (aligned) bytes of the region, NULL when the
+         * arena is full
+        */
+        void *allocBytes(size_t bytes);
+        float *allocFloats(size_t count);
+
+        size_t getCapacity(void);
+        size_t getUsed(void);
+        bool isHugePages(void);
+};
+#endif /* SIMULATION_ARENA_H
+*/
@@ -0,0 +1,192 @@
+#ifndef SIMULATION_BACKEND_H
+#define SIMULATION_BACKEND_H
+
+#include "Fluid.h"
+#include <vector>
+#include <string>
+#include <memory>
+
+/* Solver backends
+ *
+ * A step of FluidClass is made of three kinds of solves, and
+ * any of them can be swapped for another implementation
+ * without touching Fluid.cpp:
+ *  BACKEND_POISSON   - the pressure solve of clearDivergence
+ *                      (and of solvePoisson)
+ *  BACKEND_DIFFUSION - the implicit diffusion of a field
+ *  BACKEND_ADVECTION - the transport of a field through the
+ *                      velocity
+ * A backend implements the interface of its kind and is added
+ * to the registry under a name, a simulation then picks its
+ * backends by name (FluidClass::setBackend/setBackends), so the
+ * choice can come from Constants.h at startup and two backends
+ * can be run on the same workload (clone) and compared.
+ *
+ * The solvers of FluidClass are in the registry too, with no
+ * object behind them:
+ *   poisson   "gauss-seidel", "sor", "chebyshev"
+ *   diffusion "auto" (picked from the diffusion rate, see
+ *             stepPlan), "iterative", "adi"
+ *   advection "semi-lagrangian", "maccormack", "bfecc"
+ * Choosing one of them sets the relaxation, the diffusion mode
+ * or the advection scheme, and keeps the fused kernels that
+ * handle several fields in one pass. A backend from outside is
+ * called once per field.
+ *
+ * F is the simulation class (FluidClass or another layout of
+ * FluidLayoutClass), every layout has its own registry
+*/
+
+/* Solves the pressure equation of the projection on the
+ * velocity grid (vN x vN cells, row stride vStride, scalar
+ * layout of F)
+ *      4 p(i,j) - (p(i-1,j) + p(i+1,j) + p(i,j-1) + p(i,j+1)) = div(i,j)
+ * for the fluid cells (see getObstacles(CLEAR_DIVERGENCE)). p
+ * holds the starting guess (0), and the boundaries have to be
+ * set with setBoundaries(CLEAR_DIVERGENCE, p) like every other
+ * solve does
+*/
+template<typename F>
+class PoissonBackendClass{
+    public:
+        virtual ~PoissonBackendClass(void){
+        }
+        virtual void solve(F &fluid, float *p, float *div) = 0;
+};
+
+/* Diffuses prev into curr with the rate k (see
+ * FluidClass::diffuse)
+ *      (1 + 4k) curr(i,j) - k (sum of the 4 neighbours of curr) = prev(i,j)
+ * on the grid and in the layout of atType (a velocity component
+ * or a scalar field), and sets the boundaries of curr
+*/
+template<typename F>
+class DiffusionBackendClass{
+    public:
+        virtual ~DiffusionBackendClass(void){
+        }
+        virtual void diffuse(F &fluid, attribute atType, float *curr, float *prev, float k) = 0;
+};
+
+/* Advects prev into curr through the velocity components vX,
+ * vY over one step of fluid.dt (see FluidClass::advection),
+ * and sets the boundaries of curr. For a velocity component
+ * prev is one of vX, vY
+*/
+template<typename F>
+class AdvectionBackendClass{
+    public:
+        virtual ~AdvectionBackendClass(void){
+        }
+        virtual void advect(F &fluid, attribute atType, float *curr, float *prev, float *vX,
+                            float *vY) = 0;
+};
+
+/* A name in the registry, either a backend object, or no
+ * object (NULL) for a built in solver, then builtin is its
+ * relaxationMethod, diffusionMode or advectionScheme
+*/
+template<typename B>
+struct backendEntry{
+    std::string name;
+    int builtin;
+    std::unique_ptr<B> backend;
+};
+
+template<typename F>
+class BackendRegistryClass{
+    private:
+        std::vector<backendEntry<PoissonBackendClass<F>>> poisson;
+        std::vector<backendEntry<DiffusionBackendClass<F>>> diffusion;
+        std::vector<backendEntry<AdvectionBackendClass<F>>> advection;
+
+        BackendRegistryClass(void){
+            addBuiltin(poisson, "gauss-seidel", GAUSS_SEIDEL);
+            addBuiltin(poisson, "sor", SOR);
+            addBuiltin(poisson, "chebyshev", CHEBYSHEV);
+            /* -1 picks the mode from the rate
+            */
+            addBuiltin(diffusion, "auto", -1);
+            addBuiltin(diffusion, "iterative", DIFFUSE_IMPLICIT);
+            addBuiltin(diffusion, "adi", DIFFUSE_ADI);
+            addBuiltin(advection, "semi-lagrangian", SEMI_LAGRANGIAN);
+            addBuiltin(advection, "maccormack", MACCORMACK);
+            addBuiltin(advection, "bfecc", BFECC);
+        }
+        template<typename B>
+        static void addBuiltin(std::vector<backendEntry<B>> &list, const std::string &name,
+                               int builtin){
+            list.push_back(backendEntry<B>{name, builtin, NULL});
+        }
+        template<typename B>
+        static const backendEntry<B> *findEntry(const std::vector<backendEntry<B>> &list,
+                                                const std::string &name){
+            for(size_t e = 0; e < list.size(); e++){
+                if(list[e].name == name)
+                    return &list[e];
+            }
+            return NULL;
+        }
+        template<typename B>
+        static bool addEntry(std::vector<backendEntry<B>> &list, const std::string &name,
+                             B *backend){
+            if(findEntry(list, name) != NULL){
+                std::unique_ptr<B> drop(backend);
+                return false;
+            }
+            list.push_back(backendEntry<B>{name, -1, std::unique_ptr<B>(backend)});
+            return true;
+        }
+        template<typename B>
+        static std::string joinNames(const std::vector<backendEntry<B>> &list){
+            std::string names;
+            for(size_t e = 0; e < list.size(); e++)
+                names += (e == 0 ? "" : ", ") + list[e].name;
+            return names;
+        }
+    public:
+        BackendRegistryClass(const BackendRegistryClass&) = delete;
+        BackendRegistryClass &operator=(const BackendRegistryClass&) = delete;
+        /* the registry of F, made on first use
+        */
+        static BackendRegistryClass &get(void){
+            static BackendRegistryClass registry;
+            return registry;
+        }
+        /* the registry owns the backend from here on (and
+         * deletes it right away when the name is taken, then
+         * false is returned). Simulations keep a plain pointer,
+         * so a backend is never removed
+        */
+        bool addPoisson(const std::string &name, PoissonBackendClass<F> *backend){
+            return addEntry(poisson, name, backend);
+        }
+        bool addDiffusion(const std::string &name, DiffusionBackendClass<F> *backend){
+            return addEntry(diffusion, name, backend);
+        }
+        bool addAdvection(const std::string &name, AdvectionBackendClass<F> *backend){
+            return addEntry(advection, name, backend);
+        }
+        /* NULL when there is no backend of that name
+        */
+        const backendEntry<PoissonBackendClass<F>> *findPoisson(const std::string &name){
+            return findEntry(poisson, name);
+        }
+        const backendEntry<DiffusionBackendClass<F>> *findDiffusion(const std::string &name){
+            return findEntry(diffusion, name);
+        }
+        const backendEntry<AdvectionBackendClass<F>> *findAdvection(const std::string &name){
+            return findEntry(advection, name);
+        }
+        /* comma separated names of a kind, for messages
+        */
+        std::string getNames(backendKind kind){
+            if(kind == BACKEND_POISSON)
+                return joinNames(poisson);
+            if(kind == BACKEND_DIFFUSION)
+                return joinNames(diffusion);
+            return joinNames(advection);
+        }
+};
+#endif /* SIMULATION_BACKEND_H
+*/
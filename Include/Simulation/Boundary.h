@@ -0,0 +1,240 @@
+#ifndef SIMULATION_BOUNDARY_H
+#define SIMULATION_BOUNDARY_H
+
+#include "Layout.h"
+
+/* Boundary conditions of a field
+ * Every field has a ring of ghost cells around its interior
+ * (cells 1 ... n-2 in both directions), the stencils read them
+ * like any other cell. A boundary policy sets a ghost cell from
+ * the interior cell next to it (inside), the interior cell at
+ * the other end of the same row or column (opposite) and the
+ * value given for that side
+ *
+ * reflectBoundary    - ghost = -inside, the field is 0 on the
+ *                      wall (velocity normal to a solid wall)
+ * continuityBoundary - ghost = inside, no change across the
+ *                      wall (density, the velocity along a wall)
+ * periodicBoundary   - ghost = opposite, the field wraps around
+ *                      to the other side of the domain
+ * inflowBoundary     - ghost = 2 * value - inside, the field is
+ *                      value on the wall (halfway between the
+ *                      ghost and the inside cell)
+ * outflowBoundary    - ghost = inside, the field leaves the
+ *                      domain as it arrives. Fills the ghost cells
+ *                      like continuity, it is a separate policy so
+ *                      that open sides can be told apart from walls
+ *
+ * The policies are compile time parameters of the fill kernels
+ * below, so a kernel is one copy loop without any test in it,
+ * and the rows (contiguous in the row-major layouts) are filled
+ * 8 cells at a time
+*/
+typedef enum{
+    BOUNDARY_REFLECT,
+    BOUNDARY_CONTINUITY,
+    BOUNDARY_PERIODIC,
+    BOUNDARY_INFLOW,
+    BOUNDARY_OUTFLOW
+}boundaryPolicy;
+
+/* sides of the domain, LEFT and RIGHT are the ghost columns
+ * i = 0 and i = n-1, BOTTOM and TOP the ghost rows j = 0 and
+ * j = n-1
+*/
+typedef enum{
+    SIDE_LEFT,
+    SIDE_RIGHT,
+    SIDE_BOTTOM,
+    SIDE_TOP
+}boundarySide;
+
+struct reflectBoundary{
+    static float ghost(float inside, float opposite, float value){
+        (void)opposite;
+        (void)value;
+        return -inside;
+    }
+#ifdef __AVX2__
+    static __m256 ghost8(__m256 inside, __m256 opposite, __m256 value){
+        (void)opposite;
+        (void)value;
+        return _mm256_xor_ps(inside, _mm256_set1_ps(-0.0f));
+    }
+#endif
+};
+
+struct continuityBoundary{
+    static float ghost(float inside, float opposite, float value){
+        (void)opposite;
+        (void)value;
+        return inside;
+    }
+#ifdef __AVX2__
+    static __m256 ghost8(__m256 inside, __m256 opposite, __m256 value){
+        (void)opposite;
+        (void)value;
+        return inside;
+    }
+#endif
+};
+
+struct periodicBoundary{
+    static float ghost(float inside, float opposite, float value){
+        (void)inside;
+        (void)value;
+        return opposite;
+    }
+#ifdef __AVX2__
+    static __m256 ghost8(__m256 inside, __m256 opposite, __m256 value){
+        (void)inside;
+        (void)value;
+        return opposite;
+    }
+#endif
+};
+
+struct inflowBoundary{
+    static float ghost(float inside, float opposite, float value){
+        (void)opposite;
+        return 2 * value - inside;
+    }
+#ifdef __AVX2__
+    static __m256 ghost8(__m256 inside, __m256 opposite, __m256 value){
+        (void)opposite;
+        return _mm256_sub_ps(_mm256_add_ps(value, value), inside);
+    }
+#endif
+};
+
+struct outflowBoundary : continuityBoundary{
+};
+
+/* a policy that does not wrap around as
+ *      ghost = scale * inside + offset
+ * for the solvers that build the walls into their equations
+ * (see FluidClass::adiDiffuse), false for BOUNDARY_PERIODIC
+*/
+inline bool ghostRule(boundaryPolicy policy, float value, float &scale, float &offset){
+    scale = 1;
+    offset = 0;
+    if(policy == BOUNDARY_PERIODIC)
+        return false;
+    if(policy == BOUNDARY_REFLECT)
+        scale = -1;
+    else if(policy == BOUNDARY_INFLOW){
+        scale = -1;
+        offset = 2 * value;
+    }
+    return true;
+}
+
+/* what a side adds to the equation of the cells next to it
+ * when its ghost is folded into them. The Gauss-Seidel sweeps
+ * fold the sides whose ghost is -inside (+ 2 * value), a ghost
+ * filled after the sweep feeds the old value of the cell next
+ * to the side back with the wrong sign
+ *      denom * x = prev + k * (s + ghost)
+ *                = prev + k * (s - x + offset)
+ * so the cell solves (denom + diag) * x = prev + k * s + rhs
+ * with the ghost at 0 during the sweeps
+*/
+typedef struct{
+    bool folded[4];
+    float diag[4];
+    float rhs[4];
+}sideFold;
+
+inline void foldSide(sideFold &fold, boundarySide side, boundaryPolicy policy, float value,
+                     float k){
+    float scale, offset;
+    fold.folded[side] = ghostRule(policy, value, scale, offset) && scale < 0;
+    fold.diag[side] = fold.folded[side] ? -scale * k : 0;
+    fold.rhs[side] = fold.folded[side] ? offset * k : 0;
+}
+
+/* ghost cells of a side (without the corners) set to 0
+*/
+template<typename M>
+inline void clearSide(float *arr, int n, int row, boundarySide side){
+    for(int t = 1; t < n-1; t++){
+        if(side == SIDE_LEFT)
+            arr[M::cell(0, t, row)] = 0;
+        else if(side == SIDE_RIGHT)
+            arr[M::cell(n-1, t, row)] = 0;
+        else if(side == SIDE_BOTTOM)
+            arr[M::cell(t, 0, row)] = 0;
+        else
+            arr[M::cell(t, n-1, row)] = 0;
+    }
+}
+
+/* ghost row j = ghost (cells 1 ... n-2) from the rows inside
+ * and opposite, in layout M
+*/
+template<typename M, typename P>
+inline void fillRow(float *arr, int n, int row, int ghost, int inside, int opposite, float value){
+    int i = 1;
+#ifdef __AVX2__
+    const __m256 v = _mm256_set1_ps(value);
+    for(; i + 8 <= n-1; i += 8){
+        __m256 g = P::ghost8(loadCells8<M>(arr, i, inside, row),
+                             loadCells8<M>(arr, i, opposite, row), v);
+        storeCells8<M>(arr, i, ghost, row, g);
+    }
+#endif
+    for(; i < n-1; i++)
+        arr[M::cell(i, ghost, row)] = P::ghost(arr[M::cell(i, inside, row)],
+                                               arr[M::cell(i, opposite, row)], value);
+}
+
+/* ghost column i = ghost of the rows j0 ... j1-1, one cell per
+ * row (a sweep can fill the ends of a row as soon as it is done)
+*/
+template<typename M, typename P>
+inline void fillColumn(float *arr, int row, int ghost, int inside, int opposite, int j0, int j1,
+                       float value){
+    for(int j = j0; j < j1; j++)
+        arr[M::cell(ghost, j, row)] = P::ghost(arr[M::cell(inside, j, row)],
+                                               arr[M::cell(opposite, j, row)], value);
+}
+
+/* one side of a field of n x n cells. The policy is picked
+ * here, once per call, for the left and right sides only the
+ * rows j0 ... j1-1 are filled
+*/
+template<typename M, typename P>
+inline void fillSideWith(float *arr, int n, int row, boundarySide side, float value, int j0, int j1){
+    if(side == SIDE_LEFT)
+        fillColumn<M, P>(arr, row, 0, 1, n-2, j0, j1, value);
+    else if(side == SIDE_RIGHT)
+        fillColumn<M, P>(arr, row, n-1, n-2, 1, j0, j1, value);
+    else if(side == SIDE_BOTTOM)
+        fillRow<M, P>(arr, n, row, 0, 1, n-2, value);
+    else
+        fillRow<M, P>(arr, n, row, n-1, n-2, 1, value);
+}
+
+template<typename M>
+inline void fillSide(float *arr, int n, int row, boundarySide side, boundaryPolicy policy,
+                     float value, int j0, int j1){
+    switch(policy){
+        case BOUNDARY_REFLECT:
+            fillSideWith<M, reflectBoundary>(arr, n, row, side, value, j0, j1);
+            break;
+        case BOUNDARY_CONTINUITY:
+            fillSideWith<M, continuityBoundary>(arr, n, row, side, value, j0, j1);
+            break;
+        case BOUNDARY_PERIODIC:
+            fillSideWith<M, periodicBoundary>(arr, n, row, side, value, j0, j1);
+            break;
+        case BOUNDARY_INFLOW:
+            fillSideWith<M, inflowBoundary>(arr, n, row, side, value, j0, j1);
+            break;
+        case BOUNDARY_OUTFLOW:
+            fillSideWith<M, outflowBoundary>(arr, n, row, side, value, j0, j1);
+            break;
+    }
+}
+#endif /* SIMULATION_BOUNDARY_H
+*/
@@ -0,0 +1,117 @@
+#ifndef SIMULATION_FLIPFLUID_H
+#define SIMULATION_FLIPFLUID_H
+
+#include "Fluid.h"
+#include <vector>
+#include <stddef.h>
+
+/* PIC/FLIP version of FluidClass
+ *
+ * The semi-lagrangian advection of FluidClass interpolates the
+ * velocity at every step, and every interpolation smooths it
+ * out: small swirls are gone after a few steps. Here the
+ * velocity is carried by particles (kFlipParticlesPerCell per
+ * cell) that move with the flow and keep their own velocity,
+ * the grid is only used to make it divergence free:
+ * (1) particles to grid - every particle adds its velocity to
+ *     the 4 cells around it with bilinear weights, the velocity
+ *     of a cell is the weighted mean
+ * (2) sources, diffusion and clearDivergence of FluidClass on
+ *     the grid velocity
+ * (3) grid to particles - PIC takes the new grid velocity at
+ *     the particle (smooth, dissipative), FLIP adds only the
+ *     change the grid made to the particle's own velocity
+ *     (keeps the detail, noisy), blended with kFlipRatio
+ *          u = kFlipRatio * (u + du) + (1 - kFlipRatio) * uGrid
+ * (4) the particles move through the grid velocity (midpoint
+ *     rule), cells left empty get new particles and crowded
+ *     ones lose some
+ * The density stays on the grid and is advected by FluidClass.
+ *
+ * The scatter of (1) is split over threads without atomics:
+ * the particles are sorted by the TILE x TILE tile of cells
+ * they are in, and a particle only writes to its tile and one
+ * column/row of the next tiles. The tiles are coloured like a
+ * 2 x 2 checkerboard, tiles of one colour are one tile apart
+ * and never write to the same cell, so the 4 colours are done
+ * one after the other and the tiles of a colour in parallel
+ *
+ *      +---+---+---+---+
+ *      | 2 | 3 | 2 | 3 |
+ *      +---+---+---+---+
+ *      | 0 | 1 | 0 | 1 |
+ *      +---+---+---+---+
+ *
+ * The public interface (sources, stepping, density readout)
+ * is the same as FluidClass
+*/
+class FLIPFluidClass{
+    private:
+        /* the grid the velocity is projected on, and that
+         * holds the density
+        */
+        FluidClass grid;
+        /* the particles, positions in cell units of the grid
+         * (cell i has its center at i) and velocities. The
+         * sort buffers, the tile of every particle and the
+         * first particle of every tile
+        */
+        std::vector<float> px, py, pu, pv;
+        std::vector<float> sortX, sortY, sortU, sortV;
+        std::vector<int> keys, tileStart;
+        int tiles;
+        /* grid velocity before the projection (the change the
+         * grid made, after gridToParticles), the velocity
+         * sources of the next step and the particle weight of
+         * every cell
+        */
+        FieldClass<float> saved, force, weight;
+        /* state of the random numbers that place new particles
+        */
+        unsigned int seed;
+        float random(void);
+
+        /* the new particles of cell (i,j), with the velocity of
+         * the grid
+        */
+        void seedCell(int i, int j);
+        void sortParticles(void);
+        void particlesToGrid(void);
+        void gridToParticles(void);
+        void moveParticles(void);
+        /* reseed the empty cells, and keep at most twice
+         * kFlipParticlesPerCell in every cell
+        */
+        void balanceParticles(void);
+        /* bilinear sample of a row-major grid field at (x,y)
+        */
+        float sample(const float *arr, float x, float y);
+    public:
+        int N;
+        float dt;
+        float dDiff, vDiff;
+
+        FLIPFluidClass(int _N, float _dDiff, float _vDiff, float _dt);
+        ~FLIPFluidClass(void);
+
+        void addDensitySource(int i, int j, float amount);
+        void addVelocitySource(int i, int j, float amountX, float amountY);
+
+        void densityStep(void);
+        void velocityStep(void);
+        void simulationStep(void);
+        /* same adaptive stepping as FluidClass::frameStep
+         * (frameSubsteps)
+        */
+        float maxVelocity(void);
+        void frameStep(float frameDt);
+        float getDensity(int i, int j);
+        /* velocity of the grid at cell (i,j), after the last
+         * step
+        */
+        float getVelocity(attribute atType, int i, int j);
+        int getParticleCount(void);
+        size_t getMemoryUsage(void);
+};
+#endif /* SIMULATION_FLIPFLUID_H
+*/
@@ -0,0 +1,179 @@
+#ifndef SIMULATION_FIELD_H
+#define SIMULATION_FIELD_H
+
+#include "Arena.h"
+#include <stdlib.h> /* for posix_memalign, free
+*/
+#include <string.h> /* for memcpy, memset
+*/
+#include <assert.h>
+#include <utility>
+
+/* Non-owning 2D view of one component of a field in layout M
+ * (see Layout.h), (i,j) is the cell in column i and row j,
+ * stored at data[M::cell(i, j, stride)]. Cheap to copy and pass
+ * by value, it is only valid as long as the field it came from
+*/
+template<typename T, typename M>
+struct fieldView{
+    T *data;
+    int n, stride, halo;
+
+    T &operator()(int i, int j) const{
+        return data[M::cell(i, j, stride)];
+    }
+    /* not one of the halo rings of border cells
+    */
+    bool isInterior(int i, int j) const{
+        return i >= halo && i < n - halo && j >= halo && j < n - halo;
+    }
+};
+
+/* A grid of n x n cells in rows of stride cells (stride >= n,
+ * the extra cells are padding that is never read), where cell
+ * (i,j) is stored depends on the layout of the field (see
+ * Layout.h, cell()). The outer halo rings of cells are the
+ * border walls, so the interior is halo..n-halo-1
+ *
+ * The storage is either owned by the field (64 byte aligned,
+ * released when the field is destroyed) or a slice of an
+ * ArenaClass, in which case the arena releases it. Either way
+ * a field cannot be copied by accident:
+ * (1) move  - hands the storage over, the source becomes empty
+ * (2) swap  - exchanges the storage of two fields, this is how
+ *             curr and prev trade places after a step
+ * (3) clone - deep copy into a new owning field
+*/
+template<typename T>
+class FieldClass{
+    private:
+        T *ptr;
+        int n, stride, halo;
+        /* elements in the storage, n * stride for a field with
+         * a single value per cell
+        */
+        int length;
+        bool owner;
+
+        void release(void){
+            if(owner)
+                free(ptr);
+            ptr = NULL;
+            owner = false;
+        }
+    public:
+        FieldClass(void){
+            ptr = NULL;
+            n = stride = halo = length = 0;
+            owner = false;
+        }
+        /* owning field, zero filled. _length is the number of
+         * elements to store if the field holds more than one
+         * value per cell (0 - n * stride)
+        */
+        FieldClass(int _n, int _stride, int _halo, int _length = 0){
+            n = _n;
+            stride = _stride;
+            halo = _halo;
+            length = _length > 0 ? _length : n * stride;
+            owner = true;
+            void *p = NULL;
+            size_t bytes = ArenaClass::align(count() * sizeof(T));
+            if(posix_memalign(&p, kArenaAlign, bytes) != 0)
+                assert(false);
+            memset(p, 0, bytes);
+            ptr = (T*)p;
+        }
+        /* slice of an arena (zero filled, since the arena is)
+        */
+        FieldClass(ArenaClass &arena, int _n, int _stride, int _halo, int _length = 0){
+            n = _n;
+            stride = _stride;
+            halo = _halo;
+            length = _length > 0 ? _length : n * stride;
+            owner = false;
+            ptr = (T*)arena.allocBytes(count() * sizeof(T));
+            assert(ptr != NULL);
+        }
+        ~FieldClass(void){
+            release();
+        }
+
+        FieldClass(const FieldClass&) = delete;
+        FieldClass &operator=(const FieldClass&) = delete;
+
+        FieldClass(FieldClass &&other) noexcept : FieldClass(){
+            swap(other);
+        }
+        FieldClass &operator=(FieldClass &&other) noexcept{
+            if(this != &other){
+                release();
+                swap(other);
+            }
+            return *this;
+        }
+        void swap(FieldClass &other) noexcept{
+            std::swap(ptr, other.ptr);
+            std::swap(n, other.n);
+            std::swap(stride, other.stride);
+            std::swap(halo, other.halo);
+            std::swap(length, other.length);
+            std::swap(owner, other.owner);
+        }
+        /* deep copy, the copy owns its storage
+        */
+        FieldClass clone(void) const{
+            FieldClass copy(n, stride, halo, length);
+            copy.copyFrom(*this);
+            return copy;
+        }
+        /* copy the cells of a field with the same shape
+        */
+        void copyFrom(const FieldClass &other){
+            assert(n == other.n && stride == other.stride && length == other.length);
+            memcpy(ptr, other.ptr, count() * sizeof(T));
+        }
+
+        T *data(void){
+            return ptr;
+        }
+        const T *data(void) const{
+            return ptr;
+        }
+        /* element idx of the storage, the cell (i,j) it holds
+         * depends on the layout (see Layout.h, cell())
+        */
+        T &operator[](int idx){
+            return ptr[idx];
+        }
+        /* view of component c (0 for a scalar field) in layout
+         * M, the layout the field was allocated for
+        */
+        template<typename M>
+        fieldView<T, M> view(int c = 0){
+            return fieldView<T, M>{ptr + M::component(c, n, stride), n, stride, halo};
+        }
+        template<typename M>
+        fieldView<const T, M> view(int c = 0) const{
+            return fieldView<const T, M>{ptr + M::component(c, n, stride), n, stride, halo};
+        }
+        int size(void) const{
+            return n;
+        }
+        int getStride(void) const{
+            return stride;
+        }
+        int getHalo(void) const{
+            return halo;
+        }
+        /* elements in the storage, padding included
+        */
+        int count(void) const{
+            return length;
+        }
+        bool isOwner(void) const{
+            return owner;
+        }
+};
+#endif /* SIMULATION_FIELD_H
+*/
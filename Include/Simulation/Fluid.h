@@ -1,6 +1,17 @@
 #ifndef SIMULATION_FLUID_H
 #define SIMULATION_FLUID_H
 
+#include "Arena.h"
+#include "Field.h"
+#include "Layout.h"
+#include "Boundary.h"
+#include "Obstacle.h"
+#include "Particles.h"
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+
 /* Choose attribute to run sim function on
 */
 typedef enum{
@@ -10,6 +21,174 @@ typedef enum{
     CLEAR_DIVERGENCE
 }attribute;
 
+/* Advection scheme used for an attribute
+ * SEMI_LAGRANGIAN - trace back and interpolate (first order)
+ * MACCORMACK      - semi-lagrangian step corrected with the
+ *                   error of a backward step
+ * BFECC           - back and forth error compensation, the
+ *                   error is removed before advecting
+*/
+typedef enum{
+    SEMI_LAGRANGIAN,
+    MACCORMACK,
+    BFECC
+}advectionScheme;
+
+/* How a diffusion stage is carried out, chosen from k
+ * SWAP     - k = 0, the result is the input, swap the curr
+ *            and prev pointers instead of solving
+ * COPY     - k = 0, same as SWAP when the pointers cannot
+ *            be swapped (copy prev into curr)
+ * EXPLICIT - k is tiny, one explicit stencil pass
+ * IMPLICIT - the iterative (Gauss-Seidel) solve
+ * ADI      - k is large, one implicit solve along the rows
+ *            and one along the columns (see adiDiffuse)
+*/
+typedef enum{
+    DIFFUSE_SWAP,
+    DIFFUSE_COPY,
+    DIFFUSE_EXPLICIT,
+    DIFFUSE_IMPLICIT,
+    DIFFUSE_ADI
+}diffusionMode;
+
+/* Relaxation used by the iterative solver of an attribute
+ * GAUSS_SEIDEL - every cell is updated in place from the
+ *                newest values of its neighbours
+ * SOR          - Gauss-Seidel with the update scaled by the
+ *                over-relaxation factor w (1 < w < 2), w is
+ *                estimated from the grid size and k
+ * CHEBYSHEV    - Jacobi sweeps (a cell only reads the previous
+ *                sweep) with the Chebyshev weights, no cell
+ *                depends on another one of the same sweep
+*/
+typedef enum{
+    GAUSS_SEIDEL,
+    SOR,
+    CHEBYSHEV
+}relaxationMethod;
+
+/* Type of a side of the simulation domain, see setBoundary
+ * DOMAIN_WALL     - solid wall, no fluid goes through it
+ * DOMAIN_PERIODIC - fluid that leaves through this side comes
+ *                   back in through the opposite one
+ * DOMAIN_INFLOW   - fluid is pushed in at a fixed speed
+ * DOMAIN_OUTFLOW  - open side, fluid leaves freely
+*/
+typedef enum{
+    DOMAIN_WALL,
+    DOMAIN_PERIODIC,
+    DOMAIN_INFLOW,
+    DOMAIN_OUTFLOW
+}domainBoundary;
+
+/* Kind of solve that a backend does, see Backend.h
+ * BACKEND_POISSON   - pressure solve of the projection
+ * BACKEND_DIFFUSION - implicit diffusion solve
+ * BACKEND_ADVECTION - transport through the velocity
+*/
+typedef enum{
+    BACKEND_POISSON,
+    BACKEND_DIFFUSION,
+    BACKEND_ADVECTION
+}backendKind;
+
+template<typename F>
+class PoissonBackendClass;
+template<typename F>
+class DiffusionBackendClass;
+template<typename F>
+class AdvectionBackendClass;
+
+/* Execution plan of one simulation step, built from the
+ * parameters (diffusion rates, dt, grid size) and the state
+ * of the velocity field before every step
+*/
+typedef struct{
+    diffusionMode density, velocity;
+    float dK, vK;
+    /* the velocity field is zero everywhere, diffusion,
+     * advection and projection cannot change anything so
+     * those stages are skipped
+    */
+    bool velocityStill;
+}stepPlan;
+
+/* Stages that a simulation step is made of
+ * DIFFUSE_VELOCITY - viscous diffusion of both components
+ * PROJECT          - clear divergence of the velocity
+ * ADVECT_VELOCITY  - self advection of the velocity
+ * DIFFUSE_DENSITY  - diffusion of the density
+ * ADVECT_DENSITY   - advection of the density
+ * ADVECT_ALL       - velocity and density advected in one
+ *                    fused pass (only when vFactor = 1)
+*/
+typedef enum{
+    STAGE_DIFFUSE_VELOCITY,
+    STAGE_PROJECT,
+    STAGE_ADVECT_VELOCITY,
+    STAGE_DIFFUSE_DENSITY,
+    STAGE_ADVECT_DENSITY,
+    STAGE_ADVECT_ALL
+}stepStage;
+
+/* The substeps of frameStep, shared by all the engines
+ * frameDt is split into steps that move the fluid by at most
+ * target cells of the n x n grid (from maxVelocity() before
+ * every step), never more than maxSubsteps of them, and what
+ * is left is split evenly instead of ending with a tiny step.
+ * step(dt, vMax) takes one simulation step of length dt
+*/
+template<typename V, typename F>
+void frameSubsteps(float frameDt, int n, float target, int maxSubsteps, V maxVelocity, F step){
+    float remaining = frameDt;
+    int substeps = 0;
+    while(remaining > 0.0){
+        float vMax = maxVelocity();
+        float dt = remaining;
+        if(vMax > 0.0)
+            dt = std::min(dt, target/((n-2) * vMax));
+        int left = maxSubsteps - substeps;
+        if(left <= 1)
+            dt = remaining;
+        else{
+            dt = std::max(dt, remaining/left);
+            int count = (int)ceilf(remaining/dt);
+            dt = remaining/count;
+        }
+        step(dt, vMax);
+        remaining -= dt;
+        substeps++;
+        /* rounding, the last step could leave a few ulps
+        */
+        if(remaining < 1e-6 * frameDt)
+            break;
+    }
+}
+
+/* max number of fields that a fused kernel handles in one
+ * pass
+*/
+const int kMaxFusedFields = 8;
+/* max number of scalar fields, the density and the ones added
+ * with addScalar. The fused advection of everything (both
+ * velocity components and all the scalars) has to fit in
+ * kMaxFusedFields
+*/
+const int kMaxScalars = kMaxFusedFields - 2;
+
+/* A scalar field added with addScalar (dye, temperature ...)
+ * It is transported like the density, on the same grid, in
+ * the same layout and with the same advection scheme, but with
+ * its own diffusion rate diff. Like dCurr/dPrev the latest
+ * values are in prev, scratch is its buffer for the higher
+ * order advection schemes
+*/
+typedef struct{
+    float diff;
+    FieldClass<float> curr, prev, scratch;
+}scalarField;
+
 /* the 2D fluid class based on Navier-Stokes equations
  * for incompressible fluids
  *
@@ -40,10 +219,269 @@ typedef enum{
  * |    increases due to sources                                            |
  * |    ADVECTION + DIFFUSION + SOURCES                                     |
  * +------------------------------------------------------------------------+
+ *
+ * L is the memory layout of the velocity fields and S the one
+ * of the scalar fields (see Layout.h), FluidClass is the
+ * simulation with the default layouts
 */
-class FluidClass{
+template<typename L, typename S>
+class FluidLayoutClass{
     private:
-        int totalCells;
+        /* floats in a density and in a velocity field
+        */
+        int dSize, vSize;
+        /* all the fields and scratch buffers are carved out of
+         * this, see ArenaClass
+        */
+        ArenaClass arena;
+        /* density attributes live on the N x N grid, velocity
+         * and the divergence/pressure fields on the vN x vN grid
+        */
+        int getGridSize(attribute atType);
+        int getStride(attribute atType);
+        /* velocity components are stored in layout L, every
+         * other field in layout S
+        */
+        bool isVelocity(attribute atType);
+        /* bilinear interpolation of the coarse velocity field
+         * at the center of every density cell, the result is
+         * stored in vUp
+         *
+         * A density cell i has its center at (i - 0.5)/(N-2) in
+         * the unit square, which is (i - 0.5)/vFactor + 0.5 in
+         * velocity grid coordinates
+        */
+        void upsampleVelocity(float *vX, float *vY);
+        /* scheme used for DENSITY, VELOCITY_X and VELOCITY_Y
+        */
+        advectionScheme schemes[3];
+        /* scratch fields used by the higher order advection
+         * schemes, a velocity field and a density field
+        */
+        FieldClass<float> vScratch, dScratch;
+        /* semi-lagrangian pass over the fluid cells (the spans
+         * of solid) of numFields fields of n x n
+         * cells (row is the row stride), with a signed time
+         * step dT (in cells), a negative dT traces forward
+         * instead of back. The first numVel fields are velocity
+         * components
+        */
+        void advectionKernel(const ObstacleClass &solid, int n, int row, float dT, int numFields,
+                             int numVel, float **curr, float **prev, float *vX, float *vY);
+        /* clamp curr to the range of the 4 cells of prev that
+         * the back traced position falls between, this keeps
+         * the higher order schemes from creating new extremes
+        */
+        void advectionLimiter(const ObstacleClass &solid, int n, int row, float dT, int numFields,
+                              int numVel, float **curr, float **prev, float *vX, float *vY);
+        /* backends from the registry that are not built in
+         * (NULL for the solvers of this class), the advection
+         * one per attribute like schemes. forcedDiffusion is the
+         * diffusion mode that every non zero rate uses (-1 to
+         * pick it from the rate)
+        */
+        PoissonBackendClass<FluidLayoutClass> *poissonBackend;
+        DiffusionBackendClass<FluidLayoutClass> *diffusionBackend;
+        AdvectionBackendClass<FluidLayoutClass> *advectionBackends[3];
+        int forcedDiffusion;
+        /* set while solvePoisson runs with p = 0 on every side
+        */
+        bool zeroPoissonSides;
+        /* plan for the current step and the last one that was
+         * reported
+        */
+        stepPlan plan, reportedPlan;
+        bool planReported;
+        float getDiffusionRate(attribute atType, float diff);
+        diffusionMode getDiffusionMode(float k, bool canSwap);
+        /* max velocity of vCurr that frameStep measured for the
+         * step it is about to take, so that buildPlan does not
+         * scan the field again. -1 when it is not known (a
+         * direct simulationStep, or the buoyancy changed the
+         * velocity since)
+        */
+        float stepMaxVelocity;
+        /* build the plan for the next step, and report it if
+         * it is different from the last one (with
+         * reportStepPlans)
+        */
+        void buildPlan(void);
+        /* diffuse prev into curr using the given mode, returns
+         * false when the result is prev itself (DIFFUSE_SWAP),
+         * then nothing is written to curr
+        */
+        bool runDiffusion(attribute atType, float *curr, float *prev, float diff,
+                          diffusionMode mode);
+        /* same for numFields fields, each with its own rate and
+         * mode, the implicit ones are solved in one sweep. Either
+         * all fields move to curr (the ones with DIFFUSE_SWAP are
+         * copied) or none does (all of them DIFFUSE_SWAP)
+        */
+        bool runDiffusionFused(int numFields, attribute *atTypes, float **curr, float **prev,
+                               const float *diff, const diffusionMode *modes);
+        /* one explicit step
+         * curr = prev + k * (sum of 4 neighbours of prev - 4 * prev)
+        */
+        void explicitDiffuse(attribute atType, float *curr, float *prev, float k);
+        /* the kernels that run on a single field, M is the
+         * layout of the field (L or S)
+        */
+        template<typename M>
+        void explicitDiffuseMap(attribute atType, float *curr, float *prev, float k);
+        /* Line implicit (ADI) diffusion
+         * The iterative solve moves information one cell per
+         * sweep, so with a large k (strong diffusion reaches
+         * far) kIter sweeps are nowhere near the solution. But
+         * along a single row the implicit equation
+         *      (1 + 2k) x(i) - k x(i-1) - k x(i+1) = b(i)
+         * is tridiagonal and the Thomas algorithm solves it
+         * exactly in one pass forward and one pass back.
+         *
+         * So the 2D step is split into an implicit step along
+         * x (every row) followed by one along y (every column)
+         *      (1 - k Dxx) tmp = prev
+         *      (1 - k Dyy) curr = tmp
+         * Both are backward Euler, so the result is stable and
+         * smooth for any k, and it differs from the full
+         * implicit step only by k^2 Dxx Dyy (which is small for
+         * the smooth part of the field that survives a strong
+         * diffusion). The walls are part of the end rows of
+         * the system (a ghost cell is +/- its neighbour).
+         *
+         * The coefficients are the same for every line, so the
+         * elimination factors are computed once per pass, and 8
+         * lines run side by side in one AVX register: 8 rows
+         * for the x pass, the 8 columns of a row segment for the
+         * y pass
+        */
+        void adiDiffuse(attribute atType, float *curr, float *prev, float k);
+        template<typename M>
+        void adiDiffuseMap(attribute atType, float *curr, float *prev, float k);
+        /* the sides of atType whose ghost cells the sweeps fold
+         * into the cells next to them (ghost = -inside, see
+         * sideFold in Boundary.h)
+        */
+        void getSideFold(attribute atType, float k, sideFold &fold);
+        template<typename M>
+        void iterSolveMap(attribute atType, float *curr, float *prev, float k, int numIter,
+                          float w);
+        template<typename M>
+        void chebyshevSolveMap(attribute atType, float *curr, float *prev, float k,
+                               int numIter);
+        template<typename M>
+        void setBoundariesMap(attribute atType, float *arr);
+        /* the ghost rows (bottom, top) and the 4 corners, the
+         * part of setBoundaries that needs the whole interior.
+         * The sweeps fill the ghost columns of a row as soon as
+         * the row is done (it is still in the cache) and call
+         * this at the end
+        */
+        template<typename M>
+        void setRowBoundariesMap(attribute atType, float *arr);
+        /* Obstacles
+         * The solid cells on the density and on the velocity
+         * grid, rasterized from the same shapes. Every kernel
+         * only runs over the fluid spans of the rows, so the
+         * solid cells are never updated, and the interface cells
+         * (solid cells next to fluid) act as ghost cells:
+         *      velocity          -(mean of the fluid neighbours),
+         *                        0 on the surface (no-slip)
+         *      density, pressure  mean of the fluid neighbours,
+         *                        no change across the surface
+         * fillObstaclesMap sets them, with the domain sides in
+         * setBoundariesMap and at the end of every sweep of the
+         * iterative solvers
+        */
+        ObstacleClass dObstacles, vObstacles;
+        bool hasObstacles(void);
+        /* tracer particles moved after every step (NULL for
+         * none), see setParticles
+        */
+        ParticleClass *tracers;
+        void advanceParticles(void);
+        template<typename M>
+        void fillObstaclesMap(attribute atType, float *arr);
+        /* The solid cells away from the fluid are 0, but the
+         * velocity fields also hold the (scalar) divergence,
+         * pressure and solver scratch data in between, which
+         * land on other cells in the velocity layout. Only the
+         * interpolation in advection can reach past the
+         * interface cells, so the velocity it reads is reset
+         * (all solid cells 0, then the interface) before it
+         * runs
+        */
+        void resetObstacles(attribute atType, float *arr);
+        template<typename M>
+        void resetObstaclesMap(attribute atType, float *arr);
+        /* Scalar fields
+         * Scalar 0 is the density (dCurr, dPrev and dScratch),
+         * the ones added with addScalar are scalars[id-1]. All of
+         * them are diffused in one runDiffusionFused and advected
+         * in one advectionFused, they trade their buffers
+         * together
+        */
+        std::vector<scalarField> scalars;
+        int getScalarCount(void);
+        float getScalarDiffusion(int id);
+        /* the latest values of a scalar (latest) or its other
+         * buffer, and its scratch field
+        */
+        float *getScalarField(int id, bool latest);
+        float *getScalarScratch(int id);
+        /* Boussinesq buoyancy, see setBuoyancy. buoyancyScalar
+         * is -1 when it is off
+        */
+        int buoyancyScalar;
+        float buoyancyAmbient, buoyancyStrength;
+        /* add the buoyancy force of one step to vCurr
+        */
+        void addBuoyancy(void);
+        /* type of every side (in the order of boundarySide)
+         * and the speed of an inflow side, into the domain
+        */
+        domainBoundary sides[4];
+        float inflowSpeed[4];
+        /* policy (see Boundary.h) and value of a side for an
+         * attribute
+         *                  velocity     velocity      density   pressure
+         *                  normal       along side
+         *      WALL        reflect      continuity    continuity continuity
+         *      PERIODIC    periodic     periodic      periodic  periodic
+         *      INFLOW      inflow(v)    inflow(0)     continuity continuity
+         *      OUTFLOW     outflow      outflow       outflow   p = 0
+         * The pressure is fixed (to 0) only at an outflow, every
+         * other side only has a given velocity (or none)
+        */
+        boundaryPolicy getBoundaryPolicy(attribute atType, boundarySide side);
+        float getBoundaryValue(attribute atType, boundarySide side);
+        /* axis 0 (x, LEFT and RIGHT) or 1 (y, BOTTOM and TOP)
+        */
+        bool isPeriodic(int axis);
+        /* range that a back traced position is kept in along an
+         * axis of a grid of n cells. Against a wall, inflow or
+         * outflow the position is clamped to [0.5, (n-2) + 0.5]
+         * (the 4 cells to interpolate from include the border
+         * cells). A periodic position wraps around by period
+         * (the interior), into [1, n-1)
+        */
+        void getTraceRange(int n, int axis, float &lo, float &hi, float &period);
+        template<typename M>
+        void copyMap(attribute atType, float *curr, float *prev);
+        /* stages run by simulationStep
+        */
+        std::vector<stepStage> pipeline;
+        /* run a list of stages. Every stage reads the velocity
+         * and density from wherever the previous stage left
+         * them, so stages can come in any order. At the end the
+         * velocity is back in vCurr and the density in dPrev
+         * (by swapping the fields if needed)
+        */
+        void runStages(const std::vector<stepStage> &stages);
+        /* turn a preset name or a comma separated list of stage
+         * names into stages, false if a name is unknown
+        */
+        bool parsePipeline(const std::string &spec, std::vector<stepStage> &stages);
+        bool validatePipeline(const std::vector<stepStage> &stages);
         /* Iterative solver using Gauss_Seidel method 
          * 4x - 2y + z = -2
          * 3x + 6y - 2z = 49
@@ -83,8 +521,48 @@ class FluidClass{
          * numIter times
          * 
          * curr = (prev + k(sCurr))/(1 + 4k)
+         *
+         * NOTE: the sweeps use the relaxation set for atType,
+         * see setRelaxation
         */
         void iterSolve(attribute atType, float *curr, float *prev, float k, int numIter);
+        /* Gauss-Seidel on numFields fields (right hand sides
+         * prev[f], rates k[f] and relaxation factors w[f]) in the
+         * same sweep. The update of a cell only reads its own
+         * field, so every field gets exactly the result of its
+         * own iterSolve, but the loop, the index math and the
+         * neighbour offsets are shared and the fields are walked
+         * through once per sweep instead of once per field.
+         * Velocity components and scalar fields can be mixed,
+         * they have to be on the same grid
+        */
+        void iterSolveFused(int numFields, attribute *atTypes, float **curr, float **prev,
+                            const float *k, int numIter, const float *w);
+        /* relaxation method of DENSITY, VELOCITY_X, VELOCITY_Y
+         * and CLEAR_DIVERGENCE
+        */
+        relaxationMethod relaxations[4];
+        /* largest eigenvalue (in magnitude) of the Jacobi
+         * iteration of an attribute, apart from the constant
+         * mode of the pressure which does not matter. The
+         * slowest error mode is the longest wave that fits the
+         * walls, for a grid of m = n-2 unknowns per row
+         *      rho = 4k/denom * (1 + cos(pi/m))/2
+         * Gauss-Seidel reduces that mode by rho^2 per sweep,
+         * which at N = 128 is 0.9997
+        */
+        float getJacobiRadius(attribute atType, float k);
+        /* optimal SOR factor for that radius
+         *      w = 2/(1 + sqrt(1 - rho^2))
+         * 1 for GAUSS_SEIDEL
+        */
+        float getRelaxationFactor(attribute atType, float k);
+        /* second buffer of the Jacobi sweeps, a scratch field
+         * on the grid of the attribute that is free while it is
+         * being solved
+        */
+        float *getSolveScratch(attribute atType);
+    public:
         /* Boundaries in the grid
          * We assume that the fluid is contained in a
          * box with solid walls: no flow should exit the walls. 
@@ -110,7 +588,14 @@ class FluidClass{
          *                              0.5 * (2 nearest cells)
         */
         void setBoundaries(attribute atType, float *arr);
-    public:
+        /* padded row stride for a grid of n cells, rounded up
+         * to a whole number of cache lines. Rows that are a
+         * power of two apart in memory map to the same cache
+         * sets, so the stencil reads of the rows above and below
+         * (and the fields at the same offset) keep evicting each
+         * other. One extra cache line per row breaks that up
+        */
+        static int paddedStride(int n);
         /* Fluid representaion based on a grid with
          * stationary regions (NxN regions), with 
          * attributes - density and velocity that
@@ -122,6 +607,17 @@ class FluidClass{
          * N-1 x N-1 grid 
         */
         int N;
+        /* velocity grid is vFactor times coarser than the
+         * density grid, i.e (vN-2) = (N-2)/vFactor. With
+         * vFactor = 1 both grids are the same
+        */
+        int vN, vFactor;
+        /* floats between the start of two rows of the density
+         * and the velocity fields, index with getIdx(i, j, stride)
+         * and getIdx(i, j, vStride). Equal to N and vN when
+         * padStrides is off
+        */
+        int stride, vStride;
         /* this is the time step resolution
          * In the simulation, we take snapshot of
          * all the attributes in a given time, then
@@ -140,9 +636,11 @@ class FluidClass{
         float dDiff, vDiff;
         /* current densitiy and prev density for all grid cells
         */
-        float *dCurr, *dPrev;
+        FieldClass<float> dCurr, dPrev;
         /* current velocity and previous velocity
-         * for all grid cells in x and y axis
+         * for all grid cells in x and y axis, both
+         * components are stored in one field in layout L
+         * (use getComponent for the x and y parts)
          *
          * The velocity attribute tells us how
          * fast the fluid is moving and in what
@@ -153,23 +651,68 @@ class FluidClass{
          * depends on the velocity, even the velocity
          * attribute itself (self advection)
         */
-        float *vXCurr, *vXPrev;
-        float *vYCurr, *vYPrev;
+        FieldClass<float> vCurr, vPrev;
+        /* velocity upsampled to the density grid, only
+         * allocated when vFactor > 1
+        */
+        FieldClass<float> vUp;
+        /* the x (VELOCITY_X) or y (VELOCITY_Y) component of a
+         * velocity field, cell (i,j) of the component is at
+         * [L::cell(i, j, stride of the field)]
+        */
+        float *getComponent(FieldClass<float> &vel, attribute atType);
 
         /* constructor takes in N (NxN will be grid size), 
          * time step dt (how big each step is), rates of
          * diffusion - density diffusion and viscous diffusion
+         * and the coarsening factor of the velocity grid
         */
-        FluidClass(int _N, float _dDiff, float _vDiff, float _dt);
-        /* destructor needs to free all dynamic memory allocated
+        FluidLayoutClass(int _N, float _dDiff, float _vDiff, float _dt, int _vFactor);
+        /* all the fields live in the arena, which releases
+         * them in one go
         */
-        ~FluidClass(void);
+        ~FluidLayoutClass(void);
+        /* A simulation can be moved (the fields are handed
+         * over, nothing is copied) but not copied implicitly,
+         * clone() makes an independent copy of the whole state
+         * (fields, schemes, pipeline) that can be stepped on its
+         * own, to snapshot a simulation or fork it
+        */
+        FluidLayoutClass(FluidLayoutClass &&other) = default;
+        FluidLayoutClass &operator=(FluidLayoutClass &&other) = default;
+        FluidLayoutClass(const FluidLayoutClass&) = delete;
+        FluidLayoutClass &operator=(const FluidLayoutClass&) = delete;
+        FluidLayoutClass clone(void);
         /* The solver will sove the 3 terms that appear in the
          * equation in the reverse order. So, the first one
          * is adding source
+         *
+         * NOTE: (i,j) is always a cell of the density grid,
+         * velocity sources are added to the velocity cell
+         * that contains it
         */
         void addDensitySource(int i, int j, float amount);
         void addVelocitySource(int i, int j, float amountX, float amountY);
+        /* Scalar fields
+         * Besides the density, up to kMaxScalars - 1 more scalar
+         * fields (dye channels, temperature ...) can be added,
+         * each with its own diffusion rate. addScalar returns the
+         * id of the new scalar (-1 when there is no room), the
+         * density is scalar 0. All scalars are diffused and
+         * advected together with the density, in the same passes
+        */
+        int addScalar(float diff);
+        void addScalarSource(int id, int i, int j, float amount);
+        float getScalar(int id, int i, int j);
+        /* Boussinesq buoyancy
+         * Warm fluid rises: every step adds
+         *      dt * strength * (T - ambient)
+         * to the y component of the velocity, where T is scalar
+         * id (the temperature, averaged over the density cells of
+         * a velocity cell). The density of the fluid is otherwise
+         * taken as constant. An id of -1 turns it off
+        */
+        void setBuoyancy(int id, float ambient, float strength);
         /* The second is diffusion
          *
          * diffuse function which is used for density
@@ -227,6 +770,17 @@ class FluidClass{
          * have solved for dNext
         */
         void diffuse(attribute atType, float *curr, float *prev, float diff);
+        /* diffuse numFields fields (both velocity components,
+         * passive scalars) that share the diffusion rate diff,
+         * with iterSolveFused when the solve is implicit. At most
+         * kMaxFusedFields
+        */
+        void diffuseFused(int numFields, attribute *atTypes, float **curr, float **prev,
+                          float diff);
+        /* print the current step plan, with reportStepPlans
+         * this is also done every time the plan changes
+        */
+        void printPlan(void);
         /* The third and final term is advection
          * Advection is where the attribute follows the velocity field,
          * denisty and velocity itself
@@ -308,8 +862,141 @@ class FluidClass{
          * 
          * This will be the new density after advection
          * dNext
+         *
+         * NOTE: vX and vY (and curr, prev for a velocity
+         * attribute) are components of a velocity field, see
+         * getComponent
         */   
         void advection(attribute atType, float *curr, float *prev, float *vX, float *vY); 
+        /* Every field that lives on the same grid and follows
+         * the same velocity field has the same back traced
+         * position 'o' and the same weights s0, s1, t0, t1, only
+         * the 4 values that we interpolate are different.
+         *
+         * So instead of tracing back once per field, we trace
+         * back once per cell and interpolate all numFields
+         * fields (curr[k] from prev[k]) with the same weights.
+         * The velocity is read once per cell instead of once
+         * per field
+         *
+         * NOTE: every attribute can appear at most once
+        */
+        void advectionFused(int numFields, attribute *atTypes, float **curr, float **prev,
+                            float *vX, float *vY);
+        /* The bilinear interpolation in advection smooths the
+         * field a little every step (numerical diffusion), so
+         * small vortices fade out unless the grid is very fine.
+         *
+         * MacCormack: advect forward to get q1 = A(q), then
+         * advect q1 backward (with -v) to get q2. If A was
+         * perfect q2 would be q, so (q - q2)/2 is an estimate of
+         * the error of one step and
+         *      qNext = q1 + (q - q2)/2
+         *
+         * BFECC: same error estimate, but it is removed from q
+         * before advecting
+         *      qNext = A(q + (q - q2)/2)
+         *
+         * Both are second order, but can overshoot near sharp
+         * edges, so the result is clamped to the min/max of the
+         * 4 cells that the semi-lagrangian step interpolates
+         * from (limiter).
+         *
+         * The scheme is chosen per attribute, the default is
+         * SEMI_LAGRANGIAN
+        */
+        void setAdvectionScheme(attribute atType, advectionScheme scheme);
+        /* Gauss-Seidel removes the short waves of the error in
+         * a few sweeps, but the long ones (a pressure that has to
+         * build up across the whole box) lose only a tiny part
+         * every sweep, so kIter sweeps leave most of them.
+         *
+         * SOR: after the Gauss-Seidel value of a cell is found,
+         * move past it
+         *      curr = curr + w * (gaussSeidel - curr)
+         * with w between 1 and 2. With the optimal w the slowest
+         * mode shrinks by w - 1 per sweep instead of rho^2.
+         *
+         * CHEBYSHEV: plain Jacobi sweeps combined with the two
+         * previous iterates,
+         *      x(m+1) = x(m-1) + w(m+1) * (jacobi(x(m)) - x(m-1))
+         * the weights make the error after m sweeps a Chebyshev
+         * polynomial of the Jacobi matrix, the smallest possible
+         * on [-rho, rho]. A cell only reads the previous sweep,
+         * so the loop has no dependency between cells (it
+         * vectorizes, and the rows could be split between
+         * threads)
+         *
+         * The method is chosen per attribute (CLEAR_DIVERGENCE
+         * is the pressure solve), the default is SOR for the
+         * pressure and GAUSS_SEIDEL for the rest
+        */
+        void setRelaxation(attribute atType, relaxationMethod method);
+        /* Solver backends
+         * The pressure solve, the diffusion and the advection can
+         * be replaced by any backend of the registry (see
+         * Backend.h), by name. atType picks the field for
+         * BACKEND_ADVECTION (DENSITY for all the scalars) and is
+         * not used for the other kinds. The built in names set
+         * the relaxation of the pressure, the diffusion mode or
+         * the advection scheme. Returns false (and keeps the
+         * current backend) if there is no such name
+        */
+        bool setBackend(backendKind kind, attribute atType, const std::string &name);
+        /* several at once, a comma separated list of
+         * role=name with the roles
+         *   "poisson", "diffusion", "advection" (every field),
+         *   "advection-velocity", "advection-density"
+         * for example "poisson=chebyshev, advection=maccormack".
+         * Stops at the first entry that is not valid
+        */
+        bool setBackends(const std::string &spec);
+        /* Sides of the domain
+         * By default all 4 sides are walls (a closed box). A side
+         * can be turned into
+         *   DOMAIN_PERIODIC - always set on both sides of an axis,
+         *                     setting it on one side also sets the
+         *                     opposite one (and replacing it on one
+         *                     side turns the other one into a wall)
+         *   DOMAIN_INFLOW   - the velocity on the side is speed
+         *                     (in the units of the velocity field)
+         *                     into the domain, and 0 along it
+         *   DOMAIN_OUTFLOW  - the velocity and density leave with
+         *                     no change, the pressure is 0
+         * The diffusion, the advection (which wraps around across
+         * periodic sides) and the projection use the same sides.
+         *
+         * The pressure equation with no outflow side only has a
+         * solution when the divergence adds up to 0 (the fluid
+         * that comes in has to leave), so then its mean is removed
+         * before solving. An inflow needs an outflow to make sense
+        */
+        void setBoundary(boundarySide side, domainBoundary type, float speed);
+        /* Internal obstacles
+         * addObstacle marks every cell (of both grids) whose
+         * center is inside the shape as solid, see Obstacle.h.
+         * The fluid in solid cells is removed, sources added to
+         * them are ignored and the fluid flows around them with
+         * no-slip walls. A scene with obstacles diffuses with the
+         * iterative solvers (the ADI lines would have to be cut
+         * at every obstacle)
+        */
+        void addObstacle(const obstacleShape &shape);
+        void clearObstacles(void);
+        /* cell (i,j) of the density grid is solid
+        */
+        bool isSolid(int i, int j);
+        /* the obstacles of the grid of an attribute
+        */
+        const ObstacleClass &getObstacles(attribute atType);
+        /* Tracer particles
+         * The particles are moved through the velocity field at
+         * the end of every step (every substep of frameStep), by
+         * the same dt, and culled at outflow sides and obstacles.
+         * The simulation does not own them, NULL detaches them.
+         * A clone starts without particles
+        */
+        void setParticles(ParticleClass *particles);
         /* Clearing divergence of the vector field.
          * This is only used on the velocity attribute, so no
          * parameters are passed in.
@@ -366,19 +1053,92 @@ class FluidClass{
          * 
          * vXCurr = vXCurr - (p(i+1,j) - p(i-1,j))/2
          * vYCurr = vYCurr - (p(i,j+1) - p(i,j-1))/2 
+         *
+         * NOTE: vX and vY are velocity components, div and p
+         * scalar fields (layout S) on the velocity grid
         */
         void clearDivergence(float *vX, float *vY, float *div, float *p);
+        /* The pressure solve of clearDivergence on its own, with
+         * the relaxation or the Poisson backend of the simulation
+         *      4 p(i,j) - (sum of the 4 neighbours) = rhs(i,j)
+         * p and rhs are scalar fields on the velocity grid, p
+         * holds the starting guess. With zeroSides p is 0 on every
+         * side (halfway between the border cell and the first
+         * inside cell) instead of following the pressure
+         * boundaries, that is what VorticityFluidClass needs for
+         * its streamfunction
+        */
+        void solvePoisson(float *p, float *rhs, bool zeroSides);
         /* This is the density solver and the velocity solver 
          * function that we call every time step
         */           
         void densityStep(void);
         void velocityStep(void);
-        /* simulation step combines both
-         * of the above steps
+        /* simulation step runs the configured pipeline of
+         * stages, by default it combines both of the above
+         * steps
          * (1) velocity step
          * (2) density step
+         *
+         * NOTE: when both grids are the same, the velocity
+         * and density advection are fused into one pass
         */
         void simulationStep(void);
+        /* Configure the stages of simulationStep, either a preset
+         *   "stam"              - velocity step, then density step
+         *                         (diffuse, project, advect, project,
+         *                         diffuse density, advect density)
+         *   "fused"             - same, with the velocity and density
+         *                         advection in one pass (default)
+         *   "single-projection" - drops the first projection, which
+         *                         only improves the advection a little
+         *                         and costs a full pressure solve
+         *   "density-only"      - frozen velocity field, only the
+         *                         density is diffused and advected
+         * or a comma separated list of the stage names
+         *   "diffuse-velocity", "project", "advect-velocity",
+         *   "diffuse-density", "advect-density", "advect-all"
+         *
+         * The stages are validated, any velocity change has to be
+         * followed by a projection and every stage can run only
+         * once. Returns false (and keeps the current pipeline) if
+         * the list is not valid
+        */
+        bool setPipeline(const std::string &spec);
+        /* Adaptive time stepping
+         * The back trace in advection moves dt * (N-2) * v cells,
+         * when the fluid is fast this jumps over many cells and
+         * the result gets inaccurate, when it is calm a small dt
+         * is wasted work.
+         *
+         * maxVelocity() returns the largest velocity component
+         * in one pass over vCurr, and the CFL number
+         * of a step is
+         *      cfl = dt * (vN-2) * maxVelocity
+         * so the largest step that keeps cfl <= cflTarget is
+         *      dt = cflTarget/((vN-2) * maxVelocity)
+         *
+         * frameStep(frameDt) advances the simulation by exactly
+         * frameDt, using as many substeps (simulationStep) as
+         * needed, each with its own dt. A calm frame is a single
+         * step
+        */
+        float maxVelocity(void);
+        void frameStep(float frameDt);
+        /* density of cell (i,j) after the last simulation
+         * step, this is what we render
+        */
+        float getDensity(int i, int j);
+        /* bytes of the fields in the arena and of the scalars
+         * from addScalar
+        */
+        size_t getMemoryUsage(void);
+        /* bytes the arena reserved, with useHugePages rounded up
+         * to whole huge pages (2 MB)
+        */
+        size_t getReservedMemory(void);
 };
+
+typedef FluidLayoutClass<velocityLayout, densityLayout> FluidClass;
 #endif /* SIMULATION_FLUID_H
 */
@@ -0,0 +1,148 @@
+#ifndef SIMULATION_LBMFLUID_H
+#define SIMULATION_LBMFLUID_H
+
+#include "Fluid.h"
+#include <stddef.h>
+
+/* Lattice Boltzmann (D2Q9) version of FluidClass
+ *
+ * Instead of velocity and pressure every cell stores 9
+ * populations f(q), the amount of fluid moving with the
+ * lattice velocity c(q) (rest, the 4 sides and the 4 corners)
+ *
+ *      6   2   5
+ *        \ | /
+ *      3 - 0 - 1
+ *        / | \
+ *      7   4   8
+ *
+ * the density is the sum of the populations and the momentum
+ * the sum of f(q) c(q). A lattice step is
+ * (1) collide - every cell relaxes its populations toward the
+ *     equilibrium of its density and velocity, at the rate
+ *     1/tau that sets the viscosity (regularized BGK, only the
+ *     part of f - feq that belongs to the stress is kept, which
+ *     stays stable much closer to tau = 0.5)
+ * (2) stream - every population moves one cell along c(q),
+ *     at a wall it bounces back to the cell it came from
+ * There is no pressure solve, every cell only talks to its 8
+ * neighbours, so the rows are split over threads and every
+ * row is done 8 cells at a time with AVX2.
+ *
+ * The populations live in one buffer (9 floats per cell, not
+ * the 18 of an old/new pair), updated in place with the AA
+ * pattern. Even steps only collide: cell x reads f(q) from its
+ * own slot q and writes the result to its own slot opp(q).
+ * Odd steps stream, collide and stream again: cell x reads
+ * f(q) from slot opp(q) of the cell x - c(q) and writes the
+ * result to slot q of the cell x + c(q). In both steps a cell
+ * writes exactly the slots it read, so no two cells (or
+ * threads) touch the same memory. The walls are the border
+ * ring of cells, only the odd step streams, so only the odd
+ * step looks at them.
+ *
+ * The lattice moves one cell per lattice step, which makes the
+ * speed of sound 0.577 cells per step and the flow has to stay
+ * well below it. A time step of dt is split into as many
+ * lattice steps as keep the fastest cell under kLbmMaxSpeed
+ * (up to kLbmMaxSubsteps), the populations are rescaled when
+ * that number changes. The viscosity is vDiff (same units as
+ * FluidClass), with a floor of kLbmMinTau.
+ *
+ * A velocity source can not push a cell past kLbmMaxSpeed, so
+ * once kLbmMaxSubsteps is reached a strong source moves the
+ * fluid slower than it would in FluidClass.
+ *
+ * The density (dye) stays on the grid of a FluidClass. The
+ * lattice velocity is slightly compressible, and the
+ * semi-lagrangian advection of FluidClass would pile dye up
+ * (or lose it) where the flow converges, so the dye moves in
+ * flux form instead: every face between two cells passes the
+ * amount the face velocity carries from the upwind cell
+ * (second order, minmod limited slope), nothing passes the
+ * walls, and the total dye only changes by the sources and
+ * never goes negative. FluidClass does not conserve its dye,
+ * so the two engines do not show the same amount of dye for
+ * the same sources. The public interface (sources, stepping,
+ * density readout) is the same as FluidClass, only with walls
+ * on all 4 sides
+*/
+class LBMFluidClass{
+    private:
+        /* the grid that holds the density and the velocity
+         * readout
+        */
+        FluidClass grid;
+        /* row stride and cells per population
+        */
+        int stride, size;
+        /* the populations, f(q) of cell idx is in slot q at
+         * [q * size + idx] before an even step. The velocity
+         * sources of the next step
+        */
+        FieldClass<float> f, force;
+        /* dye flux through the faces of a sweep
+        */
+        FieldClass<float> flux;
+        /* the next lattice step is odd
+        */
+        bool odd;
+        /* lattice steps per time step, lattice velocity per
+         * FluidClass velocity (dt * (N-2) / substeps) and the
+         * relaxation time
+        */
+        int substeps;
+        float latticeScale, tau;
+
+        /* slot of f(q) of a cell between two lattice steps
+        */
+        int slot(int q);
+        /* the relaxation time for the current scale
+        */
+        void updateTau(void);
+        /* split the coming time step into enough lattice
+         * steps for the fastest cell vMax, and move the
+         * populations to the new lattice velocity
+        */
+        void rescale(float vMax);
+        /* add the velocity sources to the populations, the
+         * density of every cell stays the same
+        */
+        void applyForces(void);
+        void evenStep(void);
+        void oddStep(void);
+        /* one sweep of the dye d along the rows (step 1) or the
+         * columns (step stride) through the velocity component
+         * vel, courant is the cells a velocity of 1 moves
+        */
+        void transportDye(float *d, const float *vel, int step, float courant);
+    public:
+        int N;
+        float dt;
+        float dDiff, vDiff;
+
+        LBMFluidClass(int _N, float _dDiff, float _vDiff, float _dt);
+        ~LBMFluidClass(void);
+
+        void addDensitySource(int i, int j, float amount);
+        void addVelocitySource(int i, int j, float amountX, float amountY);
+
+        void densityStep(void);
+        void velocityStep(void);
+        void simulationStep(void);
+        /* the lattice steps already follow the speed of the
+         * flow, so a frame is a single step of frameDt
+        */
+        float maxVelocity(void);
+        void frameStep(float frameDt);
+        float getDensity(int i, int j);
+        /* velocity of cell (i,j) after the last step
+        */
+        float getVelocity(attribute atType, int i, int j);
+        /* lattice steps of the last time step
+        */
+        int getSubsteps(void);
+        size_t getMemoryUsage(void);
+};
+#endif /* SIMULATION_LBMFLUID_H
+*/
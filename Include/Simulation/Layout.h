@@ -0,0 +1,382 @@
+#ifndef SIMULATION_LAYOUT_H
+#define SIMULATION_LAYOUT_H
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* Memory layout of a field
+ * A field is n rows of row cells (row >= n, see paddedStride),
+ * the layout decides where cell (i,j) of component c is stored
+ * in the buffer that holds the field:
+ *      buffer[component(c, n, row) + cell(i, j, row)]
+ * so every kernel works with one pointer per component, and
+ * reads cell (i,j) from ptr[cell(i, j, row)]. size(n, row) is
+ * the number of floats the buffer needs
+ *
+ * The stencil kernels step from a cell to its neighbours with
+ * nextI/prevI (i +/- 1) and nextJ/prevJ (j +/- 1), which are
+ * cheaper than computing cell() again for layouts that are not
+ * plain rows
+ *
+ * Scalar fields (density, divergence, pressure)
+ * scalarLayout        - rows one after the other (row-major)
+ *                       | (0,0) (1,0) ... | (0,1) (1,1) ... |
+ * scalarZOrder        - 8 x 8 tiles, tiles are row-major and
+ *                       the cells of a tile are in Z-order
+ *                       (Morton order), see below
+ *
+ * Velocity fields, 2 components (x, y) per cell
+ * velocitySplit       - all x values, then all y values (SoA)
+ *                       | x0 x1 x2 ... | y0 y1 y2 ... |
+ * velocityInterleaved - (x, y) pairs (AoS), both components
+ *                       of a cell are on the same cache line
+ *                       | x0 y0 x1 y1 x2 y2 ... |
+ * velocityTiled       - 8 x values, then the same 8 y values
+ *                       (SoA of tiles), a tile of one component
+ *                       is one AVX register
+ *                       | x0..x7 y0..y7 | x8..x15 y8..y15 | ...
+ * velocityZOrder      - 2 scalarZOrder planes, x then y
+ *
+ * The layouts are compile time policies (template parameters
+ * of FluidLayoutClass), so the index math is inlined into the
+ * kernels. See Benchmark.cpp for how they compare
+*/
+struct scalarLayout{
+    /* cells (i,j) ... (i+7,j) are 8 consecutive floats
+    */
+    static const bool kContiguous = true;
+    static const char *name(void){
+        return "row-major";
+    }
+    static int size(int n, int row){
+        return n * row;
+    }
+    static int component(int c, int n, int row){
+        return c * n * row;
+    }
+    static int cell(int i, int j, int row){
+        return i + (j * row);
+    }
+    static int nextI(int c, int row){
+        (void)row;
+        return c + 1;
+    }
+    static int prevI(int c, int row){
+        (void)row;
+        return c - 1;
+    }
+    static int nextJ(int c, int row){
+        return c + row;
+    }
+    static int prevJ(int c, int row){
+        return c - row;
+    }
+#ifdef __AVX2__
+    static __m256i cell8(__m256i i, __m256i j, __m256i row){
+        return _mm256_add_epi32(i, _mm256_mullo_epi32(j, row));
+    }
+    static __m256i nextI8(__m256i c, __m256i row){
+        (void)row;
+        return _mm256_add_epi32(c, _mm256_set1_epi32(1));
+    }
+    static __m256i nextJ8(__m256i c, __m256i row){
+        return _mm256_add_epi32(c, row);
+    }
+#endif
+};
+
+/* Z-order (Morton order) inside 8 x 8 tiles
+ * The bits of the cell position inside the tile are
+ * interleaved, y2 x2 y1 x1 y0 x0, so
+ *
+ *      j
+ *      3 | 10 11 14 15
+ *      2 |  8  9 12 13     every 2 x 2 block is 4 consecutive
+ *      1 |  2  3  6  7     floats and every 4 x 4 block is 16
+ *      0 |  0  1  4  5     floats, one cache line
+ *        +------------ i
+ *
+ * A bilinear gather reads a 2 x 2 block around an arbitrary
+ * position, in row-major order that is 2 rows (row floats apart,
+ * 2 cache lines) while here it is 1 cache line most of the time.
+ * Tiles are 64 floats, a row of tiles holds 8 rows of the field
+ * so the tile rows are 8 * row floats apart like 8 rows are in
+ * row-major order
+ *
+ * Stepping to a neighbour is dilated integer arithmetic on the
+ * interleaved bits (the x bits of the code are set to 1 so that
+ * a carry runs through them), a carry out of the tile moves to
+ * the next tile
+*/
+struct scalarZOrder{
+    static const bool kContiguous = false;
+    static const int kTile = 8;
+    /* bits of the tile code that hold x and y
+    */
+    static const int kMaskX = 0x15;
+    static const int kMaskY = 0x2A;
+    static const char *name(void){
+        return "z-order";
+    }
+    static int tilesPerRow(int row){
+        return (row + kTile - 1) / kTile;
+    }
+    static int size(int n, int row){
+        return ((n + kTile - 1) / kTile) * tilesPerRow(row) * kTile * kTile;
+    }
+    static int component(int c, int n, int row){
+        return c * size(n, row);
+    }
+    /* spread the 3 bits of x to bits 0, 2 and 4
+    */
+    static int dilate(int x){
+        x = (x | (x << 2)) & 0x13;
+        return (x | (x << 1)) & kMaskX;
+    }
+    static int cell(int i, int j, int row){
+        int tile = (j / kTile) * tilesPerRow(row) + (i / kTile);
+        return (tile * kTile * kTile) | dilate(i % kTile) | (dilate(j % kTile) << 1);
+    }
+    static int nextI(int c, int row){
+        (void)row;
+        int w = c & 63;
+        int s = (w | kMaskY) + 1;
+        return ((c & ~63) + (s & 64)) | (s & kMaskX) | (w & kMaskY);
+    }
+    static int prevI(int c, int row){
+        (void)row;
+        int w = c & 63;
+        int d = (w & kMaskX) - 1;
+        return ((c & ~63) - ((d >> 31) & 64)) | (d & kMaskX) | (w & kMaskY);
+    }
+    static int nextJ(int c, int row){
+        int w = c & 63;
+        int s = (w | kMaskX) + 2;
+        return ((c & ~63) + (s >> 6) * tilesPerRow(row) * 64) | (s & kMaskY) | (w & kMaskX);
+    }
+    static int prevJ(int c, int row){
+        int w = c & 63;
+        int d = (w & kMaskY) - 2;
+        return ((c & ~63) - ((d >> 31) & 1) * tilesPerRow(row) * 64) | (d & kMaskY) | (w & kMaskX);
+    }
+#ifdef __AVX2__
+    static __m256i dilate8(__m256i x){
+        x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 2)), _mm256_set1_epi32(0x13));
+        x = _mm256_or_si256(x, _mm256_slli_epi32(x, 1));
+        return _mm256_and_si256(x, _mm256_set1_epi32(kMaskX));
+    }
+    static __m256i cell8(__m256i i, __m256i j, __m256i row){
+        const __m256i low = _mm256_set1_epi32(kTile - 1);
+        __m256i tpr = _mm256_srli_epi32(_mm256_add_epi32(row, low), 3);
+        __m256i tile = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(j, 3), tpr),
+                                        _mm256_srli_epi32(i, 3));
+        __m256i code = _mm256_or_si256(dilate8(_mm256_and_si256(i, low)),
+                                       _mm256_slli_epi32(dilate8(_mm256_and_si256(j, low)), 1));
+        return _mm256_or_si256(_mm256_slli_epi32(tile, 6), code);
+    }
+    static __m256i nextI8(__m256i c, __m256i row){
+        (void)row;
+        const __m256i tileMask = _mm256_set1_epi32(63);
+        __m256i w = _mm256_and_si256(c, tileMask);
+        __m256i s = _mm256_add_epi32(_mm256_or_si256(w, _mm256_set1_epi32(kMaskY)),
+                                     _mm256_set1_epi32(1));
+        __m256i base = _mm256_add_epi32(_mm256_andnot_si256(tileMask, c),
+                                        _mm256_and_si256(s, _mm256_set1_epi32(64)));
+        return _mm256_or_si256(_mm256_or_si256(base, _mm256_and_si256(s, _mm256_set1_epi32(kMaskX))),
+                               _mm256_and_si256(w, _mm256_set1_epi32(kMaskY)));
+    }
+    static __m256i nextJ8(__m256i c, __m256i row){
+        const __m256i tileMask = _mm256_set1_epi32(63);
+        __m256i w = _mm256_and_si256(c, tileMask);
+        __m256i s = _mm256_add_epi32(_mm256_or_si256(w, _mm256_set1_epi32(kMaskX)),
+                                     _mm256_set1_epi32(2));
+        /* a carry out of the tile moves down a row of tiles,
+         * which is 8 * row floats rounded up to whole tiles
+        */
+        __m256i tileRow = _mm256_slli_epi32(_mm256_srli_epi32(_mm256_add_epi32(row,
+                                            _mm256_set1_epi32(kTile - 1)), 3), 6);
+        __m256i carry = _mm256_srli_epi32(s, 6);
+        __m256i base = _mm256_add_epi32(_mm256_andnot_si256(tileMask, c),
+                                        _mm256_mullo_epi32(carry, tileRow));
+        return _mm256_or_si256(_mm256_or_si256(base, _mm256_and_si256(s, _mm256_set1_epi32(kMaskY))),
+                               _mm256_and_si256(w, _mm256_set1_epi32(kMaskX)));
+    }
+#endif
+};
+
+struct velocitySplit : scalarLayout{
+    static const char *name(void){
+        return "split";
+    }
+    static int size(int n, int row){
+        return 2 * n * row;
+    }
+};
+
+struct velocityInterleaved{
+    static const bool kContiguous = false;
+    static const char *name(void){
+        return "interleaved";
+    }
+    static int size(int n, int row){
+        return 2 * n * row;
+    }
+    static int component(int c, int n, int row){
+        (void)n;
+        (void)row;
+        return c;
+    }
+    static int cell(int i, int j, int row){
+        return 2 * (i + (j * row));
+    }
+    static int nextI(int c, int row){
+        (void)row;
+        return c + 2;
+    }
+    static int prevI(int c, int row){
+        (void)row;
+        return c - 2;
+    }
+    static int nextJ(int c, int row){
+        return c + 2 * row;
+    }
+    static int prevJ(int c, int row){
+        return c - 2 * row;
+    }
+#ifdef __AVX2__
+    static __m256i cell8(__m256i i, __m256i j, __m256i row){
+        return _mm256_slli_epi32(_mm256_add_epi32(i, _mm256_mullo_epi32(j, row)), 1);
+    }
+    static __m256i nextI8(__m256i c, __m256i row){
+        (void)row;
+        return _mm256_add_epi32(c, _mm256_set1_epi32(2));
+    }
+    static __m256i nextJ8(__m256i c, __m256i row){
+        return _mm256_add_epi32(c, _mm256_slli_epi32(row, 1));
+    }
+#endif
+};
+
+struct velocityTiled{
+    static const bool kContiguous = false;
+    static const int kTile = 8;
+    static const char *name(void){
+        return "tiled";
+    }
+    static int size(int n, int row){
+        return 2 * ((n * row + kTile - 1) / kTile * kTile);
+    }
+    static int component(int c, int n, int row){
+        (void)n;
+        (void)row;
+        return c * kTile;
+    }
+    /* row-major index to the position in the tiles, and back
+    */
+    static int map(int idx){
+        return ((idx / kTile) * 2 * kTile) + (idx % kTile);
+    }
+    static int unmap(int c){
+        return ((c / (2 * kTile)) * kTile) + (c % kTile);
+    }
+    static int cell(int i, int j, int row){
+        return map(i + (j * row));
+    }
+    static int nextI(int c, int row){
+        (void)row;
+        return map(unmap(c) + 1);
+    }
+    static int prevI(int c, int row){
+        (void)row;
+        return map(unmap(c) - 1);
+    }
+    static int nextJ(int c, int row){
+        return map(unmap(c) + row);
+    }
+    static int prevJ(int c, int row){
+        return map(unmap(c) - row);
+    }
+#ifdef __AVX2__
+    static __m256i map8(__m256i idx){
+        __m256i tile = _mm256_slli_epi32(_mm256_srli_epi32(idx, 3), 4);
+        return _mm256_add_epi32(tile, _mm256_and_si256(idx, _mm256_set1_epi32(kTile - 1)));
+    }
+    static __m256i unmap8(__m256i c){
+        __m256i tile = _mm256_slli_epi32(_mm256_srli_epi32(c, 4), 3);
+        return _mm256_add_epi32(tile, _mm256_and_si256(c, _mm256_set1_epi32(kTile - 1)));
+    }
+    static __m256i cell8(__m256i i, __m256i j, __m256i row){
+        return map8(_mm256_add_epi32(i, _mm256_mullo_epi32(j, row)));
+    }
+    static __m256i nextI8(__m256i c, __m256i row){
+        (void)row;
+        return map8(_mm256_add_epi32(unmap8(c), _mm256_set1_epi32(1)));
+    }
+    static __m256i nextJ8(__m256i c, __m256i row){
+        return map8(_mm256_add_epi32(unmap8(c), row));
+    }
+#endif
+};
+
+struct velocityZOrder : scalarZOrder{
+    static const char *name(void){
+        return "z-order";
+    }
+    static int size(int n, int row){
+        return 2 * scalarZOrder::size(n, row);
+    }
+};
+
+#ifdef __AVX2__
+/* cells (i,j) ... (i+7,j), a plain load/store when the layout
+ * is contiguous, otherwise a gather and a store of the single
+ * lanes
+*/
+template<typename M>
+inline __m256 loadCells8(const float *p, int i, int j, int row){
+    if(M::kContiguous)
+        return _mm256_loadu_ps(p + M::cell(i, j, row));
+    __m256i vI = _mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    return _mm256_i32gather_ps(p, M::cell8(vI, _mm256_set1_epi32(j), _mm256_set1_epi32(row)), 4);
+}
+
+template<typename M>
+inline void storeCells8(float *p, int i, int j, int row, __m256 v){
+    if(M::kContiguous){
+        _mm256_storeu_ps(p + M::cell(i, j, row), v);
+        return;
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, v);
+    for(int k = 0; k < 8; k++)
+        p[M::cell(i + k, j, row)] = lanes[k];
+}
+
+/* cells (i,j) ... (i,j+7), one cell from each of 8 rows (so
+ * a kernel that runs along the rows can process 8 rows in one
+ * register), always a gather and single stores
+*/
+template<typename M>
+inline __m256 loadColumn8(const float *p, int i, int j, int row){
+    __m256i vJ = _mm256_add_epi32(_mm256_set1_epi32(j), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    return _mm256_i32gather_ps(p, M::cell8(_mm256_set1_epi32(i), vJ, _mm256_set1_epi32(row)), 4);
+}
+
+template<typename M>
+inline void storeColumn8(float *p, int i, int j, int row, __m256 v){
+    float lanes[8];
+    _mm256_storeu_ps(lanes, v);
+    for(int k = 0; k < 8; k++)
+        p[M::cell(i, j + k, row)] = lanes[k];
+}
+#endif
+
+/* layouts used by FluidClass, for the velocity and for the
+ * scalar fields
+*/
+typedef velocitySplit velocityLayout;
+typedef scalarLayout densityLayout;
+
+#endif /* SIMULATION_LAYOUT_H
+*/
@@ -0,0 +1,137 @@
+#ifndef SIMULATION_MACFLUID_H
+#define SIMULATION_MACFLUID_H
+
+#include "Fluid.h"
+#include <stddef.h>
+
+/* Staggered (MAC) grid version of FluidClass
+ *
+ * FluidClass stores both velocity components at the cell
+ * centers, so the divergence and the pressure gradient are
+ * central differences over 2 cells:
+ *      div(i,j) ~ v(i+1,j) - v(i-1,j) + ...
+ * A velocity (or pressure) field that alternates from cell
+ * to cell (checkerboard) has a zero difference there, the
+ * projection cannot see it and it is never removed.
+ *
+ * Here the density and the pressure stay at the cell centers
+ * and the velocity components live on the faces of the cells,
+ * u on the left/right faces and v on the bottom/top faces:
+ *
+ *          v(i,j+1)
+ *       +----^----+
+ *       |         |
+ *  u(i,j) >  d,p  > u(i+1,j)       cell (i,j)
+ *       |         |
+ *       +----^----+
+ *           v(i,j)
+ *
+ * so u(i,j) is the face between cell i-1 and cell i, and v(i,j)
+ * the face between cell j-1 and cell j. The divergence of a cell
+ * and the pressure gradient across a face are differences of
+ * direct neighbours (compact stencil)
+ *      div(i,j) = u(i+1,j) - u(i,j) + v(i,j+1) - v(i,j)
+ *      u(i,j)  -= p(i,j) - p(i-1,j)
+ * which removes every mode the grid can hold, and the wall
+ * condition (no flow through the wall) is exact, the faces on
+ * the walls are simply 0.
+ *
+ * The grid is the one of FluidClass (N x N cells including the
+ * border ring, cell (i,j) has its center at (i,j) in cell
+ * units). u has N+1 columns of faces and v has N+1 rows. The
+ * steps are the same (diffuse, project, advect, project for
+ * the velocity, diffuse and advect for the density), and so
+ * is the public interface (sources, stepping, density readout)
+*/
+class MACFluidClass{
+    private:
+        /* row strides of the density/pressure fields, the u
+         * faces (N+1 per row) and the v faces (N per row)
+        */
+        int stride, uStride, vStride;
+        ArenaClass arena;
+        /* scratch velocity, divergence and pressure
+        */
+        FieldClass<float> uPrev, vPrev, div, p;
+
+        int getIdx(attribute atType, int i, int j);
+        /* the range of cells (faces) of a field that are
+         * unknowns, every other entry is a wall or a border
+         * cell and is set by setBoundaries
+        */
+        void getInterior(attribute atType, int &i0, int &i1, int &j0, int &j1);
+        /* walls: the normal component on a wall face is 0, the
+         * tangential component and the density/pressure in the
+         * border cells copy the nearest interior value (same
+         * as FluidClass::setBoundaries)
+        */
+        void setBoundaries(attribute atType, float *arr);
+        /* bilinear sample at (x,y) in cell units, the position is
+         * clamped to the region where the field is defined
+        */
+        float sample(attribute atType, float *arr, float x, float y);
+        /* velocity at (x,y), for the back trace
+        */
+        void velocityAt(float *velU, float *velV, float x, float y, float &vx, float &vy);
+        void iterSolve(attribute atType, float *curr, float *prev, float k, int numIter);
+    public:
+        int N;
+        float dt;
+        float dDiff, vDiff;
+        /* density at the cell centers, sources are added to
+         * dPrev which is also what is rendered (like FluidClass)
+        */
+        FieldClass<float> dCurr, dPrev;
+        /* face velocities, u(i,j) is at [i + j * stride of u]
+         * and v(i,j) at [i + j * stride of v]
+        */
+        FieldClass<float> u, v;
+
+        /* same arguments as FluidClass, without the coarser
+         * velocity grid (every face already sits between two
+         * density cells)
+        */
+        MACFluidClass(int _N, float _dDiff, float _vDiff, float _dt);
+        ~MACFluidClass(void);
+
+        int getStride(attribute atType);
+        /* (i,j) is a cell, the velocity source is added to
+         * both faces of the cell in each direction, so the
+         * velocity at the cell center changes by amountX,
+         * amountY
+        */
+        void addDensitySource(int i, int j, float amount);
+        void addVelocitySource(int i, int j, float amountX, float amountY);
+
+        /* same diffusion rate k as FluidClass, one explicit
+         * step below kExplicitLimit, Gauss-Seidel above it
+        */
+        void diffuse(attribute atType, float *curr, float *prev, float diff);
+        /* semi-lagrangian advection of a cell (DENSITY) or face
+         * (VELOCITY_X/Y) field, traced back through the face
+         * velocities velU, velV
+        */
+        void advection(attribute atType, float *curr, float *prev, float *velU, float *velV);
+        /* projection with the compact stencil, p is solved with
+         * kIter Gauss-Seidel sweeps
+        */
+        void clearDivergence(float *velU, float *velV);
+        /* largest |div| of the face velocities (in cells per
+         * unit time), to check the projection
+        */
+        float maxDivergence(float *velU, float *velV);
+
+        void densityStep(void);
+        void velocityStep(void);
+        void simulationStep(void);
+        /* same adaptive stepping as FluidClass::frameStep
+         * (frameSubsteps)
+        */
+        float maxVelocity(void);
+        void frameStep(float frameDt);
+        float getDensity(int i, int j);
+        size_t getMemoryUsage(void);
+        size_t getReservedMemory(void);
+};
+#endif /* SIMULATION_MACFLUID_H
+*/
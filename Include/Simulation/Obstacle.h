@@ -0,0 +1,114 @@
+#ifndef SIMULATION_OBSTACLE_H
+#define SIMULATION_OBSTACLE_H
+
+#include <stdint.h>
+#include <vector>
+
+/* Shapes that obstacles are built from, given by their signed
+ * distance (negative inside, positive outside). Positions and
+ * sizes are in the unit square of the domain, so the same
+ * shape covers the same area on grids of any size
+ * SHAPE_CIRCLE - center (x,y), radius a
+ * SHAPE_BOX    - center (x,y), half width a, half height b
+*/
+typedef enum{
+    SHAPE_CIRCLE,
+    SHAPE_BOX
+}shapeType;
+
+typedef struct{
+    shapeType type;
+    float x, y;
+    float a, b;
+}obstacleShape;
+
+float signedDistance(const obstacleShape &shape, float x, float y);
+
+/* A solid cell that has fluid next to it, fluid holds one bit
+ * per side (left, right, bottom, top) for the neighbours that
+ * are fluid. The solid cells are the ghost cells of the fluid
+ * around an obstacle, and only these are ever read by the
+ * stencils
+*/
+typedef struct{
+    int i, j;
+    int fluid;
+}interfaceCell;
+
+/* Solid cells inside the domain of a grid of n x n cells
+ *
+ * The solid cells are a bitmask, one bit per cell. From it
+ * two compact lists are built once, when the obstacles change:
+ * (1) the fluid spans of every row, the runs of fluid cells
+ *     between the solid ones. The kernels loop over the spans
+ *     instead of over the whole row, so a solid cell costs
+ *     nothing and there is no test per cell. Without obstacles
+ *     a row is one span, 1 ... n-2
+ * (2) the interface cells, the solid cells next to fluid, which
+ *     get their boundary values after every pass like the
+ *     ghost cells around the domain (see FluidClass). That is
+ *     O(interface) instead of a branch in every kernel
+ *
+ * The border cells (i or j = 0 or n-1) are the ghost cells of
+ * the domain and are never solid
+*/
+class ObstacleClass{
+    private:
+        int n;
+        /* 64 bit words per row of the mask
+        */
+        int words;
+        std::vector<uint64_t> mask;
+        /* spans of row j are rowSpans[j] ... rowSpans[j+1]-1,
+         * span s covers the cells spanBegin[s] ... spanEnd[s]-1
+        */
+        std::vector<int> rowSpans, spanBegin, spanEnd;
+        std::vector<interfaceCell> interface;
+        int numSolid, numFluid;
+        void setSolid(int i, int j);
+    public:
+        ObstacleClass(void);
+        ObstacleClass(int n);
+        ~ObstacleClass(void);
+        /* remove every obstacle
+        */
+        void clear(void);
+        /* mark the cells whose center is inside the shape (cell
+         * i has its center at (i - 0.5)/(n-2) in the unit square)
+        */
+        void rasterize(const obstacleShape &shape);
+        /* rebuild the spans and the interface list from the mask,
+         * after the last rasterize
+        */
+        void build(void);
+
+        bool isSolid(int i, int j) const{
+            return (mask[j * words + (i >> 6)] >> (i & 63)) & 1;
+        }
+        bool isEmpty(void) const{
+            return numSolid == 0;
+        }
+        int rowBegin(int j) const{
+            return rowSpans[j];
+        }
+        int rowEnd(int j) const{
+            return rowSpans[j+1];
+        }
+        int getSpanBegin(int s) const{
+            return spanBegin[s];
+        }
+        int getSpanEnd(int s) const{
+            return spanEnd[s];
+        }
+        const std::vector<interfaceCell> &getInterface(void) const{
+            return interface;
+        }
+        int getFluidCount(void) const{
+            return numFluid;
+        }
+        int getSolidCount(void) const{
+            return numSolid;
+        }
+};
+#endif /* SIMULATION_OBSTACLE_H
+*/
@@ -0,0 +1,92 @@
+#ifndef SIMULATION_PARALLEL_H
+#define SIMULATION_PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+/* upper limit of threads of a parallel run
+*/
+const int kMaxWorkers = 64;
+
+/* One set of threads for every parallel loop of the simulation
+ * (particles, PIC/FLIP, lattice Boltzmann)
+ *
+ * A thread is made the first time a run needs it, and then
+ * waits for the next run instead of exiting, so a step that is
+ * split over threads does not create (and allocate a stack
+ * for) a thread every time. A run hands the workers a plain
+ * function and its context, nothing is allocated once the
+ * threads exist.
+ *
+ * Runs from different threads take turns, a run from inside a
+ * job is done on the calling thread alone
+*/
+class WorkerPoolClass{
+    private:
+        std::vector<std::thread> workers;
+        /* lock guards everything below, serial lets one run
+         * through at a time
+        */
+        std::mutex lock, serial;
+        std::condition_variable wake, done;
+        /* the current run, workers 1 ... active-1 take part
+         * and pending of them are not done yet. generation
+         * counts the runs, a worker takes part once per run
+        */
+        void (*job)(void *context, int t);
+        void *context;
+        int active, pending;
+        unsigned long generation;
+        bool stopping;
+
+        WorkerPoolClass(void);
+        void workerLoop(int t, unsigned long seen);
+    public:
+        ~WorkerPoolClass(void);
+        WorkerPoolClass(const WorkerPoolClass&) = delete;
+        WorkerPoolClass &operator=(const WorkerPoolClass&) = delete;
+        /* the pool of the process, made on first use
+        */
+        static WorkerPoolClass &get(void);
+        /* job(context, t) for t = 0 ... count-1, t = 0 on the
+         * calling thread, returns when all of them are done
+        */
+        void run(int count, void (*job)(void *context, int t), void *context);
+};
+
+/* number of threads for count items, with the given number of
+ * threads (0 for one per hardware thread) and at least grain
+ * items per thread
+*/
+inline int workerCount(int count, int grain, int threads){
+    int workers = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+    return std::max(1, std::min({workers, count / std::max(grain, 1), kMaxWorkers}));
+}
+
+/* body(t) for t = 0 ... count-1 on the threads of the pool
+*/
+template<typename F>
+void parallelRun(int count, F &body){
+    WorkerPoolClass::get().run(count, [](void *context, int t){
+        (*(F*)context)(t);
+    }, &body);
+}
+
+/* body(begin, end) on count items split over the given number
+ * of threads (0 for one per hardware thread), at least grain
+ * items per thread. The calling thread takes the first range
+*/
+template<typename F>
+void parallelFor(int count, int grain, int threads, F body){
+    int workers = workerCount(count, grain, threads);
+    int chunk = (count + workers - 1)/workers;
+    auto range = [&](int t){
+        body(std::min(t * chunk, count), std::min((t+1) * chunk, count));
+    };
+    parallelRun(workers, range);
+}
+#endif /* SIMULATION_PARALLEL_H
+*/
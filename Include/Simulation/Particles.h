@@ -0,0 +1,124 @@
+#ifndef SIMULATION_PARTICLES_H
+#define SIMULATION_PARTICLES_H
+
+#include "Obstacle.h"
+#include <vector>
+
+/* How the particles treat the sides of the domain, in the order
+ * of boundarySide (left, right, bottom, top)
+ * periodic - a particle that leaves on one side comes back on
+ *            the other, set for both sides of an axis
+ * open     - a particle that leaves is removed (outflow)
+ * any other side is a wall, the particle stays on it
+*/
+typedef struct{
+    bool periodic[4];
+    bool open[4];
+}particleDomain;
+
+/* Passive tracer particles
+ *
+ * Massless points that follow the velocity field, for showing
+ * the flow and measuring how well it mixes. The positions are
+ * in the unit square of the domain (like the obstacle shapes),
+ * so the same particles can be moved through grids of any size.
+ * A particle at (x,y) moves by dt * v(x,y) per step, with the
+ * midpoint (RK2) rule
+ *      v1 = v(p)
+ *      p  = p + dt * v(p + 0.5 * dt * v1)
+ * and v bilinear from the cell centers of the velocity grid.
+ *
+ * The particles are stored SoA (x, y and age in separate
+ * arrays), so 8 of them are moved at a time with AVX2, the 4
+ * velocity values around each of them fetched with gathers.
+ * The arrays are split into one chunk per thread, and every
+ * thread moves and culls its own chunk. The threads are the
+ * ones of WorkerPoolClass (Parallel.h), made once and reused.
+ *
+ * All the storage is allocated up front for capacity
+ * particles, emitting, culling and sorting never allocate:
+ *  - emit appends at the end, up to the capacity
+ *  - culling packs the survivors of a chunk to its front, and
+ *    the chunks are moved together
+ *  - every kParticleSortInterval steps the particles are put
+ *    in the order of the 4 x 4 cell block they are in (counting
+ *    sort), so the particles that a thread moves one after the
+ *    other read the same few cache lines of the velocity field
+ *
+ * A particle is removed when it is older than the lifetime
+ * (never for a lifetime of 0), when it leaves through an open
+ * side or when it ends up inside an obstacle
+*/
+class ParticleClass{
+    private:
+        int capacity, count;
+        float lifetime;
+        std::vector<float> x, y, age;
+        /* the other buffers of the counting sort, the block of
+         * every particle and the particles per block
+        */
+        std::vector<float> sortX, sortY, sortAge;
+        std::vector<int> keys, bins;
+        /* threads that move the particles (0 for one per
+         * hardware thread), advances between two sorts (0 for
+         * never) and advances since the last sort
+        */
+        int threads, sortInterval, unsorted;
+        /* state of the random numbers that spread emitted
+         * particles over the disc
+        */
+        unsigned int seed;
+        float random(void);
+        /* move particles begin ... end-1, and pack the ones
+         * that stay to the front of the range. Returns the
+         * number that stayed
+        */
+        template<typename L>
+        int advanceRange(int begin, int end, const ObstacleClass &solid, int n, int row,
+                         const float *vX, const float *vY, float dt,
+                         const particleDomain &domain);
+        /* order by 4 x 4 block of the velocity grid (n x n)
+        */
+        void sort(int n);
+    public:
+        ParticleClass(int capacity, float lifetime);
+        ~ParticleClass(void);
+        /* add up to number particles, spread evenly over the
+         * disc of radius r around (cx,cy). Returns how many
+         * were added, there is no room beyond the capacity
+        */
+        int emit(float cx, float cy, float r, int number);
+        /* remove every particle
+        */
+        void clear(void);
+        /* kParticleThreads and kParticleSortInterval by default
+        */
+        void setThreads(int number);
+        void setSortInterval(int steps);
+        /* one step of dt through the velocity field vX, vY (n x
+         * n cells in layout L, rows row floats apart) with the
+         * given obstacles and sides. FluidClass calls this after
+         * every step for its particles, see setParticles
+        */
+        template<typename L>
+        void advance(const ObstacleClass &solid, int n, int row, const float *vX, const float *vY,
+                     float dt, const particleDomain &domain);
+
+        int getCount(void) const{
+            return count;
+        }
+        int getCapacity(void) const{
+            return capacity;
+        }
+        const float *getX(void) const{
+            return x.data();
+        }
+        const float *getY(void) const{
+            return y.data();
+        }
+        const float *getAge(void) const{
+            return age.data();
+        }
+};
+#endif /* SIMULATION_PARTICLES_H
+*/
@@ -0,0 +1,97 @@
+#ifndef SIMULATION_VORTICITYFLUID_H
+#define SIMULATION_VORTICITYFLUID_H
+
+#include "Fluid.h"
+#include <string>
+#include <stddef.h>
+
+/* Vorticity-streamfunction version of FluidClass
+ *
+ * FluidClass carries the velocity and pays for two
+ * clearDivergence calls every step, one after the diffusion and
+ * one after the advection, because both of them break the
+ * divergence free condition. In 2D the flow can instead be
+ * carried by its vorticity (the curl of the velocity, a scalar)
+ *      w = dv/dx - du/dy
+ * and the velocity comes from a streamfunction psi
+ *      -(d2psi/dx2 + d2psi/dy2) = w
+ *      u = dpsi/dy, v = -dpsi/dx
+ * The central differences of u and v then cancel in the
+ * divergence, so the velocity is divergence free whatever psi
+ * is, and a step needs one Poisson solve
+ * (1) the velocity sources add their curl to w, the part of a
+ *     source that is not a swirl is dropped, as clearDivergence
+ *     would have done
+ * (2) w is diffused with vDiff
+ * (3) psi is solved from w (solvePoisson of the grid, with its
+ *     Poisson backend, chebyshev unless setBackends picks
+ *     another) starting from the psi of the last step, psi = 0
+ *     on the walls so that no fluid goes through them. The
+ *     velocity lags a few steps behind a large sudden source
+ *     (from psi = 0, about 20 steps at N = 256) while psi
+ *     catches up
+ * (4) the velocity of the grid is made from psi, and w is
+ *     advected through it like a scalar
+ * The density stays on the grid and is advected by FluidClass.
+ *
+ * The walls are free slip like the walls of FluidClass. The
+ * vorticity has no flux through them (it diffuses and is
+ * advected with the boundaries of the density), there are no
+ * obstacles and no inflow, outflow or periodic sides.
+ *
+ * The public interface (sources, stepping, density readout)
+ * is the same as FluidClass
+*/
+class VorticityFluidClass{
+    private:
+        /* the grid that holds the density and the velocity made
+         * from psi, and that solves, diffuses and advects
+        */
+        FluidClass grid;
+        /* vorticity (and the field it is diffused/advected into),
+         * streamfunction and the velocity sources of the next
+         * step. w and psi are scalar fields on the velocity grid
+        */
+        FieldClass<float> vorticity, vorticityNext, psi, force;
+
+        /* w += curl of the sources, and clear them
+        */
+        void addSourceCurl(void);
+        /* psi from w, then the velocity of the grid from psi
+        */
+        void solveStreamfunction(void);
+        void velocityFromStreamfunction(void);
+    public:
+        int N;
+        float dt;
+        float dDiff, vDiff;
+
+        VorticityFluidClass(int _N, float _dDiff, float _vDiff, float _dt);
+        ~VorticityFluidClass(void);
+
+        void addDensitySource(int i, int j, float amount);
+        void addVelocitySource(int i, int j, float amountX, float amountY);
+
+        void densityStep(void);
+        void velocityStep(void);
+        void simulationStep(void);
+        /* same adaptive stepping as FluidClass::frameStep
+         * (frameSubsteps)
+        */
+        float maxVelocity(void);
+        void frameStep(float frameDt);
+        /* backends of the grid (see FluidClass::setBackends), the
+         * poisson one solves psi, advection-density advects the
+         * density and w
+        */
+        bool setBackends(const std::string &spec);
+        float getDensity(int i, int j);
+        /* velocity of the grid at cell (i,j), after the last
+         * step
+        */
+        float getVelocity(attribute atType, int i, int j);
+        float getVorticity(int i, int j);
+        size_t getMemoryUsage(void);
+};
+#endif /* SIMULATION_VORTICITYFLUID_H
+*/
@@ -0,0 +1,1073 @@
+#include "../../Include/Control/Constants.h"
+#include "../../Include/Simulation/Fluid.h"
+#include "../../Include/Simulation/Backend.h"
+#include "../../Include/Simulation/MACFluid.h"
+#include "../../Include/Simulation/FLIPFluid.h"
+#include "../../Include/Simulation/LBMFluid.h"
+#include "../../Include/Simulation/VorticityFluid.h"
+#include "../../Include/Simulation/AMRFluid.h"
+#include "../../Include/Control/Utils.h"
+#include <stdlib.h> /* for malloc, free
+*/
+#include <math.h>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string.h>
+#include <thread>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Micro benchmarks for the simulation kernels, these are
+ * not part of the simulation build. Use the "Build Benchmark"
+ * task and run Build/Benchmark.exe
+ *
+ * Every benchmark runs the kernel on a grid that is filled
+ * with a smooth swirling velocity field, the magnitude of
+ * the velocity is given in cells travelled per time step
+ * since that is what decides how far apart the gathers of
+ * the advection are
+*/
+
+/* number of times each kernel is run, the reported time
+ * is the average
+*/
+const int kBenchRepeat = 20;
+
+/* the advection loop as it was before vectorization, kept
+ * here as the baseline (column order, branches in the clamp).
+ * Rows are row floats apart, like the fields of FluidClass
+*/
+void scalarAdvection(int n, int row, float dt, float *curr, float *prev, float *vX, float *vY){
+    float dT = dt * (n-2);
+
+    for(int i = 1; i < n-1; i++){
+        for(int j = 1; j < n-1; j++){
+            float fX = i - (dT * vX[getIdx(i, j, row)]);
+            float fY = j - (dT * vY[getIdx(i, j, row)]);
+
+            fX = (fX < 0.5) ? 0.5 : fX;
+            fY = (fY < 0.5) ? 0.5 : fY;
+            fX = (fX > (n-2) + 0.5) ? (n-2) + 0.5 : fX;
+            fY = (fY > (n-2) + 0.5) ? (n-2) + 0.5 : fY;
+
+            int i0 = (int)fX;
+            int i1 = i0 + 1;
+            int j0 = (int)fY;
+            int j1 = j0 + 1;
+
+            float s1 = fX - i0;
+            float s0 = 1.0 - s1;
+            float t1 = fY - j0;
+            float t0 = 1.0 - t1;
+
+            float z0 = t0 * (prev[getIdx(i0, j0, row)]) + t1 * (prev[getIdx(i0, j1, row)]);
+            float z1 = t0 * (prev[getIdx(i1, j0, row)]) + t1 * (prev[getIdx(i1, j1, row)]);
+            curr[getIdx(i, j, row)] = (s0 * z0) + (s1 * z1);
+        }
+    }
+}
+
+/* swirl with a peak speed of speed at (x,y) in the unit
+ * square
+*/
+float swirlX(float speed, float x, float y){
+    return -speed * sinf(M_PI * x) * cosf(M_PI * y);
+}
+
+float swirlY(float speed, float x, float y){
+    return speed * cosf(M_PI * x) * sinf(M_PI * y);
+}
+
+/* swirl with a peak speed of cells/step, and a density
+ * field with some detail in it
+*/
+void fillFields(int n, int row, float dt, float cells, float *vX, float *vY, float *d){
+    float speed = cells / (dt * (n-2));
+    for(int j = 0; j < n; j++){
+        for(int i = 0; i < n; i++){
+            float x = (float)i / n;
+            float y = (float)j / n;
+            vX[getIdx(i, j, row)] = swirlX(speed, x, y);
+            vY[getIdx(i, j, row)] = swirlY(speed, x, y);
+            d[getIdx(i, j, row)] = 0.5 + 0.5 * sinf(20 * x) * sinf(20 * y);
+        }
+    }
+}
+
+/* same fields, with the velocity written into vPrev and the
+ * density into dCurr in the layouts of the simulation
+*/
+template<typename L, typename S>
+void fillFields(FluidLayoutClass<L, S> &fluid, float cells){
+    int n = fluid.N;
+    float *vX = fluid.getComponent(fluid.vPrev, VELOCITY_X);
+    float *vY = fluid.getComponent(fluid.vPrev, VELOCITY_Y);
+    float *pX = (float*)calloc(n * fluid.stride, sizeof(float));
+    float *pY = (float*)calloc(n * fluid.stride, sizeof(float));
+    float *pD = (float*)calloc(n * fluid.stride, sizeof(float));
+    fillFields(n, fluid.stride, fluid.dt, cells, pX, pY, pD);
+    for(int j = 0; j < n; j++){
+        for(int i = 0; i < n; i++){
+            int idx = getIdx(i, j, fluid.stride);
+            vX[L::cell(i, j, fluid.stride)] = pX[idx];
+            vY[L::cell(i, j, fluid.stride)] = pY[idx];
+            fluid.dCurr[S::cell(i, j, fluid.stride)] = pD[idx];
+        }
+    }
+    free(pX);
+    free(pY);
+    free(pD);
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Last level cache misses of this process (user space only),
+ * through perf_event_open. Returns -1 when the counter is not
+ * available (not linux, no PMU in a VM, perf_event_paranoid),
+ * the benchmarks then only report the time
+*/
+int openMissCounter(void){
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    /* LLC read misses, or the generic cache misses event
+     * (which is also the LLC on most cpus) if that is missing
+    */
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_LL |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if(fd < 0){
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+long long readMisses(int fd){
+#ifdef __linux__
+    long long count = 0;
+    if(fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+#else
+    (void)fd;
+    return -1;
+#endif
+}
+
+void closeMissCounter(int fd){
+#ifdef __linux__
+    if(fd >= 0)
+        close(fd);
+#else
+    (void)fd;
+#endif
+}
+
+/* average time of one call of kernel, and if misses is given
+ * the average LLC misses of one call (-1 if not available)
+*/
+template<typename F>
+double averageMs(F kernel, long long *misses = NULL, int repeat = kBenchRepeat){
+    int fd = (misses != NULL) ? openMissCounter() : -1;
+#ifdef __linux__
+    if(fd >= 0){
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < repeat; r++)
+        kernel();
+    double ms = elapsedMs(start) / repeat;
+#ifdef __linux__
+    if(fd >= 0)
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    if(misses != NULL){
+        long long count = readMisses(fd);
+        *misses = (count < 0) ? -1 : count / repeat;
+    }
+    closeMissCounter(fd);
+    return ms;
+}
+
+void benchAdvection(int n){
+    /* the split layout, so that the velocity components are
+     * plain arrays that the baseline can read too
+    */
+    FluidLayoutClass<velocitySplit, scalarLayout> fluid(n, 0.0, 0.0, dt, 1);
+    float *ref = (float*)calloc(n * fluid.stride, sizeof(float));
+    float *vX = (float*)calloc(n * fluid.stride, sizeof(float));
+    float *vY = (float*)calloc(n * fluid.stride, sizeof(float));
+    const float speeds[] = {0.25, 1.0, 4.0, 16.0, 64.0};
+
+    std::cout << "advection, N = " << n << std::endl;
+    std::cout << "  cells/step   scalar(ms)   kernel(ms)   speedup   max diff" << std::endl;
+    for(float cells : speeds){
+        fillFields(n, fluid.stride, dt, cells, vX, vY, fluid.dCurr.data());
+
+        auto start = std::chrono::steady_clock::now();
+        for(int r = 0; r < kBenchRepeat; r++)
+            scalarAdvection(n, fluid.stride, dt, ref, fluid.dCurr.data(), vX, vY);
+        double scalarMs = elapsedMs(start) / kBenchRepeat;
+
+        start = std::chrono::steady_clock::now();
+        for(int r = 0; r < kBenchRepeat; r++)
+            fluid.advection(DENSITY, fluid.dPrev.data(), fluid.dCurr.data(), vX, vY);
+        double kernelMs = elapsedMs(start) / kBenchRepeat;
+        /* interior cells only, the kernel also fills the
+         * border cells
+        */
+        float maxDiff = 0.0;
+        for(int j = 1; j < n-1; j++){
+            for(int i = 1; i < n-1; i++){
+                int idx = getIdx(i, j, fluid.stride);
+                maxDiff = fmaxf(maxDiff, fabsf(ref[idx] - fluid.dPrev[idx]));
+            }
+        }
+        std::cout << std::fixed << std::setprecision(3)
+                  << std::setw(12) << cells
+                  << std::setw(13) << scalarMs
+                  << std::setw(13) << kernelMs
+                  << std::setw(10) << scalarMs / kernelMs
+                  << std::setw(11) << std::scientific << std::setprecision(1) << maxDiff
+                  << std::endl;
+    }
+    std::cout << std::fixed << std::setprecision(3)
+              << "  memory (MB)  " << fluid.getMemoryUsage() / 1048576.0
+              << "  reserved " << fluid.getReservedMemory() / 1048576.0 << std::endl;
+    free(ref);
+    free(vX);
+    free(vY);
+}
+
+/* kernels that read or write the velocity, timed for every
+ * layout
+*/
+const int kNumLayoutKernels = 6;
+const char *layoutKernels[kNumLayoutKernels] = {
+    "advect density",
+    "advect velocity",
+    "project",
+    "diffuse (explicit)",
+    "diffuse (implicit)",
+    "max velocity"
+};
+
+template<typename L, typename S>
+void benchLayout(int n, double *ms, long long *misses = NULL, int repeat = kBenchRepeat){
+    FluidLayoutClass<L, S> fluid(n, 0.0, 0.0, dt, 1);
+    float *vX = fluid.getComponent(fluid.vPrev, VELOCITY_X);
+    float *vY = fluid.getComponent(fluid.vPrev, VELOCITY_Y);
+    float *nX = fluid.getComponent(fluid.vCurr, VELOCITY_X);
+    float *nY = fluid.getComponent(fluid.vCurr, VELOCITY_Y);
+    /* viscosity that gives a diffusion rate k below and
+     * above kExplicitLimit
+    */
+    float kToDiff = 1.0 / (dt * (n-2) * (n-2));
+    float lowDiff = 0.1 * kExplicitLimit * kToDiff;
+    float highDiff = 10.0 * kExplicitLimit * kToDiff;
+
+    fillFields(fluid, 4.0);
+    attribute atTypes[2] = {VELOCITY_X, VELOCITY_Y};
+    float *curr[2] = {nX, nY};
+    float *prev[2] = {vX, vY};
+
+    ms[0] = averageMs([&]{
+        fluid.advection(DENSITY, fluid.dPrev.data(), fluid.dCurr.data(), vX, vY);
+    }, misses ? misses + 0 : NULL, repeat);
+    ms[1] = averageMs([&]{
+        fluid.advectionFused(2, atTypes, curr, prev, vX, vY);
+    }, misses ? misses + 1 : NULL, repeat);
+    /* the density fields are free to hold div and p
+    */
+    ms[2] = averageMs([&]{
+        fluid.clearDivergence(nX, nY, fluid.dPrev.data(), fluid.dCurr.data());
+    }, misses ? misses + 2 : NULL, repeat);
+    ms[3] = averageMs([&]{
+        fluid.diffuse(VELOCITY_X, nX, vX, lowDiff);
+        fluid.diffuse(VELOCITY_Y, nY, vY, lowDiff);
+    }, misses ? misses + 3 : NULL, repeat);
+    ms[4] = averageMs([&]{
+        fluid.diffuse(VELOCITY_X, nX, vX, highDiff);
+        fluid.diffuse(VELOCITY_Y, nY, vY, highDiff);
+    }, misses ? misses + 4 : NULL, repeat);
+    volatile float sink = 0.0;
+    ms[5] = averageMs([&]{
+        sink = sink + fluid.vCurr.data()[0] + fluid.maxVelocity();
+    }, misses ? misses + 5 : NULL, repeat);
+}
+
+void benchLayouts(int n){
+    const int numLayouts = 3;
+    const char *names[numLayouts] = {
+        velocitySplit::name(),
+        velocityInterleaved::name(),
+        velocityTiled::name()
+    };
+    double ms[numLayouts][kNumLayoutKernels];
+    benchLayout<velocitySplit, scalarLayout>(n, ms[0]);
+    benchLayout<velocityInterleaved, scalarLayout>(n, ms[1]);
+    benchLayout<velocityTiled, scalarLayout>(n, ms[2]);
+
+    std::cout << "velocity layouts, N = " << n << " (ms per call)" << std::endl;
+    std::cout << "  kernel              ";
+    for(int l = 0; l < numLayouts; l++)
+        std::cout << std::setw(13) << names[l];
+    std::cout << "   fastest" << std::endl;
+    for(int k = 0; k < kNumLayoutKernels; k++){
+        int best = 0;
+        std::cout << "  " << std::left << std::setw(20) << layoutKernels[k] << std::right;
+        for(int l = 0; l < numLayouts; l++){
+            std::cout << std::fixed << std::setprecision(3) << std::setw(13) << ms[l][k];
+            if(ms[l][k] < ms[best][k])
+                best = l;
+        }
+        std::cout << "   " << names[best] << std::endl;
+    }
+}
+
+/* row-major against Z-order tiles for all the fields, time
+ * and LLC misses per call. The gathers of the advection only
+ * start to miss the LLC when the fields do not fit, so this
+ * is run at sizes past that too
+*/
+void benchZOrder(int n, int repeat){
+    double ms[2][kNumLayoutKernels];
+    long long misses[2][kNumLayoutKernels];
+    benchLayout<velocitySplit, scalarLayout>(n, ms[0], misses[0], repeat);
+    benchLayout<velocityZOrder, scalarZOrder>(n, ms[1], misses[1], repeat);
+
+    std::cout << "row-major vs z-order, N = " << n << " (ms and LLC misses per call)" << std::endl;
+    std::cout << "  kernel                row-major      misses      z-order      misses   speedup"
+              << std::endl;
+    for(int k = 0; k < kNumLayoutKernels; k++){
+        std::cout << "  " << std::left << std::setw(20) << layoutKernels[k] << std::right;
+        for(int l = 0; l < 2; l++){
+            std::cout << std::fixed << std::setprecision(3) << std::setw(11) << ms[l][k];
+            if(misses[l][k] < 0)
+                std::cout << std::setw(12) << "n/a";
+            else
+                std::cout << std::setw(12) << misses[l][k];
+        }
+        std::cout << std::setw(10) << ms[0][k] / ms[1][k] << std::endl;
+    }
+}
+
+/* implicit diffusion of both velocity components, one
+ * iterSolve per component against one iterSolveFused for both
+ * (and for both plus the density). The results have to be the
+ * same bit for bit
+*/
+void benchDiffusionFused(int n){
+    FluidClass fluid(n, 0.0, 0.0, dt, 1);
+    float *vX = fluid.getComponent(fluid.vPrev, VELOCITY_X);
+    float *vY = fluid.getComponent(fluid.vPrev, VELOCITY_Y);
+    float *nX = fluid.getComponent(fluid.vCurr, VELOCITY_X);
+    float *nY = fluid.getComponent(fluid.vCurr, VELOCITY_Y);
+    float diff = 10.0 * kExplicitLimit / (dt * (n-2) * (n-2));
+    fillFields(fluid, 4.0);
+    attribute atTypes[3] = {VELOCITY_X, VELOCITY_Y, DENSITY};
+    float *curr[3] = {nX, nY, fluid.dPrev.data()};
+    float *prev[3] = {vX, vY, fluid.dCurr.data()};
+    /* the solve starts from what is in curr, so both start
+     * from 0 for the comparison
+    */
+    size_t bytes = fluid.vCurr.count() * sizeof(float);
+    std::vector<float> ref(fluid.vCurr.count());
+    memset(fluid.vCurr.data(), 0, bytes);
+    fluid.diffuse(VELOCITY_X, nX, vX, diff);
+    fluid.diffuse(VELOCITY_Y, nY, vY, diff);
+    memcpy(ref.data(), fluid.vCurr.data(), bytes);
+    memset(fluid.vCurr.data(), 0, bytes);
+    fluid.diffuseFused(2, atTypes, curr, prev, diff);
+    bool same = memcmp(ref.data(), fluid.vCurr.data(), bytes) == 0;
+
+    double separateMs = averageMs([&]{
+        fluid.diffuse(VELOCITY_X, nX, vX, diff);
+        fluid.diffuse(VELOCITY_Y, nY, vY, diff);
+    });
+    double fusedMs = averageMs([&]{
+        fluid.diffuseFused(2, atTypes, curr, prev, diff);
+    });
+    double scalarMs = averageMs([&]{
+        fluid.diffuse(DENSITY, fluid.dPrev.data(), fluid.dCurr.data(), diff);
+    });
+    double fused3Ms = averageMs([&]{
+        fluid.diffuseFused(3, atTypes, curr, prev, diff);
+    });
+
+    std::cout << "implicit diffusion, N = " << n << " (ms per call)" << std::endl;
+    std::cout << std::fixed << std::setprecision(3)
+              << "  vX, vY separate    " << std::setw(10) << separateMs << std::endl
+              << "  vX, vY fused       " << std::setw(10) << fusedMs
+              << "   speedup " << separateMs / fusedMs
+              << (same ? "   (same result)" : "   [ERROR] results differ") << std::endl
+              << "  vX, vY, d separate " << std::setw(10) << separateMs + scalarMs << std::endl
+              << "  vX, vY, d fused    " << std::setw(10) << fused3Ms
+              << "   speedup " << (separateMs + scalarMs) / fused3Ms << std::endl;
+}
+
+/* One projection of the collocated grid (FluidClass) and the
+ * staggered grid (MACFluidClass), starting from the swirl plus
+ * a checkerboard of 10% of its speed in both components.
+ *
+ * Each grid is checked with its own divergence (the 2 cell wide
+ * central difference for FluidClass, the compact face difference
+ * for MACFluidClass), and by how much of the checkerboard is
+ * left (its amplitude in the interior, relative to the start).
+ * The wide stencil cannot see the checkerboard at all
+*/
+void benchProjection(int n){
+    FluidClass fluid(n, 0.0, 0.0, dt, 1);
+    MACFluidClass mac(n, 0.0, 0.0, dt);
+    float speed = 1.0 / (dt * (n-2));
+    float noise = 0.1 * speed;
+    float h = 1.0 / (n-2);
+
+    int row = fluid.stride;
+    float *vX = fluid.getComponent(fluid.vCurr, VELOCITY_X);
+    float *vY = fluid.getComponent(fluid.vCurr, VELOCITY_Y);
+    int uRow = mac.getStride(VELOCITY_X);
+    int vRow = mac.getStride(VELOCITY_Y);
+    /* cell (i,j) is centered at (i - 0.5) * h, u(i,j) is on its
+     * left face and v(i,j) on its bottom face
+    */
+    for(int j = 1; j < n-1; j++){
+        for(int i = 1; i < n-1; i++){
+            float sign = ((i + j) % 2 == 0) ? 1.0 : -1.0;
+            float x = (i - 0.5) * h;
+            float y = (j - 0.5) * h;
+            vX[velocityLayout::cell(i, j, row)] = swirlX(speed, x, y) + sign * noise;
+            vY[velocityLayout::cell(i, j, row)] = swirlY(speed, x, y) + sign * noise;
+            mac.u[getIdx(i, j, uRow)] = swirlX(speed, x - 0.5 * h, y) + sign * noise;
+            mac.v[getIdx(i, j, vRow)] = swirlY(speed, x, y - 0.5 * h) + sign * noise;
+        }
+    }
+    /* largest |div| and the checkerboard amplitude of the x
+     * component, for the collocated velocity
+    */
+    auto measure = [&](float &maxDiv, float &board){
+        maxDiv = 0.0;
+        double sum = 0.0;
+        for(int j = 2; j < n-2; j++){
+            for(int i = 2; i < n-2; i++){
+                float d = 0.5 * (vX[velocityLayout::cell(i+1, j, row)] - vX[velocityLayout::cell(i-1, j, row)] +
+                                 vY[velocityLayout::cell(i, j+1, row)] - vY[velocityLayout::cell(i, j-1, row)]);
+                maxDiv = std::max(maxDiv, fabsf(d) * (n-2));
+                sum += ((i + j) % 2 == 0 ? 1.0 : -1.0) * vX[velocityLayout::cell(i, j, row)];
+            }
+        }
+        board = fabs(sum) / ((n-4) * (n-4)) / noise;
+    };
+    auto measureMAC = [&](float &maxDiv, float &board){
+        maxDiv = mac.maxDivergence(mac.u.data(), mac.v.data());
+        double sum = 0.0;
+        for(int j = 2; j < n-2; j++){
+            for(int i = 2; i < n-2; i++)
+                sum += ((i + j) % 2 == 0 ? 1.0 : -1.0) * mac.u[getIdx(i, j, uRow)];
+        }
+        board = fabs(sum) / ((n-4) * (n-4)) / noise;
+    };
+    float divBefore[2], divAfter[2], boardAfter[2], unused;
+    measure(divBefore[0], unused);
+    measureMAC(divBefore[1], unused);
+
+    double ms[2];
+    ms[0] = averageMs([&]{
+        fluid.clearDivergence(vX, vY, fluid.dPrev.data(), fluid.dCurr.data());
+    }, NULL, 1);
+    ms[1] = averageMs([&]{
+        mac.clearDivergence(mac.u.data(), mac.v.data());
+    }, NULL, 1);
+    measure(divAfter[0], boardAfter[0]);
+    measureMAC(divAfter[1], boardAfter[1]);
+
+    const char *names[2] = {"collocated", "staggered (MAC)"};
+    std::cout << "projection, N = " << n << " (" << kIter << " sweeps)" << std::endl;
+    std::cout << "  grid                 project(ms)   max div before    max div after   checkerboard left"
+              << std::endl;
+    for(int g = 0; g < 2; g++){
+        std::cout << "  " << std::left << std::setw(20) << names[g] << std::right
+                  << std::fixed << std::setprecision(3) << std::setw(13) << ms[g]
+                  << std::scientific << std::setprecision(2)
+                  << std::setw(17) << divBefore[g]
+                  << std::setw(17) << divAfter[g]
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(19) << 100.0 * boardAfter[g] << "%" << std::endl;
+    }
+}
+
+/* The pressure solve with each relaxation method. The velocity
+ * is the gradient of a potential (a source and a sink), so the
+ * exact projection removes all of it and whatever is left is
+ * the error of the pressure after kIter sweeps.
+ *
+ * "rate" is how much faster than Gauss-Seidel the error goes
+ * down per sweep, log(left)/log(left of Gauss-Seidel)
+*/
+void benchRelaxation(int n){
+    const char *names[3] = {"Gauss-Seidel", "SOR", "Chebyshev"};
+    float h = 1.0 / (n-2);
+    double left[3], ms[3];
+    for(int r = 0; r < 3; r++){
+        FluidClass fluid(n, 0.0, 0.0, dt, 1);
+        fluid.setRelaxation(CLEAR_DIVERGENCE, (relaxationMethod)r);
+        int row = fluid.stride;
+        float *vX = fluid.getComponent(fluid.vCurr, VELOCITY_X);
+        float *vY = fluid.getComponent(fluid.vCurr, VELOCITY_Y);
+        /* gradient of exp(-40 r0^2) - exp(-40 r1^2)
+        */
+        auto rms = [&](void){
+            double sum = 0.0;
+            for(int j = 1; j < n-1; j++){
+                for(int i = 1; i < n-1; i++){
+                    int idx = velocityLayout::cell(i, j, row);
+                    sum += vX[idx] * vX[idx] + vY[idx] * vY[idx];
+                }
+            }
+            return sqrt(sum / ((n-2) * (n-2)));
+        };
+        for(int j = 0; j < n; j++){
+            for(int i = 0; i < n; i++){
+                float x = (i - 0.5) * h;
+                float y = (j - 0.5) * h;
+                float x0 = x - 0.35, y0 = y - 0.5;
+                float x1 = x - 0.65, y1 = y - 0.4;
+                float g0 = expf(-40.0 * (x0 * x0 + y0 * y0));
+                float g1 = expf(-40.0 * (x1 * x1 + y1 * y1));
+                int idx = velocityLayout::cell(i, j, row);
+                vX[idx] = -80.0 * (x0 * g0 - x1 * g1);
+                vY[idx] = -80.0 * (y0 * g0 - y1 * g1);
+            }
+        }
+        double before = rms();
+        ms[r] = averageMs([&]{
+            fluid.clearDivergence(vX, vY, fluid.dPrev.data(), fluid.dCurr.data());
+        }, NULL, 1);
+        left[r] = rms() / before;
+    }
+
+    std::cout << "pressure solve, N = " << n << " (" << kIter << " sweeps)" << std::endl;
+    std::cout << "  relaxation      project(ms)   error left      rate" << std::endl;
+    for(int r = 0; r < 3; r++){
+        std::cout << "  " << std::left << std::setw(14) << names[r] << std::right
+                  << std::fixed << std::setprecision(3) << std::setw(13) << ms[r]
+                  << std::setw(13) << left[r]
+                  << std::setprecision(1) << std::setw(10) << log(left[r]) / log(left[0])
+                  << "x" << std::endl;
+    }
+}
+
+/* one diffusion call of the density at rates that pick each
+ * of the modes (explicit, iterative, ADI), the time of the
+ * iterative solve does not depend on k
+*/
+void benchDiffusionModes(int n){
+    FluidClass fluid(n, 0.0, 0.0, dt, 1);
+    fillFields(fluid, 4.0);
+    const char *names[] = {"SWAP", "COPY", "EXPLICIT", "IMPLICIT", "ADI"};
+    const float rates[] = {0.5 * kExplicitLimit, 0.5 * kADILimit, kADILimit, 10 * kADILimit};
+
+    std::cout << "diffusion, N = " << n << " (ms per call)" << std::endl;
+    std::cout << "           k   mode          diffuse(ms)" << std::endl;
+    for(float k : rates){
+        float diff = k / (dt * (n-2) * (n-2));
+        diffusionMode mode = (k < kExplicitLimit) ? DIFFUSE_EXPLICIT :
+                             (k < kADILimit) ? DIFFUSE_IMPLICIT : DIFFUSE_ADI;
+        double ms = averageMs([&]{
+            fluid.diffuse(DENSITY, fluid.dPrev.data(), fluid.dCurr.data(), diff);
+        });
+        std::cout << std::fixed << std::setprecision(3) << std::setw(12) << k << "   "
+                  << std::left << std::setw(10) << names[mode] << std::right
+                  << std::setw(14) << ms << std::endl;
+    }
+}
+
+/* one simulation step and one projection with more and more
+ * of the domain covered by obstacles (a grid of circles). The
+ * kernels only run over the fluid spans, so the time should
+ * drop with the solid cells, and the boundary work grows with
+ * the interface cells only
+*/
+void benchObstacles(int n){
+    const int radii[] = {0, 3, 4, 5};
+    std::cout << "obstacles, N = " << n << " (ms per call)" << std::endl;
+    std::cout << "  solid(%)   interface   step(ms)   project(ms)" << std::endl;
+    for(int r : radii){
+        FluidClass fluid(n, 0.0, 0.0, dt, 1);
+        fillFields(fluid, 4.0);
+        fluid.vCurr.swap(fluid.vPrev);
+        /* circles of radius r/128 on a grid 1/8 apart, this
+         * also clears the fluid in them
+        */
+        for(int cy = 0; cy < 8 && r > 0; cy++){
+            for(int cx = 0; cx < 8; cx++){
+                obstacleShape circle = {SHAPE_CIRCLE, (cx + 0.5f)/8, (cy + 0.5f)/8, r/128.0f, 0};
+                fluid.addObstacle(circle);
+            }
+        }
+        const ObstacleClass &solid = fluid.getObstacles(DENSITY);
+        float *vX = fluid.getComponent(fluid.vCurr, VELOCITY_X);
+        float *vY = fluid.getComponent(fluid.vCurr, VELOCITY_Y);
+
+        double step = averageMs([&]{
+            fluid.simulationStep();
+        });
+        double project = averageMs([&]{
+            fluid.clearDivergence(vX, vY, fluid.getComponent(fluid.vPrev, VELOCITY_X),
+                                  fluid.getComponent(fluid.vPrev, VELOCITY_Y));
+        });
+        std::cout << std::fixed << std::setprecision(3)
+                  << std::setw(10) << 100.0 * solid.getSolidCount()/((n-2) * (n-2))
+                  << std::setw(12) << solid.getInterface().size()
+                  << std::setw(11) << step << std::setw(14) << project << std::endl;
+    }
+}
+
+/* transport of 1 ... kMaxScalars scalar fields (the density
+ * and the ones from addScalar): one advection and one implicit
+ * diffusion per field against the fused passes of runStages,
+ * which trace every cell once and walk through all the fields
+ * in the same sweep. The last column is a whole step with that
+ * many scalars
+*/
+void benchScalars(int n){
+    std::cout << "scalar transport, N = " << n << " (ms per call)" << std::endl;
+    std::cout << "  scalars   advect   fused   diffuse   fused   step(ms)" << std::endl;
+    for(int count = 1; count <= kMaxScalars; count++){
+        FluidClass fluid(n, 0.0, 0.0, dt, 1);
+        fillFields(fluid, 4.0);
+        float diff = 10.0 * kExplicitLimit / (dt * (n-2) * (n-2));
+        for(int id = 1; id < count; id++)
+            fluid.addScalar(diff);
+        float *vX = fluid.getComponent(fluid.vPrev, VELOCITY_X);
+        float *vY = fluid.getComponent(fluid.vPrev, VELOCITY_Y);
+        /* every scalar gets its own pair of buffers, starting
+         * from the density
+        */
+        std::vector<std::vector<float> > buffers(2 * count,
+                                                 std::vector<float>(fluid.dCurr.count()));
+        attribute atTypes[kMaxScalars];
+        float *curr[kMaxScalars], *prev[kMaxScalars];
+        for(int id = 0; id < count; id++){
+            memcpy(buffers[2 * id].data(), fluid.dCurr.data(), fluid.dCurr.count() * sizeof(float));
+            atTypes[id] = DENSITY;
+            curr[id] = buffers[2 * id + 1].data();
+            prev[id] = buffers[2 * id].data();
+        }
+
+        double advectMs = averageMs([&]{
+            for(int id = 0; id < count; id++)
+                fluid.advection(DENSITY, curr[id], prev[id], vX, vY);
+        });
+        double advectFusedMs = averageMs([&]{
+            fluid.advectionFused(count, atTypes, curr, prev, vX, vY);
+        });
+        double diffuseMs = averageMs([&]{
+            for(int id = 0; id < count; id++)
+                fluid.diffuse(DENSITY, curr[id], prev[id], diff);
+        });
+        double diffuseFusedMs = averageMs([&]{
+            fluid.diffuseFused(count, atTypes, curr, prev, diff);
+        });
+        fluid.vCurr.swap(fluid.vPrev);
+        double stepMs = averageMs([&]{
+            fluid.simulationStep();
+        });
+        std::cout << std::fixed << std::setprecision(3) << std::setw(9) << count
+                  << std::setw(9) << advectMs << std::setw(8) << advectFusedMs
+                  << std::setw(10) << diffuseMs << std::setw(8) << diffuseFusedMs
+                  << std::setw(11) << stepMs << std::endl;
+    }
+}
+
+/* one advance of a million tracer particles through the swirl,
+ * spread at random over the domain: in the order they were
+ * emitted (every particle reads other cache lines than the one
+ * before it), after the sort by cell block, and with every
+ * hardware thread instead of one
+*/
+void benchParticles(int n){
+    const int count = 1 << 20;
+    FluidClass fluid(n, 0.0, 0.0, dt, 1);
+    fillFields(fluid, 4.0);
+    float *vX = fluid.getComponent(fluid.vPrev, VELOCITY_X);
+    float *vY = fluid.getComponent(fluid.vPrev, VELOCITY_Y);
+    const ObstacleClass &solid = fluid.getObstacles(VELOCITY_X);
+    particleDomain domain = {{false, false, false, false}, {false, false, false, false}};
+    /* no lifetime and a small dt, so none of them is culled
+     * while the kernel is timed
+    */
+    ParticleClass particles(count, 0.0);
+    particles.emit(0.5, 0.5, 0.5, count);
+    particles.setThreads(1);
+    particles.setSortInterval(0);
+    float step = 0.01 / (n-2);
+    double randomMs = averageMs([&]{
+        particles.advance<velocitySplit>(solid, n, fluid.stride, vX, vY, step, domain);
+    });
+    /* one sorting advance, then none until the timing is done
+    */
+    particles.setSortInterval(1);
+    particles.advance<velocitySplit>(solid, n, fluid.stride, vX, vY, step, domain);
+    particles.setSortInterval(0);
+    double sortedMs = averageMs([&]{
+        particles.advance<velocitySplit>(solid, n, fluid.stride, vX, vY, step, domain);
+    });
+    particles.setThreads(0);
+    double threadedMs = averageMs([&]{
+        particles.advance<velocitySplit>(solid, n, fluid.stride, vX, vY, step, domain);
+    });
+    std::cout << "tracer particles, N = " << n << ", " << particles.getCount()
+              << " particles (ms per advance)" << std::endl;
+    std::cout << std::fixed << std::setprecision(3)
+              << "  emission order     " << std::setw(10) << randomMs << std::endl
+              << "  sorted             " << std::setw(10) << sortedMs
+              << "   speedup " << randomMs / sortedMs << std::endl
+              << "  sorted, " << std::setw(3) << std::thread::hardware_concurrency()
+              << " threads " << std::setw(10) << threadedMs
+              << "   speedup " << randomMs / threadedMs << std::endl;
+}
+
+/* energy and enstrophy of a velocity field given by
+ * vel(atType, i, j), over the interior away from the walls
+*/
+template<typename V>
+void measureFlow(int n, V vel, double &energy, double &enstrophy){
+    energy = enstrophy = 0.0;
+    for(int j = 2; j < n-2; j++){
+        for(int i = 2; i < n-2; i++){
+            float u = vel(VELOCITY_X, i, j);
+            float v = vel(VELOCITY_Y, i, j);
+            float w = (vel(VELOCITY_Y, i+1, j) - vel(VELOCITY_Y, i-1, j)) -
+                      (vel(VELOCITY_X, i, j+1) - vel(VELOCITY_X, i, j-1));
+            energy += u * u + v * v;
+            enstrophy += w * w;
+        }
+    }
+}
+
+/* vortex in the middle of the domain of any engine, a gaussian
+ * blob of vorticity of radius 0.1 and a peak speed of the given
+ * cells per step
+*/
+template<typename F>
+void addVortex(F &engine, int n, float cells){
+    const float r0 = 0.1;
+    float speed = cells / (dt * (n-2));
+    for(int j = 1; j < n-1; j++){
+        for(int i = 1; i < n-1; i++){
+            float dx = (i - 0.5) / (n-2) - 0.5;
+            float dy = (j - 0.5) / (n-2) - 0.5;
+            float g = sqrtf(M_E) * expf(-(dx * dx + dy * dy) / (2 * r0 * r0)) / r0;
+            engine.addVelocitySource(i, j, -speed * dy * g, speed * dx * g);
+        }
+    }
+}
+
+/* the vortex (one cell per step) left alone for 100 steps,
+ * from the end of a few steps that let the solvers which start
+ * from their last solution (psi of the vorticity engine) catch
+ * up with it. It is stable, so all that it loses is numerical
+ * dissipation:
+ * the semi-lagrangian grid (first and second order) against
+ * PIC/FLIP, which carries the velocity on particles, the
+ * lattice Boltzmann engine and the vorticity-streamfunction
+ * engine (one Poisson solve per step instead of two)
+*/
+void benchVortex(int n){
+    const int steps = 100;
+    const int warmup = 30;
+    std::cout << "vortex after " << steps << " steps, N = " << n << std::endl;
+    std::cout << "  engine              energy   enstrophy   step(ms)" << std::endl;
+    auto report = [&](const char *name, double e0, double z0, double e1, double z1, double ms){
+        std::cout << "  " << std::left << std::setw(18) << name << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(8) << e1 / e0 << std::setw(12) << z1 / z0
+                  << std::setw(11) << ms << std::endl;
+    };
+    const char *names[] = {"grid", "grid, MacCormack", "grid, Chebyshev"};
+    for(int g = 0; g < 3; g++){
+        FluidClass fluid(n, 0.0, 0.0, dt, 1);
+        if(g == 1){
+            fluid.setAdvectionScheme(VELOCITY_X, MACCORMACK);
+            fluid.setAdvectionScheme(VELOCITY_Y, MACCORMACK);
+        }
+        /* the pressure solver of the vorticity engine, for the
+         * cost of two solves against one
+        */
+        if(g == 2)
+            fluid.setBackends("poisson=chebyshev");
+        auto vel = [&](attribute atType, int i, int j){
+            return fluid.getComponent(fluid.vCurr, atType)[velocityLayout::cell(i, j, fluid.stride)];
+        };
+        addVortex(fluid, n, 1.0);
+        for(int s = 0; s < warmup; s++)
+            fluid.simulationStep();
+        double e0, z0, e1, z1;
+        measureFlow(n, vel, e0, z0);
+        double ms = averageMs([&]{
+            fluid.simulationStep();
+        }, NULL, steps);
+        measureFlow(n, vel, e1, z1);
+        report(names[g], e0, z0, e1, z1, ms);
+    }
+    auto runEngine = [&](const char *name, auto &engine){
+        auto vel = [&](attribute atType, int i, int j){
+            return engine.getVelocity(atType, i, j);
+        };
+        addVortex(engine, n, 1.0);
+        for(int s = 0; s < warmup; s++)
+            engine.simulationStep();
+        double e0, z0, e1, z1;
+        measureFlow(n, vel, e0, z0);
+        double ms = averageMs([&]{
+            engine.simulationStep();
+        }, NULL, steps);
+        measureFlow(n, vel, e1, z1);
+        report(name, e0, z0, e1, z1, ms);
+    };
+    FLIPFluidClass flip(n, 0.0, 0.0, dt);
+    runEngine("PIC/FLIP", flip);
+    LBMFluidClass lbm(n, 0.0, 0.0, dt);
+    runEngine("lattice Boltzmann", lbm);
+    VorticityFluidClass vort(n, 0.0, 0.0, dt);
+    runEngine("vorticity", vort);
+    VorticityFluidClass vortMac(n, 0.0, 0.0, dt);
+    vortMac.setBackends("advection-density=maccormack");
+    runEngine("vorticity, MacC.", vortMac);
+}
+
+/* lattice Boltzmann throughput, million lattice cell updates
+ * per second (MLUPS) of the fused stream-collide steps, and
+ * the memory of the single AA buffer against a FluidClass of
+ * the same size
+*/
+void benchLbm(int n){
+    LBMFluidClass lbm(n, 0.0, vDiff, dt);
+    FluidClass fluid(n, 0.0, vDiff, dt, 1);
+    /* fast enough for several lattice steps per time step
+    */
+    addVortex(lbm, n, 1.0);
+    lbm.simulationStep();
+    long long updates = 0;
+    double ms = averageMs([&]{
+        lbm.velocityStep();
+        updates += (long long)lbm.getSubsteps() * (n-2) * (n-2);
+    }, NULL, kBenchRepeat);
+    std::cout << "lattice Boltzmann, N = " << n << std::endl;
+    std::cout << std::fixed << std::setprecision(3)
+              << "  lattice steps per step   " << lbm.getSubsteps() << std::endl
+              << "  velocity step (ms)       " << ms << std::endl
+              << "  MLUPS                    " << updates / (ms * kBenchRepeat * 1000.0) << std::endl
+              << "  memory (MB)              " << lbm.getMemoryUsage() / 1048576.0
+              << "  (FluidClass " << fluid.getMemoryUsage() / 1048576.0 << ")" << std::endl;
+}
+
+/* a pressure backend from outside Fluid.cpp, plain Jacobi
+ * sweeps (every cell from the previous sweep), kIter of them
+*/
+class JacobiPoissonClass : public PoissonBackendClass<FluidClass>{
+    private:
+        std::vector<float> other;
+    public:
+        void solve(FluidClass &fluid, float *p, float *div){
+            int n = fluid.vN, row = fluid.vStride;
+            const ObstacleClass &solid = fluid.getObstacles(CLEAR_DIVERGENCE);
+            other.assign(p, p + scalarLayout::size(n, row));
+            float *src = p, *dst = other.data();
+            for(int it = 0; it < kIter; it++){
+                for(int j = 1; j < n-1; j++){
+                    for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+                        for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++){
+                            int c = scalarLayout::cell(i, j, row);
+                            dst[c] = (div[c] + src[scalarLayout::prevI(c, row)] +
+                                      src[scalarLayout::nextI(c, row)] +
+                                      src[scalarLayout::prevJ(c, row)] +
+                                      src[scalarLayout::nextJ(c, row)]) * 0.25;
+                        }
+                    }
+                }
+                fluid.setBoundaries(CLEAR_DIVERGENCE, dst);
+                std::swap(src, dst);
+            }
+            if(src != p)
+                memcpy(p, src, scalarLayout::size(n, row) * sizeof(float));
+        }
+};
+
+/* the same workload (a clone of one starting state) stepped
+ * with different backends, chosen by name. The divergence
+ * left after the step and how far the density ends up from
+ * the default backends show what the time buys
+*/
+void benchBackends(int n){
+    const int steps = 10;
+    BackendRegistryClass<FluidClass>::get().addPoisson("jacobi", new JacobiPoissonClass);
+    FluidClass start(n, 0.0001, 0.001, dt, 1);
+    fillFields(start, 2.0);
+    start.vCurr.swap(start.vPrev);
+    start.dCurr.swap(start.dPrev);
+    const char *specs[] = {
+        "poisson=sor",
+        "poisson=gauss-seidel",
+        "poisson=chebyshev",
+        "poisson=jacobi",
+        "diffusion=iterative",
+        "diffusion=adi",
+        "advection=maccormack",
+        "advection=bfecc"
+    };
+    int numSpecs = sizeof(specs) / sizeof(specs[0]);
+    std::vector<float> reference;
+    std::cout << "backends, N = " << n << ", " << steps << " steps" << std::endl;
+    std::cout << "  backends                step(ms)   divergence   density diff" << std::endl;
+    for(int b = 0; b < numSpecs; b++){
+        FluidClass fluid = start.clone();
+        if(!fluid.setBackends(specs[b]))
+            continue;
+        double ms = averageMs([&]{
+            fluid.simulationStep();
+        }, NULL, steps);
+        int row = fluid.stride;
+        float *vX = fluid.getComponent(fluid.vCurr, VELOCITY_X);
+        float *vY = fluid.getComponent(fluid.vCurr, VELOCITY_Y);
+        double div = 0.0, diff = 0.0;
+        for(int j = 2; j < n-2; j++){
+            for(int i = 2; i < n-2; i++){
+                int c = velocityLayout::cell(i, j, row);
+                float d = 0.5 * (vX[velocityLayout::nextI(c, row)] - vX[velocityLayout::prevI(c, row)] +
+                                 vY[velocityLayout::nextJ(c, row)] - vY[velocityLayout::prevJ(c, row)]);
+                div += d * d;
+            }
+        }
+        if(b == 0)
+            reference.assign(fluid.dPrev.data(), fluid.dPrev.data() + fluid.dPrev.count());
+        for(int k = 0; k < fluid.dPrev.count(); k++)
+            diff += (fluid.dPrev[k] - reference[k]) * (fluid.dPrev[k] - reference[k]);
+        std::cout << "  " << std::left << std::setw(22) << specs[b] << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(10) << ms << std::scientific
+                  << std::setprecision(2) << std::setw(13) << sqrt(div / ((n-4) * (n-4)))
+                  << std::setw(15) << sqrt(diff / ((n-2) * (n-2))) << std::endl;
+        std::cout << std::defaultfloat;
+    }
+}
+
+/* plume of any engine, density and an upward push over the
+ * same small part of the domain (a few cells of the N = 128
+ * grid) whatever the size of the grid
+*/
+template<typename F>
+void addPlume(F &engine, int n){
+    for(int j = 1; j < n-1; j++){
+        for(int i = 1; i < n-1; i++){
+            float x = (i - 0.5) / (n-2);
+            float y = (j - 0.5) / (n-2);
+            if(fabsf(x - 0.5) > 0.02 || fabsf(y - 0.11) > 0.012)
+                continue;
+            engine.addDensitySource(i, j, 1.0);
+            engine.addVelocitySource(i, j, 0.0, 0.02);
+        }
+    }
+}
+
+/* the plume on the AMR engine against uniform grids of the
+ * render size and of 1024 x 1024, the cost the AMR engine has
+ * to stay within. The AMR engine is timed once the plume has
+ * risen and the tree has followed it, with the regrids in
+ * the average. cells are the leaf cells, resolution that of
+ * a uniform grid with the finest cells
+*/
+void benchAmr(int n){
+    const int warmup = 60;
+    const int steps = 20;
+    std::cout << "plume, N = " << n << std::endl;
+    std::cout << "  engine              step(ms)        cells   resolution   memory(MB)" << std::endl;
+    auto report = [&](const char *name, double ms, long cells, int finest, size_t bytes){
+        std::cout << "  " << std::left << std::setw(18) << name << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(10) << ms << std::setw(13) << cells
+                  << std::setw(13) << finest << std::setw(13) << bytes / 1048576.0 << std::endl;
+    };
+    int sizes[] = {n, 1024};
+    for(int g = 0; g < 2; g++){
+        int m = sizes[g];
+        FluidClass fluid(m, 0.0, vDiff, dt, 1);
+        /* a uniform step costs the same whatever the flow
+        */
+        addPlume(fluid, m);
+        fluid.simulationStep();
+        double ms = averageMs([&]{
+            addPlume(fluid, m);
+            fluid.simulationStep();
+        }, NULL, g == 0 ? steps : 3);
+        report(g == 0 ? "uniform" : "uniform 1024", ms, (long)(m-2) * (m-2), m-2,
+               fluid.getMemoryUsage());
+    }
+    AMRFluidClass amr(n, 0.0, vDiff, dt);
+    for(int s = 0; s < warmup; s++){
+        addPlume(amr, n);
+        amr.simulationStep();
+    }
+    double ms = averageMs([&]{
+        addPlume(amr, n);
+        amr.simulationStep();
+    }, NULL, steps);
+    report("AMR", ms, (long)amr.getNumLeaves() * amrPatchSize * amrPatchSize,
+           amrPatchSize << amr.getFinestLevel(), amr.getMemoryUsage());
+}
+
+int main(void){
+#ifdef __AVX2__
+    std::cout << "[INFO] AVX2 kernels enabled" << std::endl;
+#else
+    std::cout << "[INFO] AVX2 kernels disabled, scalar fallback" << std::endl;
+#endif
+    benchAdvection(N);
+    benchAdvection(1024);
+    benchLayouts(N);
+    benchLayouts(1024);
+    benchZOrder(N, kBenchRepeat);
+    benchZOrder(1024, 5);
+    benchZOrder(2048, 2);
+    benchProjection(N);
+    benchProjection(512);
+    benchDiffusionFused(N);
+    benchDiffusionFused(1024);
+    benchRelaxation(N);
+    benchRelaxation(512);
+    benchDiffusionModes(N);
+    benchDiffusionModes(1024);
+    benchObstacles(N);
+    benchObstacles(1024);
+    benchScalars(N);
+    benchScalars(1024);
+    benchParticles(N);
+    benchParticles(1024);
+    benchVortex(N);
+    benchVortex(512);
+    benchLbm(N);
+    benchLbm(1024);
+    benchBackends(N);
+    benchBackends(512);
+    benchAmr(N);
+    return 0;
+}
@@ -36,16 +36,16 @@ std::vector<float> vertices;
 */
 std::vector<unsigned int> indices;
 /* RGBA format, define the color for all the border cells.
- * We are not using vector here since we need to index
- * into a specific cell to set the colors. It is easier
- * to do this with arrays
+ * Sized once here and indexed into directly to set the
+ * color of a specific cell, the vector owns the memory
+ * so nothing has to be freed on any exit path
  * 
  * Total #of elements in color array = 
  * 4 (RGBA) * 4(vertices per cell) * 
  * (N + 2) * (N + 2) (cells)
 */
 const int sz = 16 * (N + 2) * (N + 2);
-float *color = (float*)malloc(sizeof(float) * sz);
+std::vector<float> color(sz);
 /* cell colors
 */
 float borderR = 1.0, borderG = 1.0, borderB = 0.0, borderAlpha = 1.0;
@@ -324,7 +324,7 @@ void moveDataToGPU(dataType dtType){
         */
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBOColor);
-        glBufferData(GL_ARRAY_BUFFER, sz * sizeof(float), color, GL_DYNAMIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, sz * sizeof(float), color.data(), GL_DYNAMIC_DRAW);
         glBindVertexArray(0);
     }
 }
@@ -394,9 +394,6 @@ void openGLClose(void){
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
     glDeleteBuffers(1, &VBOColor);
-    /* deallocate heap memory
-    */
-    free(color);
     /* As soon as we exit the render loop we would like 
      * to properly clean/delete all of GLFW's resources 
      * that were allocated. We can do this via the glfwTerminate 
@@ -608,13 +605,4 @@ float getRandomAmount(float start, float end){
     std::default_random_engine eng(rd());
     std::uniform_real_distribution<> distr(start, end);
     return distr(eng);
-}
-
-/* get grid position given the index
- * positions (i, j)
- * Usage: if i = 9, j = 9 in a 10x10 grid,
- * index will be 9 + (9 * 10) = 99
-*/
-int getIdx(int i, int j){
-    return i + (j * N);
 }
\ No newline at end of file
@@ -2,11 +2,21 @@
 #include "../../Include/Simulation/Fluid.h"
 #include "../../Include/Control/Utils.h"
 #include "../../Include/Visualization/Shader/Shader.h"
+#include <iostream>
 
 int main(void){
     /* create fluid object
     */
-    FluidClass Fluid(N, dDiff, vDiff, dt);
+    FluidClass Fluid(N, dDiff, vDiff, dt, vFactor);
+    /* solvers and stages that run every time step, these are
+     * checked here so that a bad name fails at startup
+    */
+    if(!Fluid.setBackends(backendSpec))
+        return -1;
+    if(!Fluid.setPipeline(pipelineSpec))
+        return -1;
+    std::cout << "[INFO] Simulation fields use " << Fluid.getMemoryUsage()
+              << " bytes" << std::endl;
     /* OpenGL bringup routine
     */
     GLFWwindow* window = openGLBringUp();
@@ -134,10 +144,11 @@ int main(void){
         }
         Fluid.addVelocitySource(cellX, cellY, getRandomAmount(-1.0, 1.0), 
                                               getRandomAmount(-1.0, 1.0));
-        /* simulate for one tine step, to see the effects after
-         * adding source
+        /* simulate for one frame, to see the effects after
+         * adding source. The frame is split into as many time
+         * steps as the velocity needs
         */
-        Fluid.simulationStep();
+        Fluid.frameStep(dt);
         /* To see the fluid flow, we need to plot the density (dye)
          * value at every grid cell (except the border cells). move
          * the attribute array to color array
@@ -146,7 +157,7 @@ int main(void){
             for(int j = 0; j < N; j++){
                 /* cellAlpha has to be in the range 0.0 to 1.0
                 */
-                cellAlpha = Fluid.dPrev[(i + (j * N))];
+                cellAlpha = Fluid.getDensity(i, j);
                 genCellColor(i + 1, j + 1, cellR, cellG, cellB, cellAlpha);
             }
         }
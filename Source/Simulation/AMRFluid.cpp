@@ -0,0 +1,950 @@
+#include "../../Include/Simulation/AMRFluid.h"
+#include "../../Include/Control/Constants.h"
+#include <stdlib.h> /* for calloc, free
+*/
+#include <string.h> /* for memcpy
+*/
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+AMRFluidClass::AMRFluidClass(int _N, float _dDiff, float _vDiff, float _dt){
+    N = _N;
+    assert((N+2) % 2 == 0);
+    dDiff = _dDiff;
+    vDiff = _vDiff;
+    dt = _dt;
+    /* patches are split in half along each axis, so B
+     * has to be even
+    */
+    B = amrPatchSize;
+    assert(B % 2 == 0);
+    BG = B + 2;
+    minLevel = amrMinLevel;
+    maxLevel = amrMaxLevel;
+    assert(minLevel <= maxLevel);
+    numSteps = 0;
+    levels.resize(maxLevel + 1);
+
+    readLevel = 0;
+    while((B << readLevel) < (N-2) && readLevel < maxLevel)
+        readLevel++;
+    /* start with a single patch covering the whole domain
+     * and split it uniformly down to minLevel
+    */
+    allocNode(0, 0, 0, -1);
+    for(int l = 0; l < minLevel; l++){
+        int numNodes = nodes.size();
+        for(int n = 0; n < numNodes; n++){
+            if(nodes[n].alive && nodes[n].level == l)
+                refineNode(n);
+        }
+    }
+    rebuildLists();
+}
+
+AMRFluidClass::~AMRFluidClass(void){
+    for(size_t n = 0; n < nodes.size(); n++){
+        if(nodes[n].alive)
+            free(nodes[n].block);
+    }
+}
+
+int AMRFluidClass::getPatchIdx(int i, int j){
+    return i + (j * BG);
+}
+
+int AMRFluidClass::allocNode(int level, int pi, int pj, int parent){
+    int n;
+    if(!freeNodes.empty()){
+        n = freeNodes.back();
+        freeNodes.pop_back();
+    }
+    else{
+        n = nodes.size();
+        nodes.push_back(amrNode());
+        indicator.push_back(0.0);
+    }
+    amrNode &nd = nodes[n];
+    nd.level = level;
+    nd.pi = pi;
+    nd.pj = pj;
+    nd.parent = parent;
+    for(int c = 0; c < 4; c++)
+        nd.child[c] = -1;
+    /* all fields of a patch live in one block
+    */
+    nd.block = (float*)calloc(AMR_NUM_FIELDS * BG * BG, sizeof(float));
+    for(int fd = 0; fd < AMR_NUM_FIELDS; fd++)
+        nd.f[fd] = nd.block + fd * BG * BG;
+    nd.ghosts.clear();
+    nd.alive = true;
+    indicator[n] = 0.0;
+    return n;
+}
+
+void AMRFluidClass::freeNode(int n){
+    free(nodes[n].block);
+    nodes[n].block = NULL;
+    nodes[n].ghosts.clear();
+    nodes[n].alive = false;
+    freeNodes.push_back(n);
+}
+
+int AMRFluidClass::locate(float x, float y, int start){
+    /* up to the first node that contains (x,y), most back
+     * traces end up close to where they started
+    */
+    int n = start;
+    while(n != 0){
+        float size = 1.0 / (1 << nodes[n].level);
+        float x0 = nodes[n].pi * size;
+        float y0 = nodes[n].pj * size;
+        if(x >= x0 && x < x0 + size && y >= y0 && y < y0 + size)
+            break;
+        n = nodes[n].parent;
+    }
+    while(nodes[n].child[0] != -1){
+        float size = 1.0 / (1 << nodes[n].level);
+        float midX = (nodes[n].pi + 0.5) * size;
+        float midY = (nodes[n].pj + 0.5) * size;
+        int c = (x >= midX ? 1 : 0) + (y >= midY ? 2 : 0);
+        n = nodes[n].child[c];
+    }
+    return n;
+}
+
+int AMRFluidClass::locateLevel(int ci, int cj, int level){
+    int n = 0;
+    while(nodes[n].level < level && nodes[n].child[0] != -1){
+        /* patch containing (ci, cj) one level below n
+        */
+        int l = nodes[n].level + 1;
+        int px = (ci / B) >> (level - l);
+        int py = (cj / B) >> (level - l);
+        n = nodes[n].child[(px - 2 * nodes[n].pi) + 2 * (py - 2 * nodes[n].pj)];
+    }
+    return n;
+}
+
+float AMRFluidClass::sample(int n, amrField fd, float x, float y){
+    amrNode &nd = nodes[n];
+    float cells = B << nd.level;
+    /* local coordinates, cell li has its center at u = li
+     * (li = 0 is the ghost layer)
+    */
+    float u = x * cells - nd.pi * B + 0.5;
+    float v = y * cells - nd.pj * B + 0.5;
+    u = std::min(std::max(u, 0.0f), (float)(BG-1));
+    v = std::min(std::max(v, 0.0f), (float)(BG-1));
+
+    int i0 = std::min((int)u, BG-2);
+    int j0 = std::min((int)v, BG-2);
+    float s1 = u - i0;
+    float s0 = 1.0 - s1;
+    float t1 = v - j0;
+    float t0 = 1.0 - t1;
+
+    float *arr = nd.f[fd];
+    float z0 = t0 * arr[getPatchIdx(i0, j0)] + t1 * arr[getPatchIdx(i0, j0+1)];
+    float z1 = t0 * arr[getPatchIdx(i0+1, j0)] + t1 * arr[getPatchIdx(i0+1, j0+1)];
+    return (s0 * z0) + (s1 * z1);
+}
+
+void AMRFluidClass::buildGhostStencils(int n){
+    int level = nodes[n].level;
+    int cells = B << level;
+    int originI = nodes[n].pi * B;
+    int originJ = nodes[n].pj * B;
+
+    nodes[n].ghosts.clear();
+    for(int lj = 0; lj < BG; lj++){
+        for(int li = 0; li < BG; li++){
+            if(li > 0 && li < BG-1 && lj > 0 && lj < BG-1)
+                continue;
+
+            ghostStencil g;
+            g.dst = getPatchIdx(li, lj);
+            g.side = 0;
+            /* cell in level coordinates, if it is outside the
+             * domain we mirror it back across the wall
+            */
+            int ci = originI + li - 1;
+            int cj = originJ + lj - 1;
+            if(ci < 0 || ci >= cells)
+                g.side |= 1;
+            if(cj < 0 || cj >= cells)
+                g.side |= 2;
+            ci = std::min(std::max(ci, 0), cells-1);
+            cj = std::min(std::max(cj, 0), cells-1);
+
+            int m = locateLevel(ci, cj, level);
+            amrNode &src = nodes[m];
+            if(src.level == level){
+                /* same level, plain copy
+                */
+                g.node[0] = m;
+                g.idx[0] = getPatchIdx(ci - src.pi * B + 1, cj - src.pj * B + 1);
+                g.w[0] = 1.0;
+                for(int k = 1; k < 4; k++){
+                    g.node[k] = m;
+                    g.idx[k] = g.idx[0];
+                    g.w[k] = 0.0;
+                }
+            }
+            else{
+                /* the region is only covered by a coarser leaf,
+                 * interpolate at the center of our ghost cell
+                */
+                float x = (ci + 0.5) / cells;
+                float y = (cj + 0.5) / cells;
+                float srcCells = B << src.level;
+                float u = x * srcCells - src.pi * B + 0.5;
+                float v = y * srcCells - src.pj * B + 0.5;
+                u = std::min(std::max(u, 0.0f), (float)(BG-1));
+                v = std::min(std::max(v, 0.0f), (float)(BG-1));
+                int i0 = std::min((int)u, BG-2);
+                int j0 = std::min((int)v, BG-2);
+                float s1 = u - i0;
+                float t1 = v - j0;
+
+                for(int k = 0; k < 4; k++)
+                    g.node[k] = m;
+                g.idx[0] = getPatchIdx(i0, j0);
+                g.idx[1] = getPatchIdx(i0, j0+1);
+                g.idx[2] = getPatchIdx(i0+1, j0);
+                g.idx[3] = getPatchIdx(i0+1, j0+1);
+                g.w[0] = (1.0 - s1) * (1.0 - t1);
+                g.w[1] = (1.0 - s1) * t1;
+                g.w[2] = s1 * (1.0 - t1);
+                g.w[3] = s1 * t1;
+            }
+            nodes[n].ghosts.push_back(g);
+        }
+    }
+}
+
+void AMRFluidClass::rebuildLists(void){
+    leaves.clear();
+    for(int l = 0; l <= maxLevel; l++)
+        levels[l].clear();
+
+    for(size_t n = 0; n < nodes.size(); n++){
+        if(nodes[n].alive)
+            levels[nodes[n].level].push_back(n);
+    }
+    /* leaves from the coarsest level down, a ghost cell that
+     * is interpolated from a coarser leaf may read the ghost
+     * cells of that leaf, which are then already filled
+    */
+    for(int l = 0; l <= maxLevel; l++){
+        for(size_t s = 0; s < levels[l].size(); s++){
+            if(nodes[levels[l][s]].child[0] == -1)
+                leaves.push_back(levels[l][s]);
+        }
+    }
+    /* the neighbours of a patch only change when the tree
+     * changes, so the stencils are built once here and
+     * reused by every ghost fill until the next regrid
+    */
+    for(size_t n = 0; n < nodes.size(); n++){
+        if(nodes[n].alive)
+            buildGhostStencils(n);
+    }
+}
+
+void AMRFluidClass::fillGhosts(attribute atType, amrField fd, const std::vector<int> &set){
+    for(size_t s = 0; s < set.size(); s++){
+        amrNode &nd = nodes[set[s]];
+        float *dst = nd.f[fd];
+
+        for(size_t k = 0; k < nd.ghosts.size(); k++){
+            ghostStencil &g = nd.ghosts[k];
+            float val;
+            /* a neighbour at the same level is a plain copy
+            */
+            if(g.w[0] == 1.0)
+                val = nodes[g.node[0]].f[fd][g.idx[0]];
+            else
+                val = g.w[0] * nodes[g.node[0]].f[fd][g.idx[0]] +
+                      g.w[1] * nodes[g.node[1]].f[fd][g.idx[1]] +
+                      g.w[2] * nodes[g.node[2]].f[fd][g.idx[2]] +
+                      g.w[3] * nodes[g.node[3]].f[fd][g.idx[3]];
+            /* same rule as FluidClass::setBoundaries, the
+             * velocity component normal to the wall is negated
+            */
+            if((atType == VELOCITY_X && (g.side & 1)) ||
+               (atType == VELOCITY_Y && (g.side & 2)))
+                val = -val;
+            dst[g.dst] = val;
+        }
+    }
+}
+
+void AMRFluidClass::restrictNode(int n, amrField fd){
+    int half = B/2;
+    float *dst = nodes[n].f[fd];
+
+    for(int c = 0; c < 4; c++){
+        float *src = nodes[nodes[n].child[c]].f[fd];
+        int offsetI = (c % 2) * half;
+        int offsetJ = (c / 2) * half;
+
+        for(int b = 0; b < half; b++){
+            for(int a = 0; a < half; a++){
+                int fi = 2 * a + 1;
+                int fj = 2 * b + 1;
+                dst[getPatchIdx(offsetI + a + 1, offsetJ + b + 1)] =
+                    0.25 * (src[getPatchIdx(fi, fj)] + src[getPatchIdx(fi+1, fj)] +
+                            src[getPatchIdx(fi, fj+1)] + src[getPatchIdx(fi+1, fj+1)]);
+            }
+        }
+    }
+}
+
+void AMRFluidClass::restrictField(amrField fd){
+    for(int l = maxLevel - 1; l >= 0; l--){
+        for(size_t s = 0; s < levels[l].size(); s++){
+            int n = levels[l][s];
+            if(nodes[n].child[0] != -1)
+                restrictNode(n, fd);
+        }
+    }
+}
+
+void AMRFluidClass::exchange(attribute atType, amrField fd){
+    restrictField(fd);
+    fillGhosts(atType, fd, leaves);
+}
+
+void AMRFluidClass::prolongate(int parent, int child, amrField fd){
+    float cells = B << nodes[child].level;
+    float *dst = nodes[child].f[fd];
+
+    for(int lj = 1; lj <= B; lj++){
+        for(int li = 1; li <= B; li++){
+            float x = (nodes[child].pi * B + li - 0.5) / cells;
+            float y = (nodes[child].pj * B + lj - 0.5) / cells;
+            dst[getPatchIdx(li, lj)] = sample(parent, fd, x, y);
+        }
+    }
+}
+
+void AMRFluidClass::refineNode(int n){
+    for(int c = 0; c < 4; c++){
+        int m = allocNode(nodes[n].level + 1,
+                          2 * nodes[n].pi + (c % 2),
+                          2 * nodes[n].pj + (c / 2), n);
+        nodes[n].child[c] = m;
+    }
+    /* the new patches start out as the bilinear
+     * interpolation of their parent
+    */
+    for(int c = 0; c < 4; c++){
+        prolongate(n, nodes[n].child[c], AMR_D);
+        prolongate(n, nodes[n].child[c], AMR_VX);
+        prolongate(n, nodes[n].child[c], AMR_VY);
+        prolongate(n, nodes[n].child[c], AMR_P);
+    }
+}
+
+void AMRFluidClass::coarsenNode(int n){
+    restrictNode(n, AMR_D);
+    restrictNode(n, AMR_VX);
+    restrictNode(n, AMR_VY);
+    restrictNode(n, AMR_P);
+    for(int c = 0; c < 4; c++){
+        freeNode(nodes[n].child[c]);
+        nodes[n].child[c] = -1;
+    }
+}
+
+float AMRFluidClass::refineIndicator(int n, float dScale, float vScale){
+    float *vX = nodes[n].f[AMR_VX];
+    float *vY = nodes[n].f[AMR_VY];
+    float *d = nodes[n].f[AMR_D];
+    float worst = 0.0;
+
+    for(int lj = 1; lj <= B; lj++){
+        for(int li = 1; li <= B; li++){
+            /* vorticity times the cell size, i.e the jump in
+             * velocity across one cell
+            */
+            float vort = 0.5 * (vY[getPatchIdx(li+1, lj)] - vY[getPatchIdx(li-1, lj)]) -
+                         0.5 * (vX[getPatchIdx(li, lj+1)] - vX[getPatchIdx(li, lj-1)]);
+            float gX = 0.5 * (d[getPatchIdx(li+1, lj)] - d[getPatchIdx(li-1, lj)]);
+            float gY = 0.5 * (d[getPatchIdx(li, lj+1)] - d[getPatchIdx(li, lj-1)]);
+            float grad = sqrtf(gX * gX + gY * gY);
+
+            worst = std::max(worst, fabsf(vort) / (amrRefineVort * vScale));
+            worst = std::max(worst, grad / (amrRefineGrad * dScale));
+        }
+    }
+    return worst;
+}
+
+void AMRFluidClass::regrid(void){
+    exchange(VELOCITY_X, AMR_VX);
+    exchange(VELOCITY_Y, AMR_VY);
+    exchange(DENSITY, AMR_D);
+    exchange(CLEAR_DIVERGENCE, AMR_P);
+
+    /* the jumps are measured against the largest density and
+     * speed in the domain, so that only the sharpest parts of
+     * the flow are refined whatever the strength of the
+     * sources
+    */
+    float dMax = 0.0, vMax = 0.0;
+    for(size_t s = 0; s < leaves.size(); s++){
+        amrNode &nd = nodes[leaves[s]];
+        for(int lj = 1; lj <= B; lj++){
+            for(int li = 1; li <= B; li++){
+                int c = getPatchIdx(li, lj);
+                dMax = std::max(dMax, fabsf(nd.f[AMR_D][c]));
+                vMax = std::max(vMax, fabsf(nd.f[AMR_VX][c]) + fabsf(nd.f[AMR_VY][c]));
+            }
+        }
+    }
+    /* a field that is still 0 everywhere refines nothing
+    */
+    float dScale = dMax > 0.0 ? dMax : INFINITY;
+    float vScale = vMax > 0.0 ? vMax : INFINITY;
+    for(size_t s = 0; s < leaves.size(); s++)
+        indicator[leaves[s]] = refineIndicator(leaves[s], dScale, vScale);
+    /* merge 4 sibling leaves if all of them are smooth,
+     * deepest level first
+    */
+    int numLeaves = leaves.size();
+    for(int l = maxLevel - 1; l >= minLevel; l--){
+        for(size_t s = 0; s < levels[l].size(); s++){
+            int n = levels[l][s];
+            if(!nodes[n].alive || nodes[n].child[0] == -1)
+                continue;
+
+            bool smooth = true;
+            float worst = 0.0;
+            for(int c = 0; c < 4; c++){
+                int m = nodes[n].child[c];
+                smooth = smooth && (nodes[m].child[0] == -1) &&
+                         (indicator[m] < amrCoarsenRatio);
+                worst = std::max(worst, indicator[m]);
+            }
+            if(smooth && keepsBalance(n)){
+                coarsenNode(n);
+                indicator[n] = worst;
+                numLeaves -= 3;
+            }
+        }
+    }
+    /* split the leaves with the most detail first, until
+     * we run out of cells
+    */
+    std::vector<int> candidates;
+    for(size_t s = 0; s < leaves.size(); s++){
+        int n = leaves[s];
+        if(nodes[n].alive && nodes[n].child[0] == -1 &&
+           nodes[n].level < maxLevel && indicator[n] > 1.0)
+            candidates.push_back(n);
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [this](int a, int b){ return indicator[a] > indicator[b]; });
+
+    for(size_t s = 0; s < candidates.size(); s++){
+        if((long)(numLeaves + 3) * B * B > amrCellBudget)
+            break;
+        refineNode(candidates[s]);
+        numLeaves += 3;
+    }
+    balanceTree();
+}
+
+bool AMRFluidClass::keepsBalance(int n){
+    /* n would be a leaf next to the grandchildren of a
+     * neighbour, balanceTree would split it right back
+    */
+    int level = nodes[n].level;
+    int patches = 1 << level;
+    for(int dj = -1; dj <= 1; dj++){
+        for(int di = -1; di <= 1; di++){
+            int pi = nodes[n].pi + di;
+            int pj = nodes[n].pj + dj;
+            if((di == 0 && dj == 0) || pi < 0 || pi >= patches || pj < 0 || pj >= patches)
+                continue;
+            int m = locateLevel(pi * B, pj * B, level);
+            if(nodes[m].level < level || nodes[m].child[0] == -1)
+                continue;
+            for(int c = 0; c < 4; c++){
+                if(nodes[nodes[m].child[c]].child[0] != -1)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+void AMRFluidClass::balanceTree(void){
+    /* refine every leaf that is more than one level coarser
+     * than a leaf next to it (also across the corners), until
+     * there are none. The coarse-fine interpolation and the
+     * flux matching then only ever see a jump of one level.
+     * This may add a few patches over amrCellBudget
+    */
+    bool changed = true;
+    while(changed){
+        /* a patch made by the last pass may have to be split
+         * again, which interpolates from its ghost cells
+        */
+        rebuildLists();
+        exchange(VELOCITY_X, AMR_VX);
+        exchange(VELOCITY_Y, AMR_VY);
+        exchange(DENSITY, AMR_D);
+        exchange(CLEAR_DIVERGENCE, AMR_P);
+
+        changed = false;
+        for(size_t s = 0; s < leaves.size(); s++){
+            int n = leaves[s];
+            if(nodes[n].child[0] != -1 || nodes[n].level < 2)
+                continue;
+            int level = nodes[n].level;
+            int patches = 1 << level;
+            for(int dj = -1; dj <= 1; dj++){
+                for(int di = -1; di <= 1; di++){
+                    int pi = nodes[n].pi + di;
+                    int pj = nodes[n].pj + dj;
+                    if(pi < 0 || pi >= patches || pj < 0 || pj >= patches)
+                        continue;
+                    int m = locateLevel(pi * B, pj * B, level);
+                    if(nodes[m].level < level - 1){
+                        refineNode(m);
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void AMRFluidClass::addSourceRecursive(int n, amrField fd, float x0, float y0,
+                                       float x1, float y1, float amount){
+    float size = 1.0 / (1 << nodes[n].level);
+    float nx0 = nodes[n].pi * size, nx1 = nx0 + size;
+    float ny0 = nodes[n].pj * size, ny1 = ny0 + size;
+    if(x1 <= nx0 || x0 >= nx1 || y1 <= ny0 || y0 >= ny1)
+        return;
+
+    if(nodes[n].child[0] != -1){
+        for(int c = 0; c < 4; c++)
+            addSourceRecursive(nodes[n].child[c], fd, x0, y0, x1, y1, amount);
+        return;
+    }
+    /* spread the source over the cells it overlaps, a cell
+     * larger than the source region gets a proportionally
+     * smaller amount so that the total added stays the same
+    */
+    int cells = B << nodes[n].level;
+    float h = 1.0 / cells;
+    int iStart = std::max((int)(x0 * cells), nodes[n].pi * B);
+    int iEnd = std::min((int)ceilf(x1 * cells), (nodes[n].pi + 1) * B);
+    int jStart = std::max((int)(y0 * cells), nodes[n].pj * B);
+    int jEnd = std::min((int)ceilf(y1 * cells), (nodes[n].pj + 1) * B);
+
+    for(int cj = jStart; cj < jEnd; cj++){
+        for(int ci = iStart; ci < iEnd; ci++){
+            float overlapX = std::min(x1, (ci + 1) * h) - std::max(x0, ci * h);
+            float overlapY = std::min(y1, (cj + 1) * h) - std::max(y0, cj * h);
+            if(overlapX <= 0 || overlapY <= 0)
+                continue;
+            float frac = (overlapX * overlapY) / (h * h);
+            nodes[n].f[fd][getPatchIdx(ci - nodes[n].pi * B + 1, cj - nodes[n].pj * B + 1)] +=
+                amount * frac;
+        }
+    }
+}
+
+void AMRFluidClass::addSource(amrField fd, int i, int j, float amount){
+    /* footprint of render cell (i,j) in the unit square,
+     * interior cells are 1 to N-2 like in FluidClass
+    */
+    float hr = 1.0 / (N-2);
+    float x0 = std::max((i-1) * hr, 0.0f), x1 = std::min(i * hr, 1.0f);
+    float y0 = std::max((j-1) * hr, 0.0f), y1 = std::min(j * hr, 1.0f);
+    if(x1 <= x0 || y1 <= y0)
+        return;
+    addSourceRecursive(0, fd, x0, y0, x1, y1, amount);
+}
+
+void AMRFluidClass::addDensitySource(int i, int j, float amount){
+    addSource(AMR_D, i, j, amount);
+}
+
+void AMRFluidClass::addVelocitySource(int i, int j, float amountX, float amountY){
+    addSource(AMR_VX, i, j, amountX);
+    addSource(AMR_VY, i, j, amountY);
+}
+
+void AMRFluidClass::iterSolve(attribute atType, amrField curr, amrField prev, float diff,
+                              const std::vector<int> &set, int numIter, bool composite){
+    while(numIter != 0){
+        if(composite)
+            restrictField(curr);
+        fillGhosts(atType, curr, set);
+
+        for(size_t s = 0; s < set.size(); s++){
+            amrNode &nd = nodes[set[s]];
+            float cells = B << nd.level;
+            /* curr = (a * prev + k * s)/denom, the coefficients
+             * depend on the cell size of the patch
+            */
+            float a, k, denom;
+            if(atType == CLEAR_DIVERGENCE){
+                a = -1.0 / (cells * cells);
+                k = 1.0;
+                denom = 4.0;
+            }
+            else{
+                a = 1.0;
+                k = dt * diff * cells * cells;
+                denom = 1 + 4 * k;
+            }
+            float *c = nd.f[curr];
+            float *p = nd.f[prev];
+
+            for(int lj = 1; lj <= B; lj++){
+                for(int li = 1; li <= B; li++){
+                    float sum = c[getPatchIdx(li-1, lj)] +
+                                c[getPatchIdx(li+1, lj)] +
+                                c[getPatchIdx(li, lj-1)] +
+                                c[getPatchIdx(li, lj+1)];
+                    c[getPatchIdx(li, lj)] = (a * p[getPatchIdx(li, lj)] + (k * sum))/denom;
+                }
+            }
+        }
+        numIter--;
+    }
+}
+
+void AMRFluidClass::diffuse(attribute atType, amrField curr, amrField prev, float diff){
+    /* k grows with the square of the resolution, so like in
+     * FluidClass::getDiffusionMode the rate picks the scheme.
+     * Without diffusion every leaf is a plain copy (no ghost
+     * exchange), otherwise per patch one explicit step below
+     * kExplicitLimit and the kIter sweeps on the rest
+    */
+    if(diff == 0.0){
+        for(size_t s = 0; s < leaves.size(); s++)
+            memcpy(nodes[leaves[s]].f[curr], nodes[leaves[s]].f[prev], BG * BG * sizeof(float));
+        return;
+    }
+    exchange(atType, prev);
+    std::vector<int> implicitSet;
+    for(size_t s = 0; s < leaves.size(); s++){
+        amrNode &nd = nodes[leaves[s]];
+        float cells = B << nd.level;
+        float k = dt * diff * cells * cells;
+        if(k >= kExplicitLimit){
+            implicitSet.push_back(leaves[s]);
+            continue;
+        }
+        float *c = nd.f[curr];
+        float *p = nd.f[prev];
+
+        for(int lj = 1; lj <= B; lj++){
+            for(int li = 1; li <= B; li++){
+                float sum = p[getPatchIdx(li-1, lj)] +
+                            p[getPatchIdx(li+1, lj)] +
+                            p[getPatchIdx(li, lj-1)] +
+                            p[getPatchIdx(li, lj+1)];
+                c[getPatchIdx(li, lj)] = p[getPatchIdx(li, lj)] +
+                                         k * (sum - 4 * p[getPatchIdx(li, lj)]);
+            }
+        }
+    }
+    if(!implicitSet.empty())
+        iterSolve(atType, curr, prev, diff, implicitSet, kIter, true);
+}
+
+void AMRFluidClass::advection(attribute atType, amrField curr, amrField prev,
+                              amrField vX, amrField vY){
+    exchange(atType, prev);
+
+    for(size_t s = 0; s < leaves.size(); s++){
+        int n = leaves[s];
+        float cells = B << nodes[n].level;
+        float h = 1.0 / cells;
+        float *c = nodes[n].f[curr];
+        float *velX = nodes[n].f[vX];
+        float *velY = nodes[n].f[vY];
+        /* the part of the domain we can sample without
+         * leaving this patch (interior + ghost cells)
+        */
+        float x0 = (nodes[n].pi * B - 0.5) * h, x1 = x0 + (BG-1) * h;
+        float y0 = (nodes[n].pj * B - 0.5) * h, y1 = y0 + (BG-1) * h;
+
+        for(int lj = 1; lj <= B; lj++){
+            for(int li = 1; li <= B; li++){
+                /* trace back in physical units, dt * v is the
+                 * same as dt * (N-2) * v cells in FluidClass
+                */
+                float fX = (nodes[n].pi * B + li - 0.5) * h - dt * velX[getPatchIdx(li, lj)];
+                float fY = (nodes[n].pj * B + lj - 0.5) * h - dt * velY[getPatchIdx(li, lj)];
+                fX = std::min(std::max(fX, 0.0f), 1.0f);
+                fY = std::min(std::max(fY, 0.0f), 1.0f);
+
+                int m = (fX >= x0 && fX <= x1 && fY >= y0 && fY <= y1) ? n : locate(fX, fY, n);
+                c[getPatchIdx(li, lj)] = sample(m, prev, fX, fY);
+            }
+        }
+    }
+}
+
+void AMRFluidClass::compositeResidual(void){
+    exchange(CLEAR_DIVERGENCE, AMR_P);
+
+    for(size_t s = 0; s < leaves.size(); s++){
+        amrNode &nd = nodes[leaves[s]];
+        float cells = B << nd.level;
+        float *p = nd.f[AMR_P];
+        float *div = nd.f[AMR_DIV];
+        float *res = nd.f[AMR_RES];
+
+        for(int lj = 1; lj <= B; lj++){
+            for(int li = 1; li <= B; li++){
+                float sum = p[getPatchIdx(li-1, lj)] +
+                            p[getPatchIdx(li+1, lj)] +
+                            p[getPatchIdx(li, lj-1)] +
+                            p[getPatchIdx(li, lj+1)];
+                res[getPatchIdx(li, lj)] = div[getPatchIdx(li, lj)] -
+                                           cells * cells * (sum - 4 * p[getPatchIdx(li, lj)]);
+            }
+        }
+    }
+    /* coarse-fine flux matching, the flux through the face
+     * between a ghost cell and the cell next to it is
+     * (ghost - cell), whatever the cell size. A coarse cell
+     * replaces its flux through a face that has finer leaves
+     * on the other side by the sum of the fluxes of those fine
+     * cells, so the composite operator loses nothing at the
+     * coarse-fine boundary
+    */
+    for(size_t s = 0; s < leaves.size(); s++){
+        amrNode &nd = nodes[leaves[s]];
+        float cells = B << nd.level;
+        float *p = nd.f[AMR_P];
+
+        for(size_t k = 0; k < nd.ghosts.size(); k++){
+            ghostStencil &g = nd.ghosts[k];
+            int li = g.dst % BG;
+            int lj = g.dst / BG;
+            bool edgeI = (li == 0 || li == BG-1);
+            bool edgeJ = (lj == 0 || lj == BG-1);
+            /* corners are not part of the 5 point stencil and
+             * there is no flux through the walls
+            */
+            if(g.side != 0 || (edgeI && edgeJ))
+                continue;
+            int in = getPatchIdx(std::min(std::max(li, 1), B), std::min(std::max(lj, 1), B));
+            amrNode &src = nodes[g.node[0]];
+
+            if(src.level == nd.level){
+                /* finer leaves behind this face, drop our own
+                 * flux, they add theirs
+                */
+                if(src.child[0] != -1)
+                    nd.f[AMR_RES][in] += cells * cells * (p[g.dst] - p[in]);
+            }
+            else{
+                /* the ghost cell lies in a cell of the coarser
+                 * leaf src, which gets our flux with the sign
+                 * seen from its side
+                */
+                int shift = nd.level - src.level;
+                int ci = ((nd.pi * B + li - 1) >> shift) - src.pi * B + 1;
+                int cj = ((nd.pj * B + lj - 1) >> shift) - src.pj * B + 1;
+                float srcCells = B << src.level;
+                src.f[AMR_RES][getPatchIdx(ci, cj)] -= srcCells * srcCells * (p[in] - p[g.dst]);
+            }
+        }
+    }
+}
+
+void AMRFluidClass::vCycle(void){
+    /* on the way up the tree the residual is only restricted,
+     * there is nothing to smooth yet
+    */
+    compositeResidual();
+    restrictField(AMR_RES);
+    /* correction scheme, the root starts from 0 and every
+     * level below from the correction of its parent. The
+     * leaves of a level are done once the level is smoothed,
+     * the refined nodes pass their correction on
+    */
+    for(int l = 0; l <= maxLevel; l++){
+        if(levels[l].empty())
+            break;
+        for(size_t s = 0; s < levels[l].size(); s++){
+            int n = levels[l][s];
+            if(l == 0)
+                clearPatch(n, AMR_E);
+            else
+                prolongate(nodes[n].parent, n, AMR_E);
+        }
+        int numIter = (l == 0) ? amrCoarseIter : amrSmoothIter;
+        iterSolve(CLEAR_DIVERGENCE, AMR_E, AMR_RES, 0.0, levels[l], numIter, false);
+        /* the children and the finer neighbours interpolate
+         * from the ghost cells too
+        */
+        fillGhosts(CLEAR_DIVERGENCE, AMR_E, levels[l]);
+    }
+    addCorrection();
+    /* post-smoothing on the composite grid. The sweeps of
+     * iterSolve do not know about the flux matching, so they
+     * smooth a correction against the composite residual
+     * (defect correction) instead of the pressure itself
+    */
+    compositeResidual();
+    for(size_t s = 0; s < leaves.size(); s++)
+        clearPatch(leaves[s], AMR_E);
+    iterSolve(CLEAR_DIVERGENCE, AMR_E, AMR_RES, 0.0, leaves, amrSmoothIter, true);
+    addCorrection();
+}
+
+void AMRFluidClass::addCorrection(void){
+    for(size_t s = 0; s < leaves.size(); s++){
+        amrNode &nd = nodes[leaves[s]];
+        float *p = nd.f[AMR_P];
+        float *e = nd.f[AMR_E];
+
+        for(int lj = 1; lj <= B; lj++){
+            for(int li = 1; li <= B; li++)
+                p[getPatchIdx(li, lj)] += e[getPatchIdx(li, lj)];
+        }
+    }
+}
+
+void AMRFluidClass::clearPatch(int n, amrField fd){
+    float *f = nodes[n].f[fd];
+    for(int k = 0; k < BG * BG; k++)
+        f[k] = 0.0;
+}
+
+void AMRFluidClass::clearDivergence(amrField vX, amrField vY){
+    exchange(VELOCITY_X, vX);
+    exchange(VELOCITY_Y, vY);
+    /* divergence in physical units on the leaves
+    */
+    for(size_t s = 0; s < leaves.size(); s++){
+        amrNode &nd = nodes[leaves[s]];
+        float cells = B << nd.level;
+        float *velX = nd.f[vX];
+        float *velY = nd.f[vY];
+        float *div = nd.f[AMR_DIV];
+
+        for(int lj = 1; lj <= B; lj++){
+            for(int li = 1; li <= B; li++){
+                div[getPatchIdx(li, lj)] = 0.5 * cells *
+                    (velX[getPatchIdx(li+1, lj)] - velX[getPatchIdx(li-1, lj)] +
+                     velY[getPatchIdx(li, lj+1)] - velY[getPatchIdx(li, lj-1)]);
+            }
+        }
+    }
+    /* the pressure of the last call (kept through regrids)
+     * is the starting guess
+    */
+    for(int c = 0; c < amrVCycles; c++)
+        vCycle();
+    exchange(CLEAR_DIVERGENCE, AMR_P);
+
+    for(size_t s = 0; s < leaves.size(); s++){
+        amrNode &nd = nodes[leaves[s]];
+        float cells = B << nd.level;
+        float *velX = nd.f[vX];
+        float *velY = nd.f[vY];
+        float *p = nd.f[AMR_P];
+
+        for(int lj = 1; lj <= B; lj++){
+            for(int li = 1; li <= B; li++){
+                velX[getPatchIdx(li, lj)] -= 0.5 * cells *
+                                             (p[getPatchIdx(li+1, lj)] - p[getPatchIdx(li-1, lj)]);
+                velY[getPatchIdx(li, lj)] -= 0.5 * cells *
+                                             (p[getPatchIdx(li, lj+1)] - p[getPatchIdx(li, lj-1)]);
+            }
+        }
+    }
+}
+
+void AMRFluidClass::densityStep(void){
+    /* same order as FluidClass, the source is in AMR_D, the
+     * diffused result goes to AMR_D_TMP and is advected back
+     * into AMR_D
+    */
+    diffuse(DENSITY, AMR_D_TMP, AMR_D, dDiff);
+    advection(DENSITY, AMR_D, AMR_D_TMP, AMR_VX, AMR_VY);
+}
+
+void AMRFluidClass::velocityStep(void){
+    diffuse(VELOCITY_X, AMR_VX_TMP, AMR_VX, vDiff);
+    diffuse(VELOCITY_Y, AMR_VY_TMP, AMR_VY, vDiff);
+    clearDivergence(AMR_VX_TMP, AMR_VY_TMP);
+
+    advection(VELOCITY_X, AMR_VX, AMR_VX_TMP, AMR_VX_TMP, AMR_VY_TMP);
+    advection(VELOCITY_Y, AMR_VY, AMR_VY_TMP, AMR_VX_TMP, AMR_VY_TMP);
+    clearDivergence(AMR_VX, AMR_VY);
+}
+
+void AMRFluidClass::simulationStep(void){
+    velocityStep();
+    densityStep();
+
+    numSteps++;
+    if(numSteps % amrRegridInterval == 0)
+        regrid();
+    /* keep the internal nodes up to date for the readout
+    */
+    restrictField(AMR_D);
+}
+
+float AMRFluidClass::getDensity(int i, int j){
+    /* border cells of the render grid read the nearest
+     * interior cell (continuity)
+    */
+    i = std::min(std::max(i, 1), N-2);
+    j = std::min(std::max(j, 1), N-2);
+    float x = (i - 0.5) / (N-2);
+    float y = (j - 0.5) / (N-2);
+    /* stop at readLevel, the refined nodes there already
+     * hold the average of the finer cells
+    */
+    int n = 0;
+    while(nodes[n].level < readLevel && nodes[n].child[0] != -1){
+        float size = 1.0 / (1 << nodes[n].level);
+        int c = (x >= (nodes[n].pi + 0.5) * size ? 1 : 0) +
+                (y >= (nodes[n].pj + 0.5) * size ? 2 : 0);
+        n = nodes[n].child[c];
+    }
+    int cells = B << nodes[n].level;
+    int li = std::min(std::max((int)(x * cells) - nodes[n].pi * B + 1, 1), B);
+    int lj = std::min(std::max((int)(y * cells) - nodes[n].pj * B + 1, 1), B);
+    return nodes[n].f[AMR_D][getPatchIdx(li, lj)];
+}
+
+int AMRFluidClass::getNumLeaves(void){
+    return leaves.size();
+}
+
+int AMRFluidClass::getFinestLevel(void){
+    int finest = 0;
+    for(size_t s = 0; s < leaves.size(); s++)
+        finest = std::max(finest, nodes[leaves[s]].level);
+    return finest;
+}
+
+size_t AMRFluidClass::getMemoryUsage(void){
+    size_t total = nodes.capacity() * sizeof(amrNode);
+    for(size_t n = 0; n < nodes.size(); n++){
+        if(!nodes[n].alive)
+            continue;
+        total += AMR_NUM_FIELDS * BG * BG * sizeof(float);
+        total += nodes[n].ghosts.capacity() * sizeof(ghostStencil);
+    }
+    return total;
+}
@@ -0,0 +1,131 @@
+#include "../../Include/Simulation/Arena.h"
+#include <stdlib.h> /* for posix_memalign, free
+*/
+#include <string.h> /* for memset
+*/
+#include <utility>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/* size of a huge page, the mapping has to be a multiple of
+ * it
+*/
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+ArenaClass::ArenaClass(void){
+    base = NULL;
+    capacity = used = 0;
+    mapped = hugePages = false;
+}
+
+ArenaClass::~ArenaClass(void){
+    release();
+}
+
+ArenaClass::ArenaClass(ArenaClass &&other) noexcept : ArenaClass(){
+    swap(other);
+}
+
+ArenaClass &ArenaClass::operator=(ArenaClass &&other) noexcept{
+    if(this != &other){
+        release();
+        swap(other);
+    }
+    return *this;
+}
+
+void ArenaClass::swap(ArenaClass &other) noexcept{
+    std::swap(base, other.base);
+    std::swap(capacity, other.capacity);
+    std::swap(used, other.used);
+    std::swap(mapped, other.mapped);
+    std::swap(hugePages, other.hugePages);
+}
+
+void ArenaClass::release(void){
+    if(base != NULL){
+#ifdef __linux__
+        if(mapped)
+            munmap(base, capacity);
+        else
+            free(base);
+#else
+        free(base);
+#endif
+    }
+    base = NULL;
+    capacity = used = 0;
+    mapped = hugePages = false;
+}
+
+size_t ArenaClass::align(size_t bytes){
+    return (bytes + kArenaAlign - 1) / kArenaAlign * kArenaAlign;
+}
+
+bool ArenaClass::reserve(size_t bytes, bool useHugePages){
+    if(base != NULL)
+        return false;
+    capacity = align(bytes);
+    used = 0;
+#ifdef __linux__
+    if(useHugePages){
+        size_t size = (capacity + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+        /* explicit huge pages only exist if the admin has set
+         * some aside (vm.nr_hugepages), otherwise fall back to
+         * normal pages and ask for transparent huge pages
+        */
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED)
+            hugePages = true;
+        else{
+            p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(p == MAP_FAILED)
+                return false;
+            hugePages = (madvise(p, size, MADV_HUGEPAGE) == 0);
+        }
+        /* anonymous mappings are already zeroed
+        */
+        base = (char*)p;
+        capacity = size;
+        mapped = true;
+        return true;
+    }
+#else
+    /* no huge page support, a normal aligned allocation
+    */
+    (void)useHugePages;
+#endif
+    void *p = NULL;
+    if(posix_memalign(&p, kArenaAlign, capacity) != 0)
+        return false;
+    memset(p, 0, capacity);
+    base = (char*)p;
+    return true;
+}
+
+void *ArenaClass::allocBytes(size_t bytes){
+    bytes = align(bytes);
+    if(base == NULL || used + bytes > capacity)
+        return NULL;
+    void *p = base + used;
+    used += bytes;
+    return p;
+}
+
+float *ArenaClass::allocFloats(size_t count){
+    return (float*)allocBytes(count * sizeof(float));
+}
+
+size_t ArenaClass::getCapacity(void){
+    return capacity;
+}
+
+size_t ArenaClass::getUsed(void){
+    return used;
+}
+
+bool ArenaClass::isHugePages(void){
+    return hugePages;
+}
@@ -0,0 +1,336 @@
+#include "../../Include/Simulation/FLIPFluid.h"
+#include "../../Include/Simulation/Parallel.h"
+#include "../../Include/Control/Constants.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h> /* for memset
+*/
+#include <algorithm>
+
+/* cells per side of a tile of the scatter
+*/
+const int kTile = 8;
+
+FLIPFluidClass::FLIPFluidClass(int _N, float _dDiff, float _vDiff, float _dt) :
+    grid(_N, _dDiff, _vDiff, _dt, 1){
+    N = _N;
+    dDiff = _dDiff;
+    vDiff = _vDiff;
+    dt = _dt;
+    int size = grid.vCurr.count();
+    saved = FieldClass<float>(N, grid.stride, 1, size);
+    force = FieldClass<float>(N, grid.stride, 1, size);
+    weight = FieldClass<float>(N, grid.stride, 1);
+    /* a particle in cell i0 (its lower left cell) is in tile
+     * i0/kTile, i0 = 0 ... N-2
+    */
+    tiles = (N + kTile - 1)/kTile;
+    tileStart.resize(tiles * tiles + 1);
+    seed = 1;
+    int count = (N-2) * (N-2) * kFlipParticlesPerCell;
+    px.reserve(2 * count);
+    py.reserve(2 * count);
+    pu.reserve(2 * count);
+    pv.reserve(2 * count);
+    for(int j = 1; j < N-1; j++){
+        for(int i = 1; i < N-1; i++)
+            seedCell(i, j);
+    }
+}
+
+FLIPFluidClass::~FLIPFluidClass(void){
+}
+
+float FLIPFluidClass::random(void){
+    seed = seed * 1103515245u + 12345u;
+    return ((seed >> 8) & 0xffff) / 65536.0f;
+}
+
+void FLIPFluidClass::seedCell(int i, int j){
+    /* jittered on a k x k sub grid of the cell, so that the
+     * particles cover it evenly
+    */
+    int k = (int)sqrtf(kFlipParticlesPerCell);
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    for(int c = 0; c < kFlipParticlesPerCell; c++){
+        float x = i - 0.5 + ((c % k) + random()) / k;
+        float y = j - 0.5 + ((c / k % k) + random()) / k;
+        x = std::min(std::max(x, 1.0f), N - 2.0f);
+        y = std::min(std::max(y, 1.0f), N - 2.0f);
+        px.push_back(x);
+        py.push_back(y);
+        pu.push_back(sample(vX, x, y));
+        pv.push_back(sample(vY, x, y));
+    }
+}
+
+float FLIPFluidClass::sample(const float *arr, float x, float y){
+    int row = grid.stride;
+    int i0 = std::min((int)x, N-2);
+    int j0 = std::min((int)y, N-2);
+    float s1 = x - i0;
+    float s0 = 1.0 - s1;
+    float t1 = y - j0;
+    float t0 = 1.0 - t1;
+    int c = i0 + j0 * row;
+    return s0 * (t0 * arr[c] + t1 * arr[c + row]) + s1 * (t0 * arr[c + 1] + t1 * arr[c + row + 1]);
+}
+
+void FLIPFluidClass::addDensitySource(int i, int j, float amount){
+    grid.addDensitySource(i, j, amount);
+}
+
+void FLIPFluidClass::addVelocitySource(int i, int j, float amountX, float amountY){
+    /* added to the grid velocity of the next step, after the
+     * particles are transferred to it
+    */
+    int idx = i + j * grid.stride;
+    grid.getComponent(force, VELOCITY_X)[idx] += amountX;
+    grid.getComponent(force, VELOCITY_Y)[idx] += amountY;
+}
+
+void FLIPFluidClass::sortParticles(void){
+    /* counting sort by tile, the particles of a tile are then
+     * one range and the threads of the scatter take whole tiles
+    */
+    int count = px.size();
+    keys.resize(count);
+    sortX.resize(count);
+    sortY.resize(count);
+    sortU.resize(count);
+    sortV.resize(count);
+    std::fill(tileStart.begin(), tileStart.end(), 0);
+    for(int k = 0; k < count; k++){
+        keys[k] = ((int)py[k] / kTile) * tiles + (int)px[k] / kTile;
+        tileStart[keys[k] + 1]++;
+    }
+    for(int t = 0; t < tiles * tiles; t++)
+        tileStart[t+1] += tileStart[t];
+    for(int k = 0; k < count; k++){
+        int to = tileStart[keys[k]]++;
+        sortX[to] = px[k];
+        sortY[to] = py[k];
+        sortU[to] = pu[k];
+        sortV[to] = pv[k];
+    }
+    /* the scatter moved every start to the next tile
+    */
+    for(int t = tiles * tiles; t > 0; t--)
+        tileStart[t] = tileStart[t-1];
+    tileStart[0] = 0;
+    px.swap(sortX);
+    py.swap(sortY);
+    pu.swap(sortU);
+    pv.swap(sortV);
+}
+
+void FLIPFluidClass::particlesToGrid(void){
+    int row = grid.stride;
+    float *sumX = grid.getComponent(grid.vPrev, VELOCITY_X);
+    float *sumY = grid.getComponent(grid.vPrev, VELOCITY_Y);
+    float *w = weight.data();
+    memset(grid.vPrev.data(), 0, grid.vPrev.count() * sizeof(float));
+    memset(w, 0, weight.count() * sizeof(float));
+    /* the tiles of one colour, then the next colour
+    */
+    for(int colour = 0; colour < 4; colour++){
+        int cx = colour & 1, cy = colour >> 1;
+        int rows = (tiles - cy + 1)/2, cols = (tiles - cx + 1)/2;
+        parallelFor(rows * cols, 4, kParticleThreads, [&](int begin, int end){
+            for(int c = begin; c < end; c++){
+                int t = (2 * (c / cols) + cy) * tiles + 2 * (c % cols) + cx;
+                for(int k = tileStart[t]; k < tileStart[t+1]; k++){
+                    int i0 = (int)px[k];
+                    int j0 = (int)py[k];
+                    float s1 = px[k] - i0;
+                    float s0 = 1.0 - s1;
+                    float t1 = py[k] - j0;
+                    float t0 = 1.0 - t1;
+                    int idx = i0 + j0 * row;
+                    float w00 = s0 * t0, w10 = s1 * t0, w01 = s0 * t1, w11 = s1 * t1;
+                    w[idx] += w00;
+                    w[idx + 1] += w10;
+                    w[idx + row] += w01;
+                    w[idx + row + 1] += w11;
+                    sumX[idx] += w00 * pu[k];
+                    sumX[idx + 1] += w10 * pu[k];
+                    sumX[idx + row] += w01 * pu[k];
+                    sumX[idx + row + 1] += w11 * pu[k];
+                    sumY[idx] += w00 * pv[k];
+                    sumY[idx + 1] += w10 * pv[k];
+                    sumY[idx + row] += w01 * pv[k];
+                    sumY[idx + row + 1] += w11 * pv[k];
+                }
+            }
+        });
+    }
+    /* weighted mean, a cell that no particle reaches has no
+     * velocity
+    */
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    for(int j = 1; j < N-1; j++){
+        for(int i = 1; i < N-1; i++){
+            int idx = i + j * row;
+            float inv = (w[idx] > 0.0) ? 1.0 / w[idx] : 0.0;
+            vX[idx] = sumX[idx] * inv;
+            vY[idx] = sumY[idx] * inv;
+        }
+    }
+    grid.setBoundaries(VELOCITY_X, vX);
+    grid.setBoundaries(VELOCITY_Y, vY);
+}
+
+void FLIPFluidClass::gridToParticles(void){
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    float *dX = grid.getComponent(saved, VELOCITY_X);
+    float *dY = grid.getComponent(saved, VELOCITY_Y);
+    /* saved becomes the change of the grid velocity
+    */
+    for(int k = 0; k < saved.count(); k++)
+        saved[k] = grid.vCurr[k] - saved[k];
+    parallelFor(px.size(), kParticlesPerThread, kParticleThreads, [&](int begin, int end){
+        for(int k = begin; k < end; k++){
+            float picX = sample(vX, px[k], py[k]);
+            float picY = sample(vY, px[k], py[k]);
+            float flipX = pu[k] + sample(dX, px[k], py[k]);
+            float flipY = pv[k] + sample(dY, px[k], py[k]);
+            pu[k] = kFlipRatio * flipX + (1 - kFlipRatio) * picX;
+            pv[k] = kFlipRatio * flipY + (1 - kFlipRatio) * picY;
+        }
+    });
+}
+
+void FLIPFluidClass::moveParticles(void){
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    /* cells per unit of velocity and time, like the trace of
+     * FluidClass::advection. The particles stay between the
+     * centers of the first and the last interior cells
+    */
+    float dT = dt * (N-2);
+    float lo = 1.0, hi = N - 2.0;
+    parallelFor(px.size(), kParticlesPerThread, kParticleThreads, [&](int begin, int end){
+        for(int k = begin; k < end; k++){
+            float mx = std::min(std::max(px[k] + 0.5f * dT * sample(vX, px[k], py[k]), lo), hi);
+            float my = std::min(std::max(py[k] + 0.5f * dT * sample(vY, px[k], py[k]), lo), hi);
+            px[k] = std::min(std::max(px[k] + dT * sample(vX, mx, my), lo), hi);
+            py[k] = std::min(std::max(py[k] + dT * sample(vY, mx, my), lo), hi);
+        }
+    });
+}
+
+void FLIPFluidClass::balanceParticles(void){
+    /* particles per cell (the cell whose center is nearest),
+     * counted while the crowded cells drop the extra ones
+    */
+    int row = grid.stride;
+    float *count = weight.data();
+    memset(count, 0, weight.count() * sizeof(float));
+    int kept = 0;
+    for(size_t k = 0; k < px.size(); k++){
+        int idx = (int)(px[k] + 0.5) + (int)(py[k] + 0.5) * row;
+        if(count[idx] >= 2 * kFlipParticlesPerCell)
+            continue;
+        count[idx] += 1;
+        px[kept] = px[k];
+        py[kept] = py[k];
+        pu[kept] = pu[k];
+        pv[kept] = pv[k];
+        kept++;
+    }
+    px.resize(kept);
+    py.resize(kept);
+    pu.resize(kept);
+    pv.resize(kept);
+    for(int j = 1; j < N-1; j++){
+        for(int i = 1; i < N-1; i++){
+            if(count[i + j * row] == 0)
+                seedCell(i, j);
+        }
+    }
+}
+
+void FLIPFluidClass::velocityStep(void){
+    grid.dt = dt;
+    sortParticles();
+    particlesToGrid();
+    /* the sources are part of what the grid adds, so the
+     * particles get them through the FLIP update
+    */
+    saved.copyFrom(grid.vCurr);
+    for(int k = 0; k < force.count(); k++){
+        grid.vCurr[k] += force[k];
+        force[k] = 0.0;
+    }
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    grid.setBoundaries(VELOCITY_X, vX);
+    grid.setBoundaries(VELOCITY_Y, vY);
+    if(vDiff > 0.0){
+        float *diffX = grid.getComponent(grid.vPrev, VELOCITY_X);
+        float *diffY = grid.getComponent(grid.vPrev, VELOCITY_Y);
+        grid.diffuse(VELOCITY_X, diffX, vX, vDiff);
+        grid.diffuse(VELOCITY_Y, diffY, vY, vDiff);
+        grid.vCurr.swap(grid.vPrev);
+        vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+        vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    }
+    /* div and p in the free velocity field, like runStages
+    */
+    float *div = grid.vPrev.data();
+    grid.clearDivergence(vX, vY, div, div + scalarLayout::size(N, grid.stride));
+    gridToParticles();
+    moveParticles();
+    balanceParticles();
+}
+
+void FLIPFluidClass::densityStep(void){
+    /* the grid holds the projected velocity of this step
+    */
+    grid.dt = dt;
+    grid.densityStep();
+}
+
+void FLIPFluidClass::simulationStep(void){
+    velocityStep();
+    densityStep();
+}
+
+float FLIPFluidClass::maxVelocity(void){
+    float vMax = 0.0;
+    for(size_t k = 0; k < pu.size(); k++)
+        vMax = std::max(vMax, std::max(fabsf(pu[k]), fabsf(pv[k])));
+    return vMax;
+}
+
+void FLIPFluidClass::frameStep(float frameDt){
+    frameSubsteps(frameDt, N, cflTarget, kMaxSubsteps, [&]{
+        return maxVelocity();
+    }, [&](float step, float){
+        dt = step;
+        simulationStep();
+    });
+}
+
+float FLIPFluidClass::getDensity(int i, int j){
+    return grid.getDensity(i, j);
+}
+
+float FLIPFluidClass::getVelocity(attribute atType, int i, int j){
+    return grid.getComponent(grid.vCurr, atType)[i + j * grid.stride];
+}
+
+int FLIPFluidClass::getParticleCount(void){
+    return px.size();
+}
+
+size_t FLIPFluidClass::getMemoryUsage(void){
+    size_t fields = (saved.count() + force.count() + weight.count()) * sizeof(float);
+    size_t particles = (px.capacity() + py.capacity() + pu.capacity() + pv.capacity() +
+                        sortX.capacity() + sortY.capacity() + sortU.capacity() +
+                        sortV.capacity() + keys.capacity()) * sizeof(float);
+    return grid.getMemoryUsage() + fields + particles;
+}
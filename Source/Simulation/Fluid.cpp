@@ -1,242 +1,2144 @@
 #include "../../Include/Simulation/Fluid.h"
+#include "../../Include/Simulation/Backend.h"
 #include "../../Include/Control/Constants.h"
 #include "../../Include/Control/Utils.h"
-#include <stdlib.h> /* for malloc, calloc, free
+#include <assert.h>
+#include <math.h>
+#include <string.h> /* for memcpy
 */
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
-FluidClass::FluidClass(int _N, float _dDiff, float _vDiff, float _dt){
+template<typename L, typename S>
+FluidLayoutClass<L, S>::FluidLayoutClass(int _N, float _dDiff, float _vDiff, float _dt, int _vFactor){
     N = _N;
     /* (N+2) has to be an even number, for placement
      * on the render screen
     */
     assert((N+2) % 2 == 0);
+    /* every velocity cell covers exactly vFactor x vFactor
+     * density cells
+    */
+    vFactor = _vFactor;
+    assert(vFactor >= 1 && (N-2) % vFactor == 0);
+    vN = (N-2)/vFactor + 2;
     dDiff = _dDiff;
     vDiff = _vDiff;
     dt = _dt;
-    totalCells = N * N;
+    stride = padStrides ? paddedStride(N) : N;
+    vStride = padStrides ? paddedStride(vN) : vN;
+    dSize = S::size(N, stride);
+    vSize = L::size(vN, vStride);
+    /* the projection keeps div and p (scalar fields on the
+     * velocity grid) in a free velocity field
+    */
+    assert(vSize >= 2 * S::size(vN, vStride));
+    /* 2 density fields and a scratch field, 2 velocity
+     * fields and a scratch field (both components in each)
+     * and the upsampled velocity on the density grid
+    */
+    size_t bytes = 3 * ArenaClass::align(dSize * sizeof(float)) +
+                   3 * ArenaClass::align(vSize * sizeof(float));
+    if(vFactor > 1)
+        bytes += ArenaClass::align(L::size(N, stride) * sizeof(float));
+    if(!arena.reserve(bytes, useHugePages)){
+        std::cout << "[ERROR] Unable to allocate " << bytes << " bytes for the fields"
+                  << std::endl;
+        assert(false);
+    }
+    /* one ring of border cells around every field
+    */
+    dCurr = FieldClass<float>(arena, N, stride, 1, dSize);
+    dPrev = FieldClass<float>(arena, N, stride, 1, dSize);
+    dScratch = FieldClass<float>(arena, N, stride, 1, dSize);
+
+    vCurr = FieldClass<float>(arena, vN, vStride, 1, vSize);
+    vPrev = FieldClass<float>(arena, vN, vStride, 1, vSize);
+    vScratch = FieldClass<float>(arena, vN, vStride, 1, vSize);
 
-    dCurr = (float*)calloc(totalCells, sizeof(float));
-    dPrev = (float*)calloc(totalCells, sizeof(float));
+    if(vFactor > 1)
+        vUp = FieldClass<float>(arena, N, stride, 1, L::size(N, stride));
 
-    vXCurr = (float*)calloc(totalCells, sizeof(float));
-    vXPrev = (float*)calloc(totalCells, sizeof(float));
-    vYCurr = (float*)calloc(totalCells, sizeof(float));
-    vYPrev = (float*)calloc(totalCells, sizeof(float));
+    dObstacles = ObstacleClass(N);
+    vObstacles = ObstacleClass(vN);
+
+    for(int a = 0; a < 3; a++)
+        schemes[a] = SEMI_LAGRANGIAN;
+    for(int a = 0; a < 4; a++)
+        relaxations[a] = GAUSS_SEIDEL;
+    relaxations[CLEAR_DIVERGENCE] = SOR;
+    poissonBackend = NULL;
+    diffusionBackend = NULL;
+    for(int a = 0; a < 3; a++)
+        advectionBackends[a] = NULL;
+    forcedDiffusion = -1;
+    zeroPoissonSides = false;
+    for(int s = 0; s < 4; s++){
+        sides[s] = DOMAIN_WALL;
+        inflowSpeed[s] = 0.0;
+    }
+    tracers = NULL;
+    buoyancyScalar = -1;
+    buoyancyAmbient = buoyancyStrength = 0.0;
+    planReported = false;
+    stepMaxVelocity = -1;
+    setPipeline("fused");
 }
 
-FluidClass::~FluidClass(void){
-    free(dCurr);
-    free(dPrev);
+template<typename L, typename S>
+FluidLayoutClass<L, S>::~FluidLayoutClass(void){
+}
 
-    free(vXCurr);
-    free(vXPrev);
-    free(vYCurr);
-    free(vYPrev);
+template<typename L, typename S>
+FluidLayoutClass<L, S> FluidLayoutClass<L, S>::clone(void){
+    FluidLayoutClass copy(N, dDiff, vDiff, dt, vFactor);
+    copy.dCurr.copyFrom(dCurr);
+    copy.dPrev.copyFrom(dPrev);
+    copy.vCurr.copyFrom(vCurr);
+    copy.vPrev.copyFrom(vPrev);
+    /* vUp and the scratch fields are rebuilt every step,
+     * there is nothing to carry over
+    */
+    for(int a = 0; a < 3; a++)
+        copy.schemes[a] = schemes[a];
+    for(int a = 0; a < 4; a++)
+        copy.relaxations[a] = relaxations[a];
+    copy.poissonBackend = poissonBackend;
+    copy.diffusionBackend = diffusionBackend;
+    for(int a = 0; a < 3; a++)
+        copy.advectionBackends[a] = advectionBackends[a];
+    copy.forcedDiffusion = forcedDiffusion;
+    for(int s = 0; s < 4; s++){
+        copy.sides[s] = sides[s];
+        copy.inflowSpeed[s] = inflowSpeed[s];
+    }
+    copy.dObstacles = dObstacles;
+    copy.vObstacles = vObstacles;
+    for(size_t s = 0; s < scalars.size(); s++){
+        int id = copy.addScalar(scalars[s].diff);
+        copy.scalars[id-1].curr.copyFrom(scalars[s].curr);
+        copy.scalars[id-1].prev.copyFrom(scalars[s].prev);
+    }
+    copy.buoyancyScalar = buoyancyScalar;
+    copy.buoyancyAmbient = buoyancyAmbient;
+    copy.buoyancyStrength = buoyancyStrength;
+    copy.pipeline = pipeline;
+    copy.plan = plan;
+    copy.reportedPlan = reportedPlan;
+    copy.planReported = planReported;
+    return copy;
 }
 
-void FluidClass::addDensitySource(int i, int j, float amount){
+template<typename L, typename S>
+int FluidLayoutClass<L, S>::getGridSize(attribute atType){
+    return atType == DENSITY ? N : vN;
+}
+
+template<typename L, typename S>
+int FluidLayoutClass<L, S>::getStride(attribute atType){
+    return atType == DENSITY ? stride : vStride;
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::isVelocity(attribute atType){
+    return atType == VELOCITY_X || atType == VELOCITY_Y;
+}
+
+template<typename L, typename S>
+float *FluidLayoutClass<L, S>::getComponent(FieldClass<float> &vel, attribute atType){
+    assert(isVelocity(atType));
+    return vel.data() + L::component(atType == VELOCITY_Y ? 1 : 0, vel.size(), vel.getStride());
+}
+
+template<typename L, typename S>
+int FluidLayoutClass<L, S>::paddedStride(int n){
+    int line = kArenaAlign / sizeof(float);
+    int row = (n + line - 1) / line * line;
+    if((row & (row - 1)) == 0)
+        row += line;
+    return row;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::addDensitySource(int i, int j, float amount){
     /* add new source to (i,j) cell, think
      * of it as adding a dye to help visulaize
      * the flow
     */
-    dPrev[getIdx(i, j)] += amount;
+    if(dObstacles.isSolid(i, j))
+        return;
+    dPrev[S::cell(i, j, stride)] += amount;
 }
 
-void FluidClass::addVelocitySource(int i, int j, float amountX, float amountY){
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::addVelocitySource(int i, int j, float amountX, float amountY){
     /* add new source to (i,j) cell, think of it
      * as adding a wind source to change the
      * velocity vector field
     */
-    vXCurr[getIdx(i, j)] += amountX;
-    vYCurr[getIdx(i, j)] += amountY;
+    int vI = (i-1)/vFactor + 1;
+    int vJ = (j-1)/vFactor + 1;
+    if(vObstacles.isSolid(vI, vJ))
+        return;
+    int idx = L::cell(vI, vJ, vStride);
+    getComponent(vCurr, VELOCITY_X)[idx] += amountX;
+    getComponent(vCurr, VELOCITY_Y)[idx] += amountY;
+}
+
+template<typename L, typename S>
+int FluidLayoutClass<L, S>::addScalar(float diff){
+    if(getScalarCount() >= kMaxScalars){
+        std::cout << "[ERROR] No room for another scalar field, at most " << kMaxScalars
+                  << std::endl;
+        return -1;
+    }
+    /* zero filled, outside the arena since the scalars come
+     * after it was sized
+    */
+    scalarField scalar;
+    scalar.diff = diff;
+    scalar.curr = FieldClass<float>(N, stride, 1, dSize);
+    scalar.prev = FieldClass<float>(N, stride, 1, dSize);
+    scalar.scratch = FieldClass<float>(N, stride, 1, dSize);
+    scalars.push_back(std::move(scalar));
+    return getScalarCount() - 1;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::addScalarSource(int id, int i, int j, float amount){
+    assert(id >= 0 && id < getScalarCount());
+    if(dObstacles.isSolid(i, j))
+        return;
+    getScalarField(id, true)[S::cell(i, j, stride)] += amount;
+}
+
+template<typename L, typename S>
+float FluidLayoutClass<L, S>::getScalar(int id, int i, int j){
+    assert(id >= 0 && id < getScalarCount());
+    return getScalarField(id, true)[S::cell(i, j, stride)];
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::setBuoyancy(int id, float ambient, float strength){
+    assert(id >= -1 && id < getScalarCount());
+    buoyancyScalar = id;
+    buoyancyAmbient = ambient;
+    buoyancyStrength = strength;
+}
+
+template<typename L, typename S>
+int FluidLayoutClass<L, S>::getScalarCount(void){
+    return 1 + scalars.size();
+}
+
+template<typename L, typename S>
+float FluidLayoutClass<L, S>::getScalarDiffusion(int id){
+    return id == 0 ? dDiff : scalars[id-1].diff;
+}
+
+template<typename L, typename S>
+float *FluidLayoutClass<L, S>::getScalarField(int id, bool latest){
+    if(id == 0)
+        return latest ? dPrev.data() : dCurr.data();
+    return latest ? scalars[id-1].prev.data() : scalars[id-1].curr.data();
+}
+
+template<typename L, typename S>
+float *FluidLayoutClass<L, S>::getScalarScratch(int id){
+    return id == 0 ? dScratch.data() : scalars[id-1].scratch.data();
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::addBuoyancy(void){
+    if(buoyancyScalar < 0 || buoyancyStrength == 0.0)
+        return;
+    stepMaxVelocity = -1;
+    /* T of a velocity cell is the mean over the vFactor x
+     * vFactor density cells it covers, +y (j increasing) is up
+    */
+    const float *T = getScalarField(buoyancyScalar, true);
+    float *vY = getComponent(vCurr, VELOCITY_Y);
+    float scale = dt * buoyancyStrength / (vFactor * vFactor);
+    float offset = vFactor * vFactor * buoyancyAmbient;
+    for(int j = 1; j < vN-1; j++){
+        for(int r = vObstacles.rowBegin(j); r < vObstacles.rowEnd(j); r++){
+            for(int i = vObstacles.getSpanBegin(r); i < vObstacles.getSpanEnd(r); i++){
+                float sum = 0.0;
+                for(int b = 0; b < vFactor; b++){
+                    for(int a = 0; a < vFactor; a++)
+                        sum += T[S::cell((i-1) * vFactor + 1 + a, (j-1) * vFactor + 1 + b, stride)];
+                }
+                vY[L::cell(i, j, vStride)] += scale * (sum - offset);
+            }
+        }
+    }
+}
+
+template<typename L, typename S>
+float FluidLayoutClass<L, S>::maxVelocity(void){
+    /* both components and the padding (always 0) in one
+     * pass, whatever the layout
+    */
+    const float *v = vCurr.data();
+    int total = vCurr.count();
+    int idx = 0;
+    float vMax = 0.0;
+#ifdef __AVX2__
+    /* clear the sign bit for the absolute value
+    */
+    const __m256 vAbs = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 vMaxV = _mm256_setzero_ps();
+    for(; idx + 8 <= total; idx += 8)
+        vMaxV = _mm256_max_ps(vMaxV, _mm256_and_ps(vAbs, _mm256_loadu_ps(v + idx)));
+    float lanes[8];
+    _mm256_storeu_ps(lanes, vMaxV);
+    for(int k = 0; k < 8; k++)
+        vMax = std::max(vMax, lanes[k]);
+#endif
+    for(; idx < total; idx++)
+        vMax = std::max(vMax, fabsf(v[idx]));
+    return vMax;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::frameStep(float frameDt){
+    /* buildPlan takes the max velocity from here
+    */
+    frameSubsteps(frameDt, vN, cflTarget, kMaxSubsteps, [&]{
+        return maxVelocity();
+    }, [&](float step, float vMax){
+        dt = step;
+        stepMaxVelocity = vMax;
+        simulationStep();
+    });
+}
+
+template<typename L, typename S>
+float FluidLayoutClass<L, S>::getDensity(int i, int j){
+    return dPrev[S::cell(i, j, stride)];
+}
+
+template<typename L, typename S>
+size_t FluidLayoutClass<L, S>::getMemoryUsage(void){
+    /* the scalars of addScalar own their storage
+    */
+    size_t bytes = arena.getUsed();
+    for(const scalarField &scalar : scalars)
+        bytes += (scalar.curr.count() + scalar.prev.count() + scalar.scratch.count()) * sizeof(float);
+    return bytes;
+}
+
+template<typename L, typename S>
+size_t FluidLayoutClass<L, S>::getReservedMemory(void){
+    return arena.getCapacity();
+}
+
+template<typename L, typename S>
+float FluidLayoutClass<L, S>::getDiffusionRate(attribute atType, float diff){
+    int n = getGridSize(atType);
+    return dt * diff * (n-2) * (n-2);
+}
+
+template<typename L, typename S>
+diffusionMode FluidLayoutClass<L, S>::getDiffusionMode(float k, bool canSwap){
+    if(k == 0.0)
+        return canSwap ? DIFFUSE_SWAP : DIFFUSE_COPY;
+    /* the line solves have no wrap around term and run
+     * across the whole row, a periodic domain or one with
+     * obstacles stays with Gauss-Seidel
+    */
+    bool lines = !isPeriodic(0) && !isPeriodic(1) && !hasObstacles();
+    /* a diffusion backend was chosen by name
+    */
+    if(forcedDiffusion != -1)
+        return (forcedDiffusion == DIFFUSE_ADI && lines) ? DIFFUSE_ADI : DIFFUSE_IMPLICIT;
+    if(k < kExplicitLimit)
+        return DIFFUSE_EXPLICIT;
+    if(k >= kADILimit && lines)
+        return DIFFUSE_ADI;
+    return DIFFUSE_IMPLICIT;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::diffuse(attribute atType, float *curr, float *prev, float diff){
+    float k = getDiffusionRate(atType, diff);
+    runDiffusion(atType, curr, prev, diff, getDiffusionMode(k, false));
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::runDiffusion(attribute atType, float *curr, float *prev, float diff,
+                                          diffusionMode mode){
+    float k = getDiffusionRate(atType, diff);
+    if(mode == DIFFUSE_SWAP){
+        setBoundaries(atType, prev);
+        return false;
+    }
+    if(mode == DIFFUSE_COPY){
+        if(isVelocity(atType))
+            copyMap<L>(atType, curr, prev);
+        else
+            copyMap<S>(atType, curr, prev);
+    }
+    else if(mode == DIFFUSE_EXPLICIT)
+        explicitDiffuse(atType, curr, prev, k);
+    else if(mode == DIFFUSE_ADI)
+        adiDiffuse(atType, curr, prev, k);
+    else if(diffusionBackend != NULL)
+        diffusionBackend->diffuse(*this, atType, curr, prev, k);
+    else
+        iterSolve(atType, curr, prev, k, kIter);
+    return true;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::diffuseFused(int numFields, attribute *atTypes, float **curr,
+                                          float **prev, float diff){
+    float k = getDiffusionRate(atTypes[0], diff);
+    assert(numFields <= kMaxFusedFields);
+    float diffs[kMaxFusedFields];
+    diffusionMode modes[kMaxFusedFields];
+    for(int f = 0; f < numFields; f++){
+        diffs[f] = diff;
+        modes[f] = getDiffusionMode(k, false);
+    }
+    runDiffusionFused(numFields, atTypes, curr, prev, diffs, modes);
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::runDiffusionFused(int numFields, attribute *atTypes, float **curr,
+                                               float **prev, const float *diff,
+                                               const diffusionMode *modes){
+    assert(numFields <= kMaxFusedFields);
+    bool swapAll = true;
+    for(int f = 0; f < numFields; f++)
+        swapAll = swapAll && modes[f] == DIFFUSE_SWAP;
+    if(swapAll){
+        for(int f = 0; f < numFields; f++)
+            runDiffusion(atTypes[f], curr[f], prev[f], diff[f], DIFFUSE_SWAP);
+        return false;
+    }
+    /* the fused sweep is in place, the Jacobi sweeps of
+     * CHEBYSHEV need a second buffer per field. A diffusion
+     * backend gets the fields one by one
+    */
+    attribute fTypes[kMaxFusedFields];
+    float *fCurr[kMaxFusedFields], *fPrev[kMaxFusedFields];
+    float k[kMaxFusedFields], w[kMaxFusedFields];
+    int numFused = 0;
+    for(int f = 0; f < numFields; f++){
+        if(modes[f] == DIFFUSE_IMPLICIT && relaxations[atTypes[f]] != CHEBYSHEV &&
+           diffusionBackend == NULL){
+            fTypes[numFused] = atTypes[f];
+            fCurr[numFused] = curr[f];
+            fPrev[numFused] = prev[f];
+            k[numFused] = getDiffusionRate(atTypes[f], diff[f]);
+            w[numFused] = getRelaxationFactor(atTypes[f], k[numFused]);
+            numFused++;
+        }
+        /* the other modes are one or two passes per field
+         * anyway. Some field moves, so the ones that would
+         * only swap are copied over
+        */
+        else
+            runDiffusion(atTypes[f], curr[f], prev[f], diff[f],
+                         modes[f] == DIFFUSE_SWAP ? DIFFUSE_COPY : modes[f]);
+    }
+    /* same result, a single field is faster on its own
+    */
+    if(numFused == 1)
+        iterSolve(fTypes[0], fCurr[0], fPrev[0], k[0], kIter);
+    else if(numFused > 0)
+        iterSolveFused(numFused, fTypes, fCurr, fPrev, k, kIter, w);
+    return true;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::explicitDiffuse(attribute atType, float *curr, float *prev, float k){
+    if(isVelocity(atType))
+        explicitDiffuseMap<L>(atType, curr, prev, k);
+    else
+        explicitDiffuseMap<S>(atType, curr, prev, k);
+}
+
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::explicitDiffuseMap(attribute atType, float *curr, float *prev, float k){
+    int n = getGridSize(atType);
+    int row = getStride(atType);
+    const ObstacleClass &solid = getObstacles(atType);
+    for(int j = 1; j < n-1; j++){
+        for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+            for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++){
+                int idx = M::cell(i, j, row);
+                float s = prev[M::prevI(idx, row)] +
+                          prev[M::nextI(idx, row)] +
+                          prev[M::prevJ(idx, row)] +
+                          prev[M::nextJ(idx, row)];
+                curr[idx] = prev[idx] + k * (s - 4 * prev[idx]);
+            }
+        }
+    }
+    setBoundariesMap<M>(atType, curr);
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::adiDiffuse(attribute atType, float *curr, float *prev, float k){
+    if(isVelocity(atType))
+        adiDiffuseMap<L>(atType, curr, prev, k);
+    else
+        adiDiffuseMap<S>(atType, curr, prev, k);
+}
+
+/* Thomas algorithm factors of the m unknowns x(1) ... x(m) of
+ *      (1 + 2k) x(i) - k x(i-1) - k x(i+1) = b(i)
+ * where the ghost cells are x(0) = lo * x(1) + offLo and
+ * x(m+1) = hi * x(m) + offHi (see ghostRule). Eliminating
+ * x(i-1) going forward leaves
+ *      d(i) = (b(i) + k d(i-1)) * inv(i),   d(0) = offLo
+ *      x(i) = d(i) + e(i) x(i+1)
+ * with k offHi inv(m) added to d(m). inv, e only depend on k
+ * and the sides, so they are shared by all the lines of a
+ * pass
+*/
+static void lineFactors(int m, float k, float lo, float hi, float *inv, float *e){
+    float up = 0.0;
+    for(int i = 1; i <= m; i++){
+        float diag = 1 + 2 * k;
+        if(i == 1)
+            diag -= lo * k;
+        if(i == m)
+            diag -= hi * k;
+        inv[i] = 1/(diag - k * up);
+        e[i] = (i < m) ? k * inv[i] : 0;
+        up = e[i];
+    }
+}
+
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::adiDiffuseMap(attribute atType, float *curr, float *prev, float k){
+    int n = getGridSize(atType);
+    int row = getStride(atType);
+    int m = n-2;
+    /* ghost rules of the 4 sides
+    */
+    float scale[4], offset[4];
+    for(int s = 0; s < 4; s++){
+        boundarySide side = (boundarySide)s;
+        bool fixed = ghostRule(getBoundaryPolicy(atType, side), getBoundaryValue(atType, side),
+                               scale[s], offset[s]);
+        assert(fixed);
+        (void)fixed;
+    }
+    std::vector<float> invX(n), eX(n), invY(n), eY(n);
+    lineFactors(m, k, scale[SIDE_LEFT], scale[SIDE_RIGHT], invX.data(), eX.data());
+    lineFactors(m, k, scale[SIDE_BOTTOM], scale[SIDE_TOP], invY.data(), eY.data());
+    float endX = k * offset[SIDE_RIGHT] * invX[m];
+    float endY = k * offset[SIDE_TOP];
+
+    /* x pass, prev into curr, every row is a line
+    */
+    int j = 1;
+#ifdef __AVX2__
+    /* 8 rows at a time, lane r of a register is row j+r. The
+     * forward results d(i) of the 8 rows are kept in line (8
+     * floats per i), and the backward pass writes x(i) to curr
+    */
+    std::vector<float> line(8 * n);
+    const __m256 vK = _mm256_set1_ps(k);
+    for(; j + 8 <= n-1; j += 8){
+        __m256 d = _mm256_set1_ps(offset[SIDE_LEFT]);
+        for(int i = 1; i <= m; i++){
+            __m256 b = loadColumn8<M>(prev, i, j, row);
+            d = _mm256_mul_ps(_mm256_add_ps(b, _mm256_mul_ps(vK, d)), _mm256_set1_ps(invX[i]));
+            _mm256_storeu_ps(&line[8 * i], d);
+        }
+        __m256 x = _mm256_add_ps(d, _mm256_set1_ps(endX));
+        storeColumn8<M>(curr, m, j, row, x);
+        for(int i = m-1; i >= 1; i--){
+            x = _mm256_add_ps(_mm256_loadu_ps(&line[8 * i]), _mm256_mul_ps(_mm256_set1_ps(eX[i]), x));
+            storeColumn8<M>(curr, i, j, row, x);
+        }
+    }
+#endif
+    /* remaining rows (or all of them without AVX2), d(i) is
+     * stored in curr and replaced by x(i) on the way back
+    */
+    for(; j < n-1; j++){
+        float d = offset[SIDE_LEFT];
+        for(int i = 1; i <= m; i++){
+            int idx = M::cell(i, j, row);
+            d = (prev[idx] + k * d) * invX[i];
+            curr[idx] = d;
+        }
+        curr[M::cell(m, j, row)] += endX;
+        for(int i = m-1; i >= 1; i--)
+            curr[M::cell(i, j, row)] += eX[i] * curr[M::cell(i+1, j, row)];
+    }
+
+    /* y pass, in place in curr, every column is a line. The
+     * recurrence goes from row to row, so a row segment of 8
+     * columns is one register
+    */
+    for(int j = 1; j <= m; j++){
+        /* the first and last rows take the constant part of
+         * the ghost rows
+        */
+        float edge = (j == 1) ? k * offset[SIDE_BOTTOM] : 0;
+        if(j == m)
+            edge += endY;
+        int i = 1;
+#ifdef __AVX2__
+        const __m256 vInv = _mm256_set1_ps(invY[j]);
+        const __m256 vEdge = _mm256_set1_ps(edge);
+        for(; i + 8 <= n-1; i += 8){
+            __m256 b = _mm256_add_ps(loadCells8<M>(curr, i, j, row), vEdge);
+            if(j > 1)
+                b = _mm256_add_ps(b, _mm256_mul_ps(vK, loadCells8<M>(curr, i, j-1, row)));
+            storeCells8<M>(curr, i, j, row, _mm256_mul_ps(b, vInv));
+        }
+#endif
+        for(; i < n-1; i++){
+            int idx = M::cell(i, j, row);
+            float b = curr[idx] + edge;
+            if(j > 1)
+                b += k * curr[M::prevJ(idx, row)];
+            curr[idx] = b * invY[j];
+        }
+    }
+    for(int j = m-1; j >= 1; j--){
+        int i = 1;
+#ifdef __AVX2__
+        const __m256 vE = _mm256_set1_ps(eY[j]);
+        for(; i + 8 <= n-1; i += 8){
+            __m256 x = _mm256_add_ps(loadCells8<M>(curr, i, j, row),
+                                     _mm256_mul_ps(vE, loadCells8<M>(curr, i, j+1, row)));
+            storeCells8<M>(curr, i, j, row, x);
+        }
+#endif
+        for(; i < n-1; i++){
+            int idx = M::cell(i, j, row);
+            curr[idx] += eY[j] * curr[M::nextJ(idx, row)];
+        }
+    }
+    setBoundariesMap<M>(atType, curr);
 }
 
-void FluidClass::diffuse(attribute atType, float *curr, float *prev, float diff){
-    float k = dt * diff * (N-2) * (N-2);
-    iterSolve(atType, curr, prev, k, kIter);
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::copyMap(attribute atType, float *curr, float *prev){
+    int n = getGridSize(atType);
+    int row = getStride(atType);
+    if(M::kContiguous)
+        memcpy(curr, prev, n * row * sizeof(float));
+    else{
+        for(int j = 0; j < n; j++){
+            for(int i = 0; i < n; i++)
+                curr[M::cell(i, j, row)] = prev[M::cell(i, j, row)];
+        }
+    }
+    setBoundariesMap<M>(atType, curr);
 }
 
-void FluidClass::advection(attribute atType, float *curr, float *prev, float *vX, float *vY){
-    float dT = dt * (N-2);
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::buildPlan(void){
+    plan.dK = getDiffusionRate(DENSITY, dDiff);
+    plan.vK = getDiffusionRate(VELOCITY_X, vDiff);
+    plan.density = getDiffusionMode(plan.dK, true);
+    plan.velocity = getDiffusionMode(plan.vK, true);
+    /* an inflow side keeps pushing fluid in, even into a
+     * domain at rest
+    */
+    float vMax = (stepMaxVelocity >= 0) ? stepMaxVelocity : maxVelocity();
+    stepMaxVelocity = -1;
+    plan.velocityStill = (vMax == 0.0);
+    for(int s = 0; s < 4; s++)
+        plan.velocityStill = plan.velocityStill && !(sides[s] == DOMAIN_INFLOW && inflowSpeed[s] != 0.0);
+    /* only the modes are compared, k changes with every
+     * adaptive dt
+    */
+    if(!reportStepPlans)
+        return;
+    if(!planReported || plan.density != reportedPlan.density ||
+       plan.velocity != reportedPlan.velocity ||
+       plan.velocityStill != reportedPlan.velocityStill){
+        printPlan();
+        reportedPlan = plan;
+        planReported = true;
+    }
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::printPlan(void){
+    const char *names[] = {"SWAP", "COPY", "EXPLICIT", "IMPLICIT", "ADI"};
+    /* the format of the caller is left as it was
+    */
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::defaultfloat << std::setprecision(4)
+              << "[INFO] step plan: density diffusion " << names[plan.density]
+              << " (k = " << plan.dK << ")"
+              << ", velocity diffusion " << names[plan.velocity]
+              << " (k = " << plan.vK << ")"
+              << ", velocity stages " << (plan.velocityStill ? "SKIPPED" : "ACTIVE")
+              << std::endl;
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::advection(attribute atType, float *curr, float *prev, float *vX, float *vY){
+    advectionFused(1, &atType, &curr, &prev, vX, vY);
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::setAdvectionScheme(attribute atType, advectionScheme scheme){
+    assert(atType != CLEAR_DIVERGENCE);
+    schemes[atType] = scheme;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::setRelaxation(attribute atType, relaxationMethod method){
+    relaxations[atType] = method;
+}
 
-    for(int i = 1; i < N-1; i++){
-        for(int j = 1; j < N-1; j++){
-            /* do back dT to see where the density is coming
-             * from
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::setBackend(backendKind kind, attribute atType, const std::string &name){
+    BackendRegistryClass<FluidLayoutClass> &registry = BackendRegistryClass<FluidLayoutClass>::get();
+    if(kind == BACKEND_POISSON){
+        const backendEntry<PoissonBackendClass<FluidLayoutClass>> *entry = registry.findPoisson(name);
+        if(entry != NULL){
+            poissonBackend = entry->backend.get();
+            if(poissonBackend == NULL)
+                relaxations[CLEAR_DIVERGENCE] = (relaxationMethod)entry->builtin;
+            return true;
+        }
+    }
+    else if(kind == BACKEND_DIFFUSION){
+        const backendEntry<DiffusionBackendClass<FluidLayoutClass>> *entry = registry.findDiffusion(name);
+        if(entry != NULL){
+            /* a backend takes the place of the iterative
+             * solve, so every non zero rate is sent there
             */
-            float fX = i - (dT * vX[getIdx(i, j)]);
-            float fY = j - (dT * vY[getIdx(i, j)]);
-            /* limit boundaries
+            diffusionBackend = entry->backend.get();
+            forcedDiffusion = (diffusionBackend == NULL) ? entry->builtin : DIFFUSE_IMPLICIT;
+            return true;
+        }
+    }
+    else{
+        assert(atType != CLEAR_DIVERGENCE);
+        const backendEntry<AdvectionBackendClass<FluidLayoutClass>> *entry = registry.findAdvection(name);
+        if(entry != NULL){
+            advectionBackends[atType] = entry->backend.get();
+            if(advectionBackends[atType] == NULL)
+                schemes[atType] = (advectionScheme)entry->builtin;
+            return true;
+        }
+    }
+    std::cout << "[ERROR] Unknown backend '" << name << "', the choices are "
+              << registry.getNames(kind) << std::endl;
+    return false;
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::setBackends(const std::string &spec){
+    size_t start = 0;
+    while(start <= spec.size()){
+        size_t end = spec.find(',', start);
+        if(end == std::string::npos)
+            end = spec.size();
+        std::string entry = spec.substr(start, end - start);
+        start = end + 1;
+        size_t eq = entry.find('=');
+        if(eq == std::string::npos){
+            std::cout << "[ERROR] Backend entry '" << entry << "' is not role=name" << std::endl;
+            return false;
+        }
+        std::string role = entry.substr(0, eq), name = entry.substr(eq + 1);
+        role.erase(0, role.find_first_not_of(' '));
+        role.erase(role.find_last_not_of(' ') + 1);
+        name.erase(0, name.find_first_not_of(' '));
+        name.erase(name.find_last_not_of(' ') + 1);
+
+        bool ok;
+        if(role == "poisson")
+            ok = setBackend(BACKEND_POISSON, CLEAR_DIVERGENCE, name);
+        else if(role == "diffusion")
+            ok = setBackend(BACKEND_DIFFUSION, DENSITY, name);
+        else if(role == "advection")
+            ok = setBackend(BACKEND_ADVECTION, DENSITY, name) &&
+                 setBackend(BACKEND_ADVECTION, VELOCITY_X, name) &&
+                 setBackend(BACKEND_ADVECTION, VELOCITY_Y, name);
+        else if(role == "advection-velocity")
+            ok = setBackend(BACKEND_ADVECTION, VELOCITY_X, name) &&
+                 setBackend(BACKEND_ADVECTION, VELOCITY_Y, name);
+        else if(role == "advection-density")
+            ok = setBackend(BACKEND_ADVECTION, DENSITY, name);
+        else{
+            std::cout << "[ERROR] Unknown backend role '" << role << "'" << std::endl;
+            return false;
+        }
+        if(!ok)
+            return false;
+    }
+    return true;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::setBoundary(boundarySide side, domainBoundary type, float speed){
+    /* LEFT/RIGHT and BOTTOM/TOP are next to each other in
+     * boundarySide
+    */
+    int opposite = side ^ 1;
+    if(type == DOMAIN_PERIODIC)
+        sides[opposite] = DOMAIN_PERIODIC;
+    else if(sides[side] == DOMAIN_PERIODIC)
+        sides[opposite] = DOMAIN_WALL;
+    sides[side] = type;
+    inflowSpeed[side] = speed;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::advectionFused(int numFields, attribute *atTypes, float **curr,
+                                            float **prev, float *vX, float *vY){
+    /* vX and vY have to be on the same grid as all the
+     * fields
+    */
+    int n = getGridSize(atTypes[0]);
+    int row = getStride(atTypes[0]);
+    assert(numFields <= kMaxFusedFields);
+    for(int k = 1; k < numFields; k++)
+        assert(getGridSize(atTypes[k]) == n);
+    /* the fields with an advection backend go through it one
+     * by one, the rest stay fused (all the scalars are DENSITY,
+     * so they stay together and in order)
+    */
+    attribute keptTypes[kMaxFusedFields];
+    float *keptCurr[kMaxFusedFields], *keptPrev[kMaxFusedFields];
+    int numKept = 0;
+    for(int k = 0; k < numFields; k++){
+        AdvectionBackendClass<FluidLayoutClass> *backend = advectionBackends[atTypes[k]];
+        if(backend != NULL){
+            backend->advect(*this, atTypes[k], curr[k], prev[k], vX, vY);
+            continue;
+        }
+        keptTypes[numKept] = atTypes[k];
+        keptCurr[numKept] = curr[k];
+        keptPrev[numKept] = prev[k];
+        numKept++;
+    }
+    if(numKept < numFields){
+        if(numKept > 0)
+            advectionFused(numKept, keptTypes, keptCurr, keptPrev, vX, vY);
+        return;
+    }
+    /* velocity components first, the kernels read those
+     * through the layout. The scalar fields follow in their
+     * order, the i-th one is scalar i (see getScalarScratch)
+    */
+    attribute types[kMaxFusedFields];
+    float *fCurr[kMaxFusedFields], *fPrev[kMaxFusedFields];
+    int numVel = 0, f = 0;
+    for(int pass = 0; pass < 2; pass++){
+        for(int k = 0; k < numFields; k++){
+            if(isVelocity(atTypes[k]) != (pass == 0))
+                continue;
+            types[f] = atTypes[k];
+            fCurr[f] = curr[k];
+            fPrev[f] = prev[k];
+            f++;
+        }
+        if(pass == 0)
+            numVel = f;
+    }
+    float dT = dt * (n-2);
+    const ObstacleClass &solid = getObstacles(atTypes[0]);
+    /* first order step for every field, this is the final
+     * result for the SEMI_LAGRANGIAN fields
+    */
+    advectionKernel(solid, n, row, dT, numFields, numVel, fCurr, fPrev, vX, vY);
+    for(int k = 0; k < numFields; k++)
+        setBoundaries(types[k], fCurr[k]);
+    /* the fields that need the error correction, grouped
+     * so that they still share the traces
+    */
+    for(int scheme = MACCORMACK; scheme <= BFECC; scheme++){
+        attribute hTypes[kMaxFusedFields];
+        float *hCurr[kMaxFusedFields], *hPrev[kMaxFusedFields], *back[kMaxFusedFields];
+        int numHigh = 0, hVel = 0;
+        for(int k = 0; k < numFields; k++){
+            if(schemes[types[k]] != scheme)
+                continue;
+            hTypes[numHigh] = types[k];
+            hCurr[numHigh] = fCurr[k];
+            hPrev[numHigh] = fPrev[k];
+            /* q2, the first order result advected backward,
+             * in a scratch field of the same layout
             */
-            fX = (fX < 0.5) ? 0.5 : fX;
-            fY = (fY < 0.5) ? 0.5 : fY;
-            fX = (fX > (N-2) + 0.5) ? (N-2) + 0.5 : fX;
-            fY = (fY > (N-2) + 0.5) ? (N-2) + 0.5 : fY;
-            /* get surrounding cell coordinates
+            if(isVelocity(types[k])){
+                back[numHigh] = getComponent(vScratch, types[k]);
+                hVel++;
+            }
+            else{
+                assert(k - numVel < getScalarCount());
+                back[numHigh] = getScalarScratch(k - numVel);
+            }
+            numHigh++;
+        }
+        if(numHigh == 0)
+            continue;
+        advectionKernel(solid, n, row, -dT, numHigh, hVel, back, hCurr, vX, vY);
+
+        for(int k = 0; k < numHigh; k++){
+            float *q = hPrev[k], *q1 = hCurr[k], *q2 = back[k];
+            bool vel = (k < hVel);
+            for(int j = 1; j < n-1; j++){
+                for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+                    for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++){
+                        int idx = vel ? L::cell(i, j, row) : S::cell(i, j, row);
+                        /* MACCORMACK - correct the result
+                         * BFECC      - correct the input, q2 is reused
+                         *              to store it
+                        */
+                        if(scheme == MACCORMACK)
+                            q1[idx] = q1[idx] + 0.5 * (q[idx] - q2[idx]);
+                        else
+                            q2[idx] = q[idx] + 0.5 * (q[idx] - q2[idx]);
+                    }
+                }
+            }
+            /* the corrected input is traced into, like the
+             * velocity in runStages
             */
-            int i0 = (int)fX;
-            int i1 = i0 + 1;
-            int j0 = (int)fY;
-            int j1 = j0 + 1;
-            /* get distance to cell centers
+            if(scheme == BFECC)
+                resetObstacles(hTypes[k], q2);
+        }
+        if(scheme == BFECC)
+            advectionKernel(solid, n, row, dT, numHigh, hVel, hCurr, back, vX, vY);
+
+        advectionLimiter(solid, n, row, dT, numHigh, hVel, hCurr, hPrev, vX, vY);
+        for(int k = 0; k < numHigh; k++)
+            setBoundaries(hTypes[k], hCurr[k]);
+    }
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::advectionKernel(const ObstacleClass &solid, int n, int row, float dT,
+                                             int numFields, int numVel, float **curr, float **prev,
+                                             float *vX, float *vY){
+    /* The border cells of every field act as a ghost layer,
+     * clamping the back traced position to [0.5, (n-2) + 0.5]
+     * keeps all 4 surrounding cells inside the array. So the
+     * clamp is just a min/max, with no branches. Along a
+     * periodic axis the position is first wrapped around into
+     * the interior (see getTraceRange)
+    */
+    float loX, hiX, periodX, loY, hiY, periodY;
+    getTraceRange(n, 0, loX, hiX, periodX);
+    getTraceRange(n, 1, loY, hiY, periodY);
+#ifdef __AVX2__
+    const __m256 vdT = _mm256_set1_ps(dT);
+    const __m256 vLoX = _mm256_set1_ps(loX);
+    const __m256 vHiX = _mm256_set1_ps(hiX);
+    const __m256 vLoY = _mm256_set1_ps(loY);
+    const __m256 vHiY = _mm256_set1_ps(hiY);
+    const __m256 vPeriodX = _mm256_set1_ps(periodX);
+    const __m256 vPeriodY = _mm256_set1_ps(periodY);
+    const __m256 vInvX = _mm256_set1_ps(periodX > 0 ? 1/periodX : 0);
+    const __m256 vInvY = _mm256_set1_ps(periodY > 0 ? 1/periodY : 0);
+    const __m256 vOne = _mm256_set1_ps(1.0);
+    const __m256 vLane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i vRow = _mm256_set1_epi32(row);
+#endif
+    /* rows on the outside, so that cells next to each other
+     * in memory are processed one after the other
+    */
+    for(int j = 1; j < n-1; j++){
+#ifdef __AVX2__
+        const __m256 vJ = _mm256_set1_ps(j);
+#endif
+        /* the fluid spans of the row, see ObstacleClass
+        */
+        for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+            int i = solid.getSpanBegin(r);
+            int end = solid.getSpanEnd(r);
+#ifdef __AVX2__
+            /* 8 cells of the row at a time, the 4 surrounding cells
+             * of each back traced position are fetched with gathers
             */
-            float s1 = fX - i0;
-            float s0 = 1.0 - s1;
-            float t1 = fY - j0;
-            float t0 = 1.0 - t1;
-            /* interpolate
+            for(; i + 8 <= end; i += 8){
+                __m256 fX = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps(i), vLane),
+                                          _mm256_mul_ps(vdT, loadCells8<L>(vX, i, j, row)));
+                __m256 fY = _mm256_sub_ps(vJ, _mm256_mul_ps(vdT, loadCells8<L>(vY, i, j, row)));
+                /* fX - period * floor((fX - 1)/period), a no-op for
+                 * a period of 0
+                */
+                fX = _mm256_sub_ps(fX, _mm256_mul_ps(vPeriodX, _mm256_floor_ps(
+                         _mm256_mul_ps(_mm256_sub_ps(fX, vOne), vInvX))));
+                fY = _mm256_sub_ps(fY, _mm256_mul_ps(vPeriodY, _mm256_floor_ps(
+                         _mm256_mul_ps(_mm256_sub_ps(fY, vOne), vInvY))));
+                fX = _mm256_min_ps(_mm256_max_ps(fX, vLoX), vHiX);
+                fY = _mm256_min_ps(_mm256_max_ps(fY, vLoY), vHiY);
+
+                __m256i i0 = _mm256_cvttps_epi32(fX);
+                __m256i j0 = _mm256_cvttps_epi32(fY);
+                __m256 s1 = _mm256_sub_ps(fX, _mm256_cvtepi32_ps(i0));
+                __m256 s0 = _mm256_sub_ps(vOne, s1);
+                __m256 t1 = _mm256_sub_ps(fY, _mm256_cvtepi32_ps(j0));
+                __m256 t0 = _mm256_sub_ps(vOne, t1);
+
+                /* positions of the 4 surrounding cells in the layout
+                 * of the velocity (l) and of the scalar fields (s)
+                */
+                __m256i l00 = L::cell8(i0, j0, vRow);
+                __m256i l01 = L::nextJ8(l00, vRow);
+                __m256i l10 = L::nextI8(l00, vRow);
+                __m256i l11 = L::nextI8(l01, vRow);
+                __m256i s00 = S::cell8(i0, j0, vRow);
+                __m256i s01 = S::nextJ8(s00, vRow);
+                __m256i s10 = S::nextI8(s00, vRow);
+                __m256i s11 = S::nextI8(s01, vRow);
+                for(int k = 0; k < numFields; k++){
+                    float *p = prev[k];
+                    bool vel = (k < numVel);
+                    __m256i g00 = vel ? l00 : s00;
+                    __m256i g01 = vel ? l01 : s01;
+                    __m256i g10 = vel ? l10 : s10;
+                    __m256i g11 = vel ? l11 : s11;
+                    __m256 z0 = _mm256_add_ps(_mm256_mul_ps(t0, _mm256_i32gather_ps(p, g00, 4)),
+                                              _mm256_mul_ps(t1, _mm256_i32gather_ps(p, g01, 4)));
+                    __m256 z1 = _mm256_add_ps(_mm256_mul_ps(t0, _mm256_i32gather_ps(p, g10, 4)),
+                                              _mm256_mul_ps(t1, _mm256_i32gather_ps(p, g11, 4)));
+                    __m256 result = _mm256_add_ps(_mm256_mul_ps(s0, z0), _mm256_mul_ps(s1, z1));
+                    if(vel)
+                        storeCells8<L>(curr[k], i, j, row, result);
+                    else
+                        storeCells8<S>(curr[k], i, j, row, result);
+                }
+            }
+#endif
+            /* rest of the span (or the whole span without AVX2)
             */
-            float z0 = t0 * (prev[getIdx(i0, j0)]) + t1 * (prev[getIdx(i0, j1)]);
-            float z1 = t0 * (prev[getIdx(i1, j0)]) + t1 * (prev[getIdx(i1, j1)]);
-            curr[getIdx(i,j)] = (s0 * z0) + (s1 * z1);
+            for(; i < end; i++){
+                int lIdx = L::cell(i, j, row);
+                int sIdx = S::cell(i, j, row);
+                /* do back dT to see where the density is coming
+                 * from
+                */
+                float fX = i - (dT * vX[lIdx]);
+                float fY = j - (dT * vY[lIdx]);
+                /* limit boundaries
+                */
+                if(periodX > 0)
+                    fX -= periodX * floor((fX - 1)/periodX);
+                if(periodY > 0)
+                    fY -= periodY * floor((fY - 1)/periodY);
+                fX = std::min(std::max(fX, loX), hiX);
+                fY = std::min(std::max(fY, loY), hiY);
+                /* get surrounding cell coordinates
+                */
+                int i0 = (int)fX;
+                int i1 = i0 + 1;
+                int j0 = (int)fY;
+                int j1 = j0 + 1;
+                /* get distance to cell centers
+                */
+                float s1 = fX - i0;
+                float s0 = 1.0 - s1;
+                float t1 = fY - j0;
+                float t0 = 1.0 - t1;
+                /* the trace and the weights are shared, only the
+                 * interpolation is done per field
+                */
+                int l00 = L::cell(i0, j0, row), s00 = S::cell(i0, j0, row);
+                int l01 = L::cell(i0, j1, row), s01 = S::cell(i0, j1, row);
+                int l10 = L::cell(i1, j0, row), s10 = S::cell(i1, j0, row);
+                int l11 = L::cell(i1, j1, row), s11 = S::cell(i1, j1, row);
+                for(int k = 0; k < numFields; k++){
+                    float *p = prev[k];
+                    bool vel = (k < numVel);
+                    float z0 = t0 * (p[vel ? l00 : s00]) + t1 * (p[vel ? l01 : s01]);
+                    float z1 = t0 * (p[vel ? l10 : s10]) + t1 * (p[vel ? l11 : s11]);
+                    curr[k][vel ? lIdx : sIdx] = (s0 * z0) + (s1 * z1);
+                }
+            }
         }
     }
-    setBoundaries(atType, curr);
 }
 
-void FluidClass::clearDivergence(float *vX, float *vY, float *div, float *p){
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::advectionLimiter(const ObstacleClass &solid, int n, int row, float dT,
+                                              int numFields, int numVel, float **curr, float **prev,
+                                              float *vX, float *vY){
+    float loX, hiX, periodX, loY, hiY, periodY;
+    getTraceRange(n, 0, loX, hiX, periodX);
+    getTraceRange(n, 1, loY, hiY, periodY);
+    for(int j = 1; j < n-1; j++){
+        for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+            for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++){
+                int lIdx = L::cell(i, j, row);
+                int sIdx = S::cell(i, j, row);
+                /* same trace as the first order step
+                */
+                float fX = i - (dT * vX[lIdx]);
+                float fY = j - (dT * vY[lIdx]);
+                if(periodX > 0)
+                    fX -= periodX * floor((fX - 1)/periodX);
+                if(periodY > 0)
+                    fY -= periodY * floor((fY - 1)/periodY);
+                fX = std::min(std::max(fX, loX), hiX);
+                fY = std::min(std::max(fY, loY), hiY);
+                int i0 = (int)fX;
+                int j0 = (int)fY;
+
+                int l00 = L::cell(i0, j0, row), s00 = S::cell(i0, j0, row);
+                int l01 = L::cell(i0, j0 + 1, row), s01 = S::cell(i0, j0 + 1, row);
+                int l10 = L::cell(i0 + 1, j0, row), s10 = S::cell(i0 + 1, j0, row);
+                int l11 = L::cell(i0 + 1, j0 + 1, row), s11 = S::cell(i0 + 1, j0 + 1, row);
+                for(int k = 0; k < numFields; k++){
+                    float *p = prev[k];
+                    bool vel = (k < numVel);
+                    float p00 = p[vel ? l00 : s00];
+                    float p01 = p[vel ? l01 : s01];
+                    float p10 = p[vel ? l10 : s10];
+                    float p11 = p[vel ? l11 : s11];
+                    float minVal = std::min(std::min(p00, p01), std::min(p10, p11));
+                    float maxVal = std::max(std::max(p00, p01), std::max(p10, p11));
+                    float &c = curr[k][vel ? lIdx : sIdx];
+                    c = std::min(std::max(c, minVal), maxVal);
+                }
+            }
+        }
+    }
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::clearDivergence(float *vX, float *vY, float *div, float *p){
     /* we reuse the already allocated memory to store
-     * div and p values
+     * div and p values, all of them are on the velocity
+     * grid
     */
-    for(int i = 1; i < N-1; i++){
-        for(int j = 1; j < N-1; j++){
-            /* divergence
-            */
-            div[getIdx(i, j)] = -0.5 * 
-                                (vX[getIdx(i+1, j)] - vX[getIdx(i-1, j)] + 
-                                 vY[getIdx(i, j+1)] - vY[getIdx(i, j-1)])/N;
-            p[getIdx(i,j)] = 0;
+    int n = vN;
+    int row = vStride;
+    const ObstacleClass &solid = getObstacles(CLEAR_DIVERGENCE);
+    for(int j = 1; j < n-1; j++){
+        for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+            for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++){
+                /* divergence
+                */
+                int c = L::cell(i, j, row);
+                int idx = S::cell(i, j, row);
+                div[idx] = -0.5 * 
+                           (vX[L::nextI(c, row)] - vX[L::prevI(c, row)] + 
+                            vY[L::nextJ(c, row)] - vY[L::prevJ(c, row)])/n;
+                p[idx] = 0;
+            }
+        }
+    }
+    /* with no outflow side the pressure is only known up to
+     * a constant and the equation has a solution only if the
+     * divergence adds up to 0 (whatever comes in through an
+     * inflow has to leave). Remove its mean so that a solution
+     * exists, for a closed box this is only rounding
+    */
+    bool open = false;
+    for(int s = 0; s < 4; s++)
+        open = open || sides[s] == DOMAIN_OUTFLOW;
+    if(!open){
+        double sum = 0.0;
+        for(int j = 1; j < n-1; j++){
+            for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+                for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++)
+                    sum += div[S::cell(i, j, row)];
+            }
+        }
+        float mean = sum/solid.getFluidCount();
+        for(int j = 1; j < n-1; j++){
+            for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+                for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++)
+                    div[S::cell(i, j, row)] -= mean;
+            }
         }
     }
     setBoundaries(CLEAR_DIVERGENCE, div);
-    setBoundaries(CLEAR_DIVERGENCE, p);
-
-    iterSolve(CLEAR_DIVERGENCE, p, div, 1, kIter);
+    solvePoisson(p, div, false);
 
-    for(int i = 1; i < N-1; i++){
-        for(int j = 1; j < N-1; j++){
-            vX[getIdx(i, j)] -= 0.5 * N * (p[getIdx(i+1, j)] - p[getIdx(i-1, j)]);
-            vY[getIdx(i, j)] -= 0.5 * N * (p[getIdx(i, j+1)] - p[getIdx(i, j-1)]); 
+    for(int j = 1; j < n-1; j++){
+        for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+            for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++){
+                int idx = L::cell(i, j, row);
+                int c = S::cell(i, j, row);
+                vX[idx] -= 0.5 * n * (p[S::nextI(c, row)] - p[S::prevI(c, row)]);
+                vY[idx] -= 0.5 * n * (p[S::nextJ(c, row)] - p[S::prevJ(c, row)]);
+            }
         }
     }
     setBoundaries(VELOCITY_X, vX);
     setBoundaries(VELOCITY_Y, vY);
 }
 
-void FluidClass::densityStep(void){
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::solvePoisson(float *p, float *rhs, bool zeroSides){
+    zeroPoissonSides = zeroSides;
+    setBoundaries(CLEAR_DIVERGENCE, p);
+    if(poissonBackend != NULL)
+        poissonBackend->solve(*this, p, rhs);
+    else
+        iterSolve(CLEAR_DIVERGENCE, p, rhs, 1, kIter);
+    zeroPoissonSides = false;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::densityStep(void){
     /* adding source will be done as an input, so 
      * it is not included in this routine
     */
-    
-    /* We reach here after adding source, meaning
-     * we have our starting values stored in dPrev
+    static const std::vector<stepStage> stages = {
+        STAGE_DIFFUSE_DENSITY,
+        STAGE_ADVECT_DENSITY
+    };
+    runStages(stages);
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::velocityStep(void){
+    /* adding source will be done as an input, so it 
+     * is not included in this routine
     */
-    diffuse(DENSITY, dCurr, dPrev, dDiff);
-    /* After diffusion, we have the results store in
-     * dCurr
+    addBuoyancy();
+    static const std::vector<stepStage> stages = {
+        STAGE_DIFFUSE_VELOCITY,
+        STAGE_PROJECT,
+        STAGE_ADVECT_VELOCITY,
+        STAGE_PROJECT
+    };
+    runStages(stages);
+    advanceParticles();
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::upsampleVelocity(float *vX, float *vY){
+    float *upX = getComponent(vUp, VELOCITY_X);
+    float *upY = getComponent(vUp, VELOCITY_Y);
+    /* row by row like every other kernel, the stores and the
+     * two velocity rows that are read walk through memory in
+     * order
     */
-    advection(DENSITY, dPrev, dCurr, vXCurr, vYCurr);
-    /* After advection, the new values will be written to
-     * dPrev using the diffusion result that was stored in 
-     * dCurr.
+    for(int j = 1; j < N-1; j++){
+        /* position of the density cell center in velocity
+         * grid coordinates, this never leaves the interior
+         * plus border cells of the velocity grid
+        */
+        float fY = (j - 0.5)/vFactor + 0.5;
+        int j0 = (int)fY;
+        int j1 = j0 + 1;
+        float t1 = fY - j0;
+        float t0 = 1.0 - t1;
+        for(int i = 1; i < N-1; i++){
+            float fX = (i - 0.5)/vFactor + 0.5;
+            int i0 = (int)fX;
+            int i1 = i0 + 1;
+            float s1 = fX - i0;
+            float s0 = 1.0 - s1;
+
+            int idx00 = L::cell(i0, j0, vStride);
+            int idx01 = L::cell(i0, j1, vStride);
+            int idx10 = L::cell(i1, j0, vStride);
+            int idx11 = L::cell(i1, j1, vStride);
+            int idx = L::cell(i, j, stride);
+            upX[idx] = s0 * (t0 * vX[idx00] + t1 * vX[idx01]) + s1 * (t0 * vX[idx10] + t1 * vX[idx11]);
+            upY[idx] = s0 * (t0 * vY[idx00] + t1 * vY[idx01]) + s1 * (t0 * vY[idx10] + t1 * vY[idx11]);
+        }
+    }
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::simulationStep(void){
+    addBuoyancy();
+    runStages(pipeline);
+    advanceParticles();
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::runStages(const std::vector<stepStage> &stages){
+    buildPlan();
+    /* We reach here after adding source, meaning we have
+     * our starting values stored in vCurr and dPrev.
+     *
+     * vel and scal[] point to the arrays that hold the latest
+     * values, otherV and otherS[] to the ones the next stage
+     * writes its result to. After every stage that has a
+     * result they trade places. scal[0] is the density, the
+     * scalars always move together
     */
-    
-    /* In the render loop, we can render out dPrev which
-     * has the advection result. In the next time step,
-     * we operate on the dPrev thus forming a cycle
+    float *vel = vCurr.data(), *otherV = vPrev.data();
+    int numScalars = getScalarCount();
+    float *scal[kMaxScalars], *otherS[kMaxScalars];
+    attribute scalarTypes[kMaxScalars];
+    float scalarDiffs[kMaxScalars];
+    diffusionMode scalarModes[kMaxScalars];
+    for(int id = 0; id < numScalars; id++){
+        scal[id] = getScalarField(id, true);
+        otherS[id] = getScalarField(id, false);
+        scalarTypes[id] = DENSITY;
+        scalarDiffs[id] = getScalarDiffusion(id);
+        scalarModes[id] = (id == 0) ? plan.density :
+                          getDiffusionMode(getDiffusionRate(DENSITY, scalarDiffs[id]), true);
+    }
+    /* offset of the y component in a velocity field
     */
-}
+    int cY = L::component(1, vN, vStride);
 
-void FluidClass::velocityStep(void){
-    /* adding source will be done as an input, so it 
-     * is not included in this routine
+    for(size_t s = 0; s < stages.size(); s++){
+        stepStage stage = stages[s];
+        /* nothing moves, the velocity stages and advection
+         * would give back their input
+        */
+        if(plan.velocityStill && stage != STAGE_DIFFUSE_DENSITY)
+            continue;
+        /* the velocity is about to be interpolated anywhere,
+         * see resetObstacles
+        */
+        if(stage == STAGE_ADVECT_VELOCITY || stage == STAGE_ADVECT_DENSITY ||
+           stage == STAGE_ADVECT_ALL){
+            resetObstacles(VELOCITY_X, vel);
+            resetObstacles(VELOCITY_Y, vel + cY);
+        }
+
+        if(stage == STAGE_DIFFUSE_VELOCITY){
+            /* both components in one solve
+            */
+            attribute atTypes[2] = {VELOCITY_X, VELOCITY_Y};
+            float *curr[2] = {otherV, otherV + cY};
+            float *prev[2] = {vel, vel + cY};
+            float diffs[2] = {vDiff, vDiff};
+            diffusionMode modes[2] = {plan.velocity, plan.velocity};
+            if(runDiffusionFused(2, atTypes, curr, prev, diffs, modes))
+                std::swap(vel, otherV);
+        }
+        else if(stage == STAGE_PROJECT){
+            /* the other field is free, so it stores div and p
+             * (as scalar fields)
+            */
+            clearDivergence(vel, vel + cY, otherV, otherV + S::size(vN, vStride));
+        }
+        else if(stage == STAGE_ADVECT_VELOCITY){
+            attribute atTypes[2] = {VELOCITY_X, VELOCITY_Y};
+            float *curr[2] = {otherV, otherV + cY};
+            float *prev[2] = {vel, vel + cY};
+            advectionFused(2, atTypes, curr, prev, vel, vel + cY);
+            std::swap(vel, otherV);
+        }
+        else if(stage == STAGE_DIFFUSE_DENSITY){
+            /* all the scalars in one solve
+            */
+            if(runDiffusionFused(numScalars, scalarTypes, otherS, scal, scalarDiffs, scalarModes)){
+                for(int id = 0; id < numScalars; id++)
+                    std::swap(scal[id], otherS[id]);
+            }
+        }
+        else if(stage == STAGE_ADVECT_DENSITY){
+            if(vFactor > 1){
+                /* the velocity grid is coarser, advect using the
+                 * velocity interpolated to the density grid
+                */
+                upsampleVelocity(vel, vel + cY);
+                advectionFused(numScalars, scalarTypes, otherS, scal,
+                               getComponent(vUp, VELOCITY_X), getComponent(vUp, VELOCITY_Y));
+            }
+            else
+                advectionFused(numScalars, scalarTypes, otherS, scal, vel, vel + cY);
+            for(int id = 0; id < numScalars; id++)
+                std::swap(scal[id], otherS[id]);
+        }
+        else if(stage == STAGE_ADVECT_ALL){
+            attribute atTypes[kMaxFusedFields] = {VELOCITY_X, VELOCITY_Y};
+            float *curr[kMaxFusedFields] = {otherV, otherV + cY};
+            float *prev[kMaxFusedFields] = {vel, vel + cY};
+            for(int id = 0; id < numScalars; id++){
+                atTypes[2 + id] = DENSITY;
+                curr[2 + id] = otherS[id];
+                prev[2 + id] = scal[id];
+            }
+            advectionFused(2 + numScalars, atTypes, curr, prev, vel, vel + cY);
+            std::swap(vel, otherV);
+            for(int id = 0; id < numScalars; id++)
+                std::swap(scal[id], otherS[id]);
+        }
+    }
+    /* In the render loop, we render out dPrev, and the next
+     * step adds its sources to vCurr and dPrev, so the
+     * results have to end up there. Swapping two fields
+     * only swaps their storage
     */
+    if(vel != vCurr.data())
+        vCurr.swap(vPrev);
+    if(scal[0] != dPrev.data()){
+        dCurr.swap(dPrev);
+        for(size_t id = 0; id < scalars.size(); id++)
+            scalars[id].curr.swap(scalars[id].prev);
+    }
+}
+
+/* names used by setPipeline, in the order of stepStage
+*/
+static const char *stageNames[] = {
+    "diffuse-velocity",
+    "project",
+    "advect-velocity",
+    "diffuse-density",
+    "advect-density",
+    "advect-all"
+};
 
-    /* We reach here after adding source, meaning
-     * we have our starting values stored in vXCurr
-     * and vYCurr
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::parsePipeline(const std::string &spec, std::vector<stepStage> &stages){
+    stages.clear();
+    /* presets, the fused advection needs both fields on the
+     * same grid
     */
-    diffuse(VELOCITY_X, vXPrev, vXCurr, vDiff);
-    diffuse(VELOCITY_Y, vYPrev, vYCurr, vDiff);
-    /* after diffusion, vXPrev and vYPrev will have the
-     * result
+    bool fused = (vFactor == 1);
+    if(spec == "stam"){
+        stages = {STAGE_DIFFUSE_VELOCITY, STAGE_PROJECT, STAGE_ADVECT_VELOCITY, STAGE_PROJECT,
+                  STAGE_DIFFUSE_DENSITY, STAGE_ADVECT_DENSITY};
+        return true;
+    }
+    if(spec == "fused"){
+        if(!fused)
+            return parsePipeline("stam", stages);
+        stages = {STAGE_DIFFUSE_VELOCITY, STAGE_PROJECT, STAGE_DIFFUSE_DENSITY,
+                  STAGE_ADVECT_ALL, STAGE_PROJECT};
+        return true;
+    }
+    if(spec == "single-projection"){
+        if(fused)
+            stages = {STAGE_DIFFUSE_VELOCITY, STAGE_DIFFUSE_DENSITY, STAGE_ADVECT_ALL,
+                      STAGE_PROJECT};
+        else
+            stages = {STAGE_DIFFUSE_VELOCITY, STAGE_ADVECT_VELOCITY, STAGE_PROJECT,
+                      STAGE_DIFFUSE_DENSITY, STAGE_ADVECT_DENSITY};
+        return true;
+    }
+    if(spec == "density-only"){
+        stages = {STAGE_DIFFUSE_DENSITY, STAGE_ADVECT_DENSITY};
+        return true;
+    }
+    /* comma separated stage names
     */
-    clearDivergence(vXPrev, vYPrev, vXCurr, vYCurr);
-    /* After clearDivergence(), we have our results in vXPrev
-     * and vYPrev
+    size_t start = 0;
+    while(start <= spec.size()){
+        size_t end = spec.find(',', start);
+        if(end == std::string::npos)
+            end = spec.size();
+        std::string name = spec.substr(start, end - start);
+        name.erase(0, name.find_first_not_of(' '));
+        name.erase(name.find_last_not_of(' ') + 1);
+
+        int found = -1;
+        for(int k = 0; k <= STAGE_ADVECT_ALL; k++){
+            if(name == stageNames[k])
+                found = k;
+        }
+        if(found == -1){
+            std::cout << "[ERROR] Unknown pipeline stage '" << name << "'" << std::endl;
+            return false;
+        }
+        stages.push_back((stepStage)found);
+        start = end + 1;
+    }
+    return true;
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::validatePipeline(const std::vector<stepStage> &stages){
+    if(stages.empty()){
+        std::cout << "[ERROR] Pipeline has no stages" << std::endl;
+        return false;
+    }
+    int count[STAGE_ADVECT_ALL + 1] = {0};
+    int lastChange = -1, lastProject = -1;
+    for(size_t s = 0; s < stages.size(); s++){
+        count[stages[s]]++;
+        if(stages[s] == STAGE_PROJECT)
+            lastProject = s;
+        else if(stages[s] == STAGE_DIFFUSE_VELOCITY || stages[s] == STAGE_ADVECT_VELOCITY ||
+                stages[s] == STAGE_ADVECT_ALL)
+            lastChange = s;
+    }
+    bool valid = true;
+    for(int k = 0; k <= STAGE_ADVECT_ALL; k++){
+        if(k != STAGE_PROJECT && count[k] > 1){
+            std::cout << "[ERROR] Pipeline stage '" << stageNames[k]
+                      << "' can only run once per step" << std::endl;
+            valid = false;
+        }
+    }
+    if(count[STAGE_ADVECT_ALL] > 0 &&
+       (count[STAGE_ADVECT_VELOCITY] > 0 || count[STAGE_ADVECT_DENSITY] > 0)){
+        std::cout << "[ERROR] 'advect-all' already advects the velocity and the density"
+                  << std::endl;
+        valid = false;
+    }
+    if(count[STAGE_ADVECT_ALL] > 0 && vFactor > 1){
+        std::cout << "[ERROR] 'advect-all' needs the velocity and density on the same grid"
+                  << std::endl;
+        valid = false;
+    }
+    /* a velocity field that is not divergence free would
+     * be carried over to the next step
     */
-    advection(VELOCITY_X, vXCurr, vXPrev, vXPrev, vYPrev);
-    advection(VELOCITY_Y, vYCurr, vYPrev, vXPrev, vYPrev);
-    /* After advection, the results will be in vXCurr and
-     * vYCurr
+    if(lastChange > lastProject){
+        std::cout << "[ERROR] Pipeline has to 'project' after '"
+                  << stageNames[stages[lastChange]] << "'" << std::endl;
+        valid = false;
+    }
+    return valid;
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::setPipeline(const std::string &spec){
+    std::vector<stepStage> stages;
+    if(!parsePipeline(spec, stages) || !validatePipeline(stages)){
+        std::cout << "[ERROR] Invalid pipeline \"" << spec << "\"" << std::endl;
+        return false;
+    }
+    pipeline = stages;
+    return true;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::iterSolve(attribute atType, float *curr, float *prev, float k, int numIter){
+    if(relaxations[atType] == CHEBYSHEV){
+        if(isVelocity(atType))
+            chebyshevSolveMap<L>(atType, curr, prev, k, numIter);
+        else
+            chebyshevSolveMap<S>(atType, curr, prev, k, numIter);
+        return;
+    }
+    float w = getRelaxationFactor(atType, k);
+    if(isVelocity(atType))
+        iterSolveMap<L>(atType, curr, prev, k, numIter, w);
+    else
+        iterSolveMap<S>(atType, curr, prev, k, numIter, w);
+}
+
+template<typename L, typename S>
+float FluidLayoutClass<L, S>::getJacobiRadius(attribute atType, float k){
+    int m = getGridSize(atType) - 2;
+    float denom = (atType == CLEAR_DIVERGENCE) ? 4 : (1 + 4 * k);
+    return 4 * k/denom * 0.5 * (1 + cos(M_PI/m));
+}
+
+template<typename L, typename S>
+float FluidLayoutClass<L, S>::getRelaxationFactor(attribute atType, float k){
+    if(relaxations[atType] != SOR)
+        return 1;
+    float rho = getJacobiRadius(atType, k);
+    return 2/(1 + sqrt(1 - rho * rho));
+}
+
+template<typename L, typename S>
+float *FluidLayoutClass<L, S>::getSolveScratch(attribute atType){
+    /* the scratch fields are only used inside advection,
+     * the pressure (a scalar field on the velocity grid) fits
+     * in the velocity scratch field
     */
-    clearDivergence(vXCurr, vYCurr, vXPrev, vYPrev);
+    if(atType == DENSITY)
+        return dScratch.data();
+    if(atType == CLEAR_DIVERGENCE)
+        return vScratch.data();
+    return getComponent(vScratch, atType);
 }
 
-void FluidClass::simulationStep(void){
-    velocityStep();
-    densityStep();
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::getSideFold(attribute atType, float k, sideFold &fold){
+    for(int s = 0; s < 4; s++){
+        boundarySide side = (boundarySide)s;
+        foldSide(fold, side, getBoundaryPolicy(atType, side), getBoundaryValue(atType, side), k);
+    }
 }
 
-void FluidClass::iterSolve(attribute atType, float *curr, float *prev, float k, int numIter){
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::iterSolveMap(attribute atType, float *curr, float *prev, float k,
+                                          int numIter, float w){
     if(curr == NULL || prev == NULL)
         assert(false);
     
     /* 1 is passed in when iterSolve is called
      * to solve p vector field
     */
+    int n = getGridSize(atType);
+    int row = getStride(atType);
     float denom = (atType == CLEAR_DIVERGENCE) ? 4 : (1 + 4 * k);
+    /* with w = 1 this is exactly the Gauss-Seidel value
+    */
+    float keep = 1 - w;
+    const ObstacleClass &solid = getObstacles(atType);
+    boundaryPolicy left = getBoundaryPolicy(atType, SIDE_LEFT);
+    boundaryPolicy right = getBoundaryPolicy(atType, SIDE_RIGHT);
+    float leftValue = getBoundaryValue(atType, SIDE_LEFT);
+    float rightValue = getBoundaryValue(atType, SIDE_RIGHT);
+    /* the sides with ghost = -inside (p = 0 where the fluid
+     * leaves, the walls of a streamfunction, the velocity into
+     * a wall) are part of the equation of the cells next to
+     * them, see sideFold
+    */
+    sideFold fold;
+    getSideFold(atType, k, fold);
+    bool anyFolded = false;
+    for(int s = 0; s < 4; s++){
+        if(fold.folded[s])
+            clearSide<M>(curr, n, row, (boundarySide)s);
+        anyFolded = anyFolded || fold.folded[s];
+    }
+    auto relax = [&](int i, int j, float d, float rhs){
+        int idx = M::cell(i, j, row);
+        float s = curr[M::prevI(idx, row)] + 
+                  curr[M::nextI(idx, row)] +
+                  curr[M::prevJ(idx, row)] +
+                  curr[M::nextJ(idx, row)];
+
+        curr[idx] = w * ((prev[idx] + (k * s) + rhs)/d) + keep * curr[idx];
+    };
     while(numIter != 0){
         /* process all grid cells except the
-         * border walls
+         * border walls, row by row so that the sweep walks
+         * through memory in order
         */
-        for(int i = 1; i < N-1; i++){
-            for(int j = 1; j < N-1; j++){
-                float s = curr[getIdx(i-1, j)] + 
-                          curr[getIdx(i+1, j)] +
-                          curr[getIdx(i, j-1)] +
-                          curr[getIdx(i, j+1)];
+        for(int j = 1; j < n-1; j++){
+            float rowDiag = denom + (j == 1 ? fold.diag[SIDE_BOTTOM] : 0) +
+                            (j == n-2 ? fold.diag[SIDE_TOP] : 0);
+            float rowRhs = (j == 1 ? fold.rhs[SIDE_BOTTOM] : 0) +
+                           (j == n-2 ? fold.rhs[SIDE_TOP] : 0);
+            for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+                int begin = solid.getSpanBegin(r);
+                int end = solid.getSpanEnd(r);
+                /* the cells next to a folded left or right side
+                 * are taken out of the loop
+                */
+                if(begin == 1 && fold.folded[SIDE_LEFT]){
+                    relax(1, j, rowDiag + fold.diag[SIDE_LEFT], rowRhs + fold.rhs[SIDE_LEFT]);
+                    begin++;
+                }
+                bool lastFolded = (end == n-1 && fold.folded[SIDE_RIGHT] && begin < end);
+                if(lastFolded)
+                    end--;
+                for(int i = begin; i < end; i++)
+                    relax(i, j, rowDiag, rowRhs);
+                if(lastFolded)
+                    relax(n-2, j, rowDiag + fold.diag[SIDE_RIGHT], rowRhs + fold.rhs[SIDE_RIGHT]);
+            }
+            /* border cells at both ends of the row, they only
+             * depend on this row (which no later row changes)
+            */
+            if(!fold.folded[SIDE_LEFT])
+                fillSide<M>(curr, n, row, SIDE_LEFT, left, leftValue, j, j+1);
+            if(!fold.folded[SIDE_RIGHT])
+                fillSide<M>(curr, n, row, SIDE_RIGHT, right, rightValue, j, j+1);
+        }
+        /* process the remaining border grid cells
+        */
+        fillObstaclesMap<M>(atType, curr);
+        if(!anyFolded)
+            setRowBoundariesMap<M>(atType, curr);
+        else{
+            for(int s = SIDE_BOTTOM; s <= SIDE_TOP; s++){
+                boundarySide side = (boundarySide)s;
+                if(!fold.folded[side])
+                    fillSide<M>(curr, n, row, side, getBoundaryPolicy(atType, side),
+                                getBoundaryValue(atType, side), 1, n-1);
+            }
+        }
+        numIter--;
+    }
+    /* the folded ghost cells (and the corners) from the
+     * result
+    */
+    if(anyFolded)
+        setBoundariesMap<M>(atType, curr);
+}
 
-                curr[getIdx(i, j)] = (prev[getIdx(i, j)] + (k * s))/denom;    
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::chebyshevSolveMap(attribute atType, float *curr, float *prev,
+                                               float k, int numIter){
+    if(curr == NULL || prev == NULL)
+        assert(false);
+
+    int n = getGridSize(atType);
+    int row = getStride(atType);
+    float denom = (atType == CLEAR_DIVERGENCE) ? 4 : (1 + 4 * k);
+    float rho = getJacobiRadius(atType, k);
+    /* x(m-1) and x(m), the new iterate only reads x(m-1) at
+     * its own cell, so it overwrites x(m-1) and the two
+     * buffers take turns
+    */
+    float *older = getSolveScratch(atType);
+    float *newer = curr;
+    float w = 1;
+    const ObstacleClass &solid = getObstacles(atType);
+    boundaryPolicy left = getBoundaryPolicy(atType, SIDE_LEFT);
+    boundaryPolicy right = getBoundaryPolicy(atType, SIDE_RIGHT);
+    float leftValue = getBoundaryValue(atType, SIDE_LEFT);
+    float rightValue = getBoundaryValue(atType, SIDE_RIGHT);
+    for(int m = 0; m < numIter; m++){
+        /* the first sweep is plain Jacobi (nothing to combine
+         * with), then
+         *      w(2) = 1/(1 - rho^2/2)
+         *      w(m+1) = 1/(1 - rho^2 * w(m)/4)
+        */
+        if(m == 1)
+            w = 1/(1 - 0.5 * rho * rho);
+        else if(m > 1)
+            w = 1/(1 - 0.25 * rho * rho * w);
+        float keep = 1 - w;
+        for(int j = 1; j < n-1; j++){
+            for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+                for(int i = solid.getSpanBegin(r); i < solid.getSpanEnd(r); i++){
+                    int idx = M::cell(i, j, row);
+                    float s = newer[M::prevI(idx, row)] +
+                              newer[M::nextI(idx, row)] +
+                              newer[M::prevJ(idx, row)] +
+                              newer[M::nextJ(idx, row)];
+                    float jacobi = (prev[idx] + (k * s))/denom;
+                    older[idx] = (m == 0) ? jacobi : w * jacobi + keep * older[idx];
+                }
             }
+            fillSide<M>(older, n, row, SIDE_LEFT, left, leftValue, j, j+1);
+            fillSide<M>(older, n, row, SIDE_RIGHT, right, rightValue, j, j+1);
         }
-        /* process border grid cells
+        fillObstaclesMap<M>(atType, older);
+        setRowBoundariesMap<M>(atType, older);
+        std::swap(older, newer);
+    }
+    /* odd number of sweeps, the result is in the scratch
+     * field
+    */
+    if(newer != curr)
+        copyMap<M>(atType, curr, newer);
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::iterSolveFused(int numFields, attribute *atTypes, float **curr,
+                                            float **prev, const float *k, int numIter,
+                                            const float *w){
+    int n = getGridSize(atTypes[0]);
+    int row = getStride(atTypes[0]);
+    assert(numFields <= kMaxFusedFields);
+    bool vel[kMaxFusedFields];
+    boundaryPolicy left[kMaxFusedFields], right[kMaxFusedFields];
+    float leftValue[kMaxFusedFields], rightValue[kMaxFusedFields];
+    for(int f = 0; f < numFields; f++){
+        assert(atTypes[f] != CLEAR_DIVERGENCE && getGridSize(atTypes[f]) == n);
+        vel[f] = isVelocity(atTypes[f]);
+        left[f] = getBoundaryPolicy(atTypes[f], SIDE_LEFT);
+        right[f] = getBoundaryPolicy(atTypes[f], SIDE_RIGHT);
+        leftValue[f] = getBoundaryValue(atTypes[f], SIDE_LEFT);
+        rightValue[f] = getBoundaryValue(atTypes[f], SIDE_RIGHT);
+    }
+    float denom[kMaxFusedFields], keep[kMaxFusedFields];
+    for(int f = 0; f < numFields; f++){
+        denom[f] = 1 + 4 * k[f];
+        keep[f] = 1 - w[f];
+    }
+    /* the sides with ghost = -inside are folded into the cells
+     * next to them, as in iterSolveMap
+    */
+    sideFold fold[kMaxFusedFields];
+    bool anyFolded[kMaxFusedFields];
+    for(int f = 0; f < numFields; f++){
+        getSideFold(atTypes[f], k[f], fold[f]);
+        anyFolded[f] = false;
+        for(int s = 0; s < 4; s++){
+            if(!fold[f].folded[s])
+                continue;
+            anyFolded[f] = true;
+            if(vel[f])
+                clearSide<L>(curr[f], n, row, (boundarySide)s);
+            else
+                clearSide<S>(curr[f], n, row, (boundarySide)s);
+        }
+    }
+    float rowDiag[kMaxFusedFields], rowRhs[kMaxFusedFields];
+    /* edge is SIDE_LEFT or SIDE_RIGHT for the cells next to
+     * those sides, -1 for the rest
+    */
+    auto relax = [&](int i, int j, int edge){
+        /* the cell and its neighbours in both layouts, for
+         * the row-major layouts these are the same
         */
-        setBoundaries(atType, curr);
+        int lIdx = L::cell(i, j, row);
+        int l0 = L::prevI(lIdx, row), l1 = L::nextI(lIdx, row);
+        int l2 = L::prevJ(lIdx, row), l3 = L::nextJ(lIdx, row);
+        int sIdx = S::cell(i, j, row);
+        int s0 = S::prevI(sIdx, row), s1 = S::nextI(sIdx, row);
+        int s2 = S::prevJ(sIdx, row), s3 = S::nextJ(sIdx, row);
+        for(int f = 0; f < numFields; f++){
+            float *c = curr[f];
+            float d = rowDiag[f] + (edge >= 0 ? fold[f].diag[edge] : 0);
+            float rhs = rowRhs[f] + (edge >= 0 ? fold[f].rhs[edge] : 0);
+            if(vel[f]){
+                float s = c[l0] + c[l1] + c[l2] + c[l3];
+                c[lIdx] = w[f] * ((prev[f][lIdx] + (k[f] * s) + rhs)/d) +
+                          keep[f] * c[lIdx];
+            }
+            else{
+                float s = c[s0] + c[s1] + c[s2] + c[s3];
+                c[sIdx] = w[f] * ((prev[f][sIdx] + (k[f] * s) + rhs)/d) +
+                          keep[f] * c[sIdx];
+            }
+        }
+    };
+    /* a folded side is taken out of the loop if one of the
+     * fields folds it, the others get 0 from it
+    */
+    bool foldLeft = false, foldRight = false;
+    for(int f = 0; f < numFields; f++){
+        foldLeft = foldLeft || fold[f].folded[SIDE_LEFT];
+        foldRight = foldRight || fold[f].folded[SIDE_RIGHT];
+    }
+    const ObstacleClass &solid = getObstacles(atTypes[0]);
+    while(numIter != 0){
+        for(int j = 1; j < n-1; j++){
+            for(int f = 0; f < numFields; f++){
+                rowDiag[f] = denom[f] + (j == 1 ? fold[f].diag[SIDE_BOTTOM] : 0) +
+                             (j == n-2 ? fold[f].diag[SIDE_TOP] : 0);
+                rowRhs[f] = (j == 1 ? fold[f].rhs[SIDE_BOTTOM] : 0) +
+                            (j == n-2 ? fold[f].rhs[SIDE_TOP] : 0);
+            }
+            for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+                int begin = solid.getSpanBegin(r);
+                int end = solid.getSpanEnd(r);
+                if(begin == 1 && foldLeft){
+                    relax(1, j, SIDE_LEFT);
+                    begin++;
+                }
+                bool lastFolded = (end == n-1 && foldRight && begin < end);
+                if(lastFolded)
+                    end--;
+                for(int i = begin; i < end; i++)
+                    relax(i, j, -1);
+                if(lastFolded)
+                    relax(n-2, j, SIDE_RIGHT);
+            }
+            /* border cells at both ends of the row
+            */
+            for(int f = 0; f < numFields; f++){
+                if(vel[f]){
+                    if(!fold[f].folded[SIDE_LEFT])
+                        fillSide<L>(curr[f], n, row, SIDE_LEFT, left[f], leftValue[f], j, j+1);
+                    if(!fold[f].folded[SIDE_RIGHT])
+                        fillSide<L>(curr[f], n, row, SIDE_RIGHT, right[f], rightValue[f], j, j+1);
+                }
+                else{
+                    if(!fold[f].folded[SIDE_LEFT])
+                        fillSide<S>(curr[f], n, row, SIDE_LEFT, left[f], leftValue[f], j, j+1);
+                    if(!fold[f].folded[SIDE_RIGHT])
+                        fillSide<S>(curr[f], n, row, SIDE_RIGHT, right[f], rightValue[f], j, j+1);
+                }
+            }
+        }
+        for(int f = 0; f < numFields; f++){
+            if(vel[f])
+                fillObstaclesMap<L>(atTypes[f], curr[f]);
+            else
+                fillObstaclesMap<S>(atTypes[f], curr[f]);
+            if(!anyFolded[f]){
+                if(vel[f])
+                    setRowBoundariesMap<L>(atTypes[f], curr[f]);
+                else
+                    setRowBoundariesMap<S>(atTypes[f], curr[f]);
+                continue;
+            }
+            for(int s = SIDE_BOTTOM; s <= SIDE_TOP; s++){
+                boundarySide side = (boundarySide)s;
+                if(fold[f].folded[side])
+                    continue;
+                if(vel[f])
+                    fillSide<L>(curr[f], n, row, side, getBoundaryPolicy(atTypes[f], side),
+                                getBoundaryValue(atTypes[f], side), 1, n-1);
+                else
+                    fillSide<S>(curr[f], n, row, side, getBoundaryPolicy(atTypes[f], side),
+                                getBoundaryValue(atTypes[f], side), 1, n-1);
+            }
+        }
         numIter--;
     }
+    for(int f = 0; f < numFields; f++){
+        if(anyFolded[f])
+            setBoundaries(atTypes[f], curr[f]);
+    }
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::setBoundaries(attribute atType, float *arr){
+    if(isVelocity(atType))
+        setBoundariesMap<L>(atType, arr);
+    else
+        setBoundariesMap<S>(atType, arr);
+}
+
+template<typename L, typename S>
+boundaryPolicy FluidLayoutClass<L, S>::getBoundaryPolicy(attribute atType, boundarySide side){
+    domainBoundary type = sides[side];
+    if(atType == CLEAR_DIVERGENCE && zeroPoissonSides)
+        return BOUNDARY_REFLECT;
+    if(type == DOMAIN_PERIODIC)
+        return BOUNDARY_PERIODIC;
+    /* the pressure is 0 where the fluid leaves, and has no
+     * change across every other side
+    */
+    if(atType == CLEAR_DIVERGENCE)
+        return (type == DOMAIN_OUTFLOW) ? BOUNDARY_REFLECT : BOUNDARY_CONTINUITY;
+    if(type == DOMAIN_OUTFLOW)
+        return BOUNDARY_OUTFLOW;
+    if(type == DOMAIN_INFLOW && isVelocity(atType))
+        return BOUNDARY_INFLOW;
+    /* the vertical (Y) componenet of velocity should be
+     * negated at the top and bottom border cells, and the
+     * horizontal component (X) at the left and right border
+     * cells. The other component and the density will be the
+     * same as the previous cell
+    */
+    bool vertical = (side == SIDE_LEFT || side == SIDE_RIGHT);
+    if((atType == VELOCITY_X && vertical) || (atType == VELOCITY_Y && !vertical))
+        return BOUNDARY_REFLECT;
+    return BOUNDARY_CONTINUITY;
+}
+
+template<typename L, typename S>
+float FluidLayoutClass<L, S>::getBoundaryValue(attribute atType, boundarySide side){
+    if(sides[side] != DOMAIN_INFLOW)
+        return 0.0;
+    /* only the component normal to the side is given, it
+     * points into the domain
+    */
+    bool vertical = (side == SIDE_LEFT || side == SIDE_RIGHT);
+    if((atType == VELOCITY_X && vertical) || (atType == VELOCITY_Y && !vertical))
+        return (side == SIDE_LEFT || side == SIDE_BOTTOM) ? inflowSpeed[side] : -inflowSpeed[side];
+    return 0.0;
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::isPeriodic(int axis){
+    return sides[2 * axis] == DOMAIN_PERIODIC;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::getTraceRange(int n, int axis, float &lo, float &hi, float &period){
+    if(isPeriodic(axis)){
+        /* cells 1 ... n-2 repeat, and a position in the last
+         * one reads the ghost cell n-1 (a copy of cell 1).
+         * Keep it strictly below n-1 so that rounding in the
+         * wrap can not take it past the ghost cell
+        */
+        period = n-2;
+        lo = 1.0;
+        hi = nextafterf(n-1, 0);
+    }
+    else{
+        period = 0.0;
+        lo = 0.5;
+        hi = (n-2) + 0.5;
+    }
 }
 
-void FluidClass::setBoundaries(attribute atType, float *arr){
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::setBoundariesMap(attribute atType, float *arr){
     if(arr == NULL)
         assert(false);
         
-    /* the vertical (Y) componenet of velocity should be
-     * negated at the top and bottom border cells except
-     * the corner cells. The x component and the density
-     * will be the same as the previous cell
+    int n = getGridSize(atType);
+    int row = getStride(atType);
+    /* obstacles first, the border cells next to them read
+     * their interface cells
     */
-    for(int i = 1; i < N-1; i++){
-        arr[getIdx(i, 0)] = 
-            atType == VELOCITY_Y ? -arr[getIdx(i, 1)] : arr[getIdx(i, 1)];
-        arr[getIdx(i, N-1)] = 
-            atType == VELOCITY_Y ? -arr[getIdx(i, N-2)] : arr[getIdx(i, N-2)];
-    }
-    /* the horizontal component (X) of velocity should be
-     * negated at the left and right border cells except the
-     * corner cells
+    fillObstaclesMap<M>(atType, arr);
+    /* border cells except the corner cells, the left and
+     * right columns here and the rows in setRowBoundariesMap
     */
-    for(int j = 1; j < N-1; j++){
-        arr[getIdx(0, j)] = 
-            atType == VELOCITY_X ? -arr[getIdx(1, j)] : arr[getIdx(1, j)];
-        arr[getIdx(N-1, j)] = 
-            atType == VELOCITY_X ? -arr[getIdx(N-2, j)] : arr[getIdx(N-2, j)];
+    fillSide<M>(arr, n, row, SIDE_LEFT, getBoundaryPolicy(atType, SIDE_LEFT),
+                getBoundaryValue(atType, SIDE_LEFT), 1, n-1);
+    fillSide<M>(arr, n, row, SIDE_RIGHT, getBoundaryPolicy(atType, SIDE_RIGHT),
+                getBoundaryValue(atType, SIDE_RIGHT), 1, n-1);
+    setRowBoundariesMap<M>(atType, arr);
+}
+
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::setRowBoundariesMap(attribute atType, float *arr){
+    int n = getGridSize(atType);
+    int row = getStride(atType);
+    fillSide<M>(arr, n, row, SIDE_BOTTOM, getBoundaryPolicy(atType, SIDE_BOTTOM),
+                getBoundaryValue(atType, SIDE_BOTTOM), 1, n-1);
+    fillSide<M>(arr, n, row, SIDE_TOP, getBoundaryPolicy(atType, SIDE_TOP),
+                getBoundaryValue(atType, SIDE_TOP), 1, n-1);
+
+    /* corner cells, a periodic axis wraps them around like the
+     * rest of its ghost cells (the ghost rows and columns they
+     * copy are filled by now)
+    */
+    if(isPeriodic(0)){
+        arr[M::cell(0, 0, row)] = arr[M::cell(n-2, 0, row)];
+        arr[M::cell(n-1, 0, row)] = arr[M::cell(1, 0, row)];
+        arr[M::cell(0, n-1, row)] = arr[M::cell(n-2, n-1, row)];
+        arr[M::cell(n-1, n-1, row)] = arr[M::cell(1, n-1, row)];
+        return;
+    }
+    if(isPeriodic(1)){
+        arr[M::cell(0, 0, row)] = arr[M::cell(0, n-2, row)];
+        arr[M::cell(n-1, 0, row)] = arr[M::cell(n-1, n-2, row)];
+        arr[M::cell(0, n-1, row)] = arr[M::cell(0, 1, row)];
+        arr[M::cell(n-1, n-1, row)] = arr[M::cell(n-1, 1, row)];
+        return;
+    }
+    arr[M::cell(0, 0, row)] = 
+        0.5 * (arr[M::cell(1, 0, row)] + arr[M::cell(0, 1, row)]);
+    arr[M::cell(n-1, 0, row)] = 
+        0.5 * (arr[M::cell(n-2, 0, row)] + arr[M::cell(n-1, 1, row)]);
+    arr[M::cell(0, n-1, row)] = 
+        0.5 * (arr[M::cell(1, n-1, row)] + arr[M::cell(0, n-2, row)]);
+    arr[M::cell(n-1, n-1, row)] = 
+        0.5 * (arr[M::cell(n-2, n-1, row)] + arr[M::cell(n-1, n-2, row)]);
+}
+
+template<typename L, typename S>
+const ObstacleClass &FluidLayoutClass<L, S>::getObstacles(attribute atType){
+    return atType == DENSITY ? dObstacles : vObstacles;
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::hasObstacles(void){
+    return !dObstacles.isEmpty() || !vObstacles.isEmpty();
+}
+
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::fillObstaclesMap(attribute atType, float *arr){
+    const std::vector<interfaceCell> &cells = getObstacles(atType).getInterface();
+    int row = getStride(atType);
+    float sign = isVelocity(atType) ? -1 : 1;
+    for(size_t c = 0; c < cells.size(); c++){
+        int idx = M::cell(cells[c].i, cells[c].j, row);
+        int fluid = cells[c].fluid;
+        float sum = 0.0;
+        int count = 0;
+        if(fluid & 1){
+            sum += arr[M::prevI(idx, row)];
+            count++;
+        }
+        if(fluid & 2){
+            sum += arr[M::nextI(idx, row)];
+            count++;
+        }
+        if(fluid & 4){
+            sum += arr[M::prevJ(idx, row)];
+            count++;
+        }
+        if(fluid & 8){
+            sum += arr[M::nextJ(idx, row)];
+            count++;
+        }
+        arr[idx] = sign * sum/count;
+    }
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::resetObstacles(attribute atType, float *arr){
+    if(isVelocity(atType))
+        resetObstaclesMap<L>(atType, arr);
+    else
+        resetObstaclesMap<S>(atType, arr);
+}
+
+template<typename L, typename S>
+template<typename M>
+void FluidLayoutClass<L, S>::resetObstaclesMap(attribute atType, float *arr){
+    const ObstacleClass &solid = getObstacles(atType);
+    if(!solid.isEmpty()){
+        int n = getGridSize(atType);
+        int row = getStride(atType);
+        /* the solid cells are the gaps between the fluid
+         * spans
+        */
+        for(int j = 1; j < n-1; j++){
+            int i = 1;
+            for(int r = solid.rowBegin(j); r < solid.rowEnd(j); r++){
+                for(; i < solid.getSpanBegin(r); i++)
+                    arr[M::cell(i, j, row)] = 0.0;
+                i = solid.getSpanEnd(r);
+            }
+            for(; i < n-1; i++)
+                arr[M::cell(i, j, row)] = 0.0;
+        }
     }
+    setBoundariesMap<M>(atType, arr);
+}
 
-    /* corner cells
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::addObstacle(const obstacleShape &shape){
+    dObstacles.rasterize(shape);
+    dObstacles.build();
+    vObstacles.rasterize(shape);
+    vObstacles.build();
+    /* the fluid that was in the new solid cells is gone, the
+     * scratch fields are cleared too (only their fluid cells
+     * are written from here on)
     */
-    arr[getIdx(0, 0)] = 0.5 * (arr[getIdx(1, 0)] + arr[getIdx(0, 1)]);
-    arr[getIdx(N-1, 0)] = 0.5 * (arr[getIdx(N-2, 0)] + arr[getIdx(N-1, 1)]);
-    arr[getIdx(0, N-1)] = 0.5 * (arr[getIdx(1, N-1)] + arr[getIdx(0, N-2)]);
-    arr[getIdx(N-1, N-1)] = 0.5 * (arr[getIdx(N-2, N-1)] + arr[getIdx(N-1, N-2)]);
-}
\ No newline at end of file
+    float *density[3] = {dCurr.data(), dPrev.data(), dScratch.data()};
+    for(int f = 0; f < 3; f++)
+        resetObstacles(DENSITY, density[f]);
+    for(size_t s = 0; s < scalars.size(); s++){
+        resetObstacles(DENSITY, scalars[s].curr.data());
+        resetObstacles(DENSITY, scalars[s].prev.data());
+        resetObstacles(DENSITY, scalars[s].scratch.data());
+    }
+    FieldClass<float> *velocity[3] = {&vCurr, &vPrev, &vScratch};
+    for(int f = 0; f < 3; f++){
+        resetObstacles(VELOCITY_X, getComponent(*velocity[f], VELOCITY_X));
+        resetObstacles(VELOCITY_Y, getComponent(*velocity[f], VELOCITY_Y));
+    }
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::clearObstacles(void){
+    dObstacles.clear();
+    vObstacles.clear();
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::setParticles(ParticleClass *particles){
+    tracers = particles;
+}
+
+template<typename L, typename S>
+void FluidLayoutClass<L, S>::advanceParticles(void){
+    if(tracers == NULL)
+        return;
+    particleDomain domain;
+    for(int s = 0; s < 4; s++){
+        domain.periodic[s] = (sides[s] == DOMAIN_PERIODIC);
+        domain.open[s] = (sides[s] == DOMAIN_OUTFLOW);
+    }
+    tracers->advance<L>(vObstacles, vN, vStride, getComponent(vCurr, VELOCITY_X),
+                        getComponent(vCurr, VELOCITY_Y), dt, domain);
+}
+
+template<typename L, typename S>
+bool FluidLayoutClass<L, S>::isSolid(int i, int j){
+    return dObstacles.isSolid(i, j);
+}
+
+/* the layouts (velocity, scalar fields) that a simulation can
+ * be built with, see Layout.h
+*/
+template class FluidLayoutClass<velocitySplit, scalarLayout>;
+template class FluidLayoutClass<velocityInterleaved, scalarLayout>;
+template class FluidLayoutClass<velocityTiled, scalarLayout>;
+template class FluidLayoutClass<velocityZOrder, scalarZOrder>;
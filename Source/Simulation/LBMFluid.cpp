@@ -0,0 +1,489 @@
+#include "../../Include/Simulation/LBMFluid.h"
+#include "../../Include/Simulation/Parallel.h"
+#include "../../Include/Control/Constants.h"
+#include <math.h>
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* the D2Q9 lattice, the velocity c(q) of every population, its
+ * weight in the equilibrium and the population moving the
+ * other way
+*/
+static const int cX[9] = {0, 1, 0, -1, 0, 1, -1, -1, 1};
+static const int cY[9] = {0, 0, 1, 0, -1, 1, 1, -1, -1};
+static const float wQ[9] = {4.0/9, 1.0/9, 1.0/9, 1.0/9, 1.0/9,
+                            1.0/36, 1.0/36, 1.0/36, 1.0/36};
+static const int opp[9] = {0, 3, 4, 1, 2, 7, 8, 5, 6};
+
+#ifdef __AVX2__
+/* 8 cells of a row, so that the collision below is written
+ * once for a single cell (float) and for 8 of them
+*/
+struct lane8{
+    __m256 v;
+    lane8(void){}
+    lane8(__m256 _v) : v(_v){}
+    lane8(float x) : v(_mm256_set1_ps(x)){}
+};
+static inline lane8 operator+(lane8 a, lane8 b){
+    return _mm256_add_ps(a.v, b.v);
+}
+static inline lane8 operator-(lane8 a, lane8 b){
+    return _mm256_sub_ps(a.v, b.v);
+}
+static inline lane8 operator*(lane8 a, lane8 b){
+    return _mm256_mul_ps(a.v, b.v);
+}
+static inline lane8 operator/(lane8 a, lane8 b){
+    return _mm256_div_ps(a.v, b.v);
+}
+static inline void loadLane(const float *p, lane8 &x){
+    x = _mm256_loadu_ps(p);
+}
+static inline void storeLane(float *p, lane8 x){
+    _mm256_storeu_ps(p, x.v);
+}
+#endif
+static inline void loadLane(const float *p, float &x){
+    x = *p;
+}
+static inline void storeLane(float *p, float x){
+    *p = x;
+}
+
+/* equilibrium of density rho and velocity (ux,uy)
+ *      feq(q) = w(q) rho (1 + 3 cu + 4.5 cu^2 - 1.5 u^2)
+ * with cu = c(q).u
+*/
+template<typename T>
+static inline void equilibrium(T rho, T ux, T uy, T *feq){
+    T usq = T(1.5f) * (ux * ux + uy * uy);
+    T r9 = rho * T(1.0f/9), r36 = rho * T(1.0f/36);
+    T s = ux + uy, d = ux - uy;
+    T a = T(1.0f) + T(4.5f) * ux * ux - usq;
+    T b = T(1.0f) + T(4.5f) * uy * uy - usq;
+    T e = T(1.0f) + T(4.5f) * s * s - usq;
+    T h = T(1.0f) + T(4.5f) * d * d - usq;
+    feq[0] = rho * T(4.0f/9) * (T(1.0f) - usq);
+    feq[1] = r9 * (a + T(3.0f) * ux);
+    feq[3] = r9 * (a - T(3.0f) * ux);
+    feq[2] = r9 * (b + T(3.0f) * uy);
+    feq[4] = r9 * (b - T(3.0f) * uy);
+    feq[5] = r36 * (e + T(3.0f) * s);
+    feq[7] = r36 * (e - T(3.0f) * s);
+    feq[8] = r36 * (h + T(3.0f) * d);
+    feq[6] = r36 * (h - T(3.0f) * d);
+}
+
+template<typename T>
+static inline void moments(const T *g, T &rho, T &ux, T &uy){
+    rho = g[0] + g[1] + g[2] + g[3] + g[4] + g[5] + g[6] + g[7] + g[8];
+    T invRho = T(1.0f) / rho;
+    ux = (g[1] - g[3] + g[5] - g[6] - g[7] + g[8]) * invRho;
+    uy = (g[2] - g[4] + g[5] + g[6] - g[7] - g[8]) * invRho;
+}
+
+/* regularized BGK collision of the populations g, returns the
+ * velocity (before the collision, which keeps it). Of f - feq
+ * only the stress part is kept, rebuilt from the 3 moments
+ *      P = sum c c (f - feq)
+ *      fneq(q) = 4.5 w(q) ((cx^2 - 1/3) Pxx + (cy^2 - 1/3) Pyy
+ *                          + 2 cx cy Pxy)
+ * and relaxed by (1 - omega)
+*/
+template<typename T>
+static inline void collide(T *g, T omega, T &ux, T &uy){
+    T rho;
+    moments(g, rho, ux, uy);
+    T third = T(1.0f/3);
+    T pXX = g[1] + g[3] + g[5] + g[6] + g[7] + g[8] - rho * (third + ux * ux);
+    T pYY = g[2] + g[4] + g[5] + g[6] + g[7] + g[8] - rho * (third + uy * uy);
+    T pXY = g[5] - g[6] + g[7] - g[8] - rho * ux * uy;
+    T keep = T(1.0f) - omega;
+    T trace = keep * (pXX + pYY);
+    T axisX = keep * (pXX * third - pYY * T(1.0f/6));
+    T axisY = keep * (pYY * third - pXX * T(1.0f/6));
+    T diag = trace * T(1.0f/12), shear = keep * pXY * T(0.25f);
+    T feq[9];
+    equilibrium(rho, ux, uy, feq);
+    g[0] = feq[0] - trace * T(2.0f/3);
+    g[1] = feq[1] + axisX;
+    g[3] = feq[3] + axisX;
+    g[2] = feq[2] + axisY;
+    g[4] = feq[4] + axisY;
+    g[5] = feq[5] + diag + shear;
+    g[7] = feq[7] + diag + shear;
+    g[6] = feq[6] + diag - shear;
+    g[8] = feq[8] + diag - shear;
+}
+
+/* even step of the cells idx ... (1 or 8 of them), collide in
+ * place and write f(q) to slot opp(q)
+*/
+template<typename T>
+static inline void evenCells(float *a, int size, int idx, float omega, float inv, float *vX, float *vY){
+    T g[9], ux, uy;
+    for(int q = 0; q < 9; q++)
+        loadLane(a + q * size + idx, g[q]);
+    collide(g, T(omega), ux, uy);
+    for(int q = 0; q < 9; q++)
+        storeLane(a + opp[q] * size + idx, g[q]);
+    storeLane(vX + idx, ux * T(inv));
+    storeLane(vY + idx, uy * T(inv));
+}
+
+/* odd step of cells away from the walls, f(q) comes from slot
+ * opp(q) of the cell behind it (off(q) = c(q) in cells) and
+ * goes to slot q of the cell ahead
+*/
+template<typename T>
+static inline void oddCells(float *a, int size, int idx, const int *off, float omega, float inv,
+                            float *vX, float *vY){
+    T g[9], ux, uy;
+    for(int q = 0; q < 9; q++)
+        loadLane(a + opp[q] * size + idx - off[q], g[q]);
+    collide(g, T(omega), ux, uy);
+    for(int q = 0; q < 9; q++)
+        storeLane(a + q * size + idx + off[q], g[q]);
+    storeLane(vX + idx, ux * T(inv));
+    storeLane(vY + idx, uy * T(inv));
+}
+
+LBMFluidClass::LBMFluidClass(int _N, float _dDiff, float _vDiff, float _dt) :
+    grid(_N, _dDiff, _vDiff, _dt, 1){
+    N = _N;
+    dDiff = _dDiff;
+    vDiff = _vDiff;
+    dt = _dt;
+    stride = grid.stride;
+    size = N * stride;
+    f = FieldClass<float>(N, stride, 1, 9 * size);
+    force = FieldClass<float>(N, stride, 1, grid.vCurr.count());
+    flux = FieldClass<float>(N, stride, 1);
+    /* fluid at rest with density 1
+    */
+    for(int q = 0; q < 9; q++){
+        for(int idx = 0; idx < size; idx++)
+            f[q * size + idx] = wQ[q];
+    }
+    odd = false;
+    substeps = 1;
+    latticeScale = dt * (N-2);
+    updateTau();
+}
+
+LBMFluidClass::~LBMFluidClass(void){
+}
+
+int LBMFluidClass::slot(int q){
+    /* after an even step the collided f(q) has not streamed
+     * yet, it waits in slot opp(q) of its own cell
+    */
+    return odd ? opp[q] : q;
+}
+
+void LBMFluidClass::updateTau(void){
+    /* FluidClass diffuses by k = dt * vDiff * (N-2)^2 per step,
+     * so per lattice step of dt/substeps
+     *      nu = vDiff * (N-2) * latticeScale
+     * and nu = (tau - 0.5)/3 in lattice units
+    */
+    float nu = vDiff * (N-2) * latticeScale;
+    tau = std::max(3.0f * nu + 0.5f, kLbmMinTau);
+}
+
+void LBMFluidClass::rescale(float vMax){
+    int needed = (int)ceilf(vMax * dt * (N-2) / kLbmMaxSpeed);
+    needed = std::min(std::max(needed, 1), kLbmMaxSubsteps);
+    /* only split finer when the flow gets faster and merge
+     * when it is less than half as fast, so a flow near the
+     * limit does not rescale every step
+    */
+    int steps = substeps;
+    if(needed > steps || 2 * needed < steps)
+        steps = needed;
+    float scale = dt * (N-2) / steps;
+    if(scale == latticeScale)
+        return;
+    /* the velocity scales with the lattice step, and the
+     * non equilibrium part with the velocity gradient and tau
+    */
+    float s = scale / latticeScale;
+    float oldTau = tau;
+    substeps = steps;
+    latticeScale = scale;
+    updateTau();
+    float sNeq = s * tau / oldTau;
+    int at[9];
+    for(int q = 0; q < 9; q++)
+        at[q] = slot(q) * size;
+    for(int j = 1; j < N-1; j++){
+        for(int i = 1; i < N-1; i++){
+            int idx = i + j * stride;
+            float g[9], feq[9], feqNew[9], rho, ux, uy;
+            for(int q = 0; q < 9; q++)
+                g[q] = f[at[q] + idx];
+            moments(g, rho, ux, uy);
+            equilibrium(rho, ux, uy, feq);
+            equilibrium(rho, s * ux, s * uy, feqNew);
+            for(int q = 0; q < 9; q++)
+                f[at[q] + idx] = feqNew[q] + sNeq * (g[q] - feq[q]);
+        }
+    }
+}
+
+void LBMFluidClass::applyForces(void){
+    float *fX = grid.getComponent(force, VELOCITY_X);
+    float *fY = grid.getComponent(force, VELOCITY_Y);
+    int at[9];
+    for(int q = 0; q < 9; q++)
+        at[q] = slot(q) * size;
+    for(int j = 1; j < N-1; j++){
+        for(int i = 1; i < N-1; i++){
+            int idx = i + j * stride;
+            if(fX[idx] == 0.0 && fY[idx] == 0.0)
+                continue;
+            /* shift the equilibrium part by the new velocity,
+             * which adds rho * du to the momentum and nothing
+             * to the density
+            */
+            float g[9], feq[9], feqNew[9], rho, ux, uy;
+            for(int q = 0; q < 9; q++)
+                g[q] = f[at[q] + idx];
+            moments(g, rho, ux, uy);
+            equilibrium(rho, ux, uy, feq);
+            /* no faster than kLbmMaxSpeed, a source that asks for
+             * more than kLbmMaxSubsteps lattice steps can carry
+             * would make the lattice blow up
+            */
+            float newX = ux + fX[idx] * latticeScale;
+            float newY = uy + fY[idx] * latticeScale;
+            float fastest = std::max(fabsf(newX), fabsf(newY));
+            if(fastest > kLbmMaxSpeed){
+                newX *= kLbmMaxSpeed / fastest;
+                newY *= kLbmMaxSpeed / fastest;
+            }
+            equilibrium(rho, newX, newY, feqNew);
+            for(int q = 0; q < 9; q++)
+                f[at[q] + idx] = g[q] + feqNew[q] - feq[q];
+            fX[idx] = fY[idx] = 0.0;
+        }
+    }
+}
+
+void LBMFluidClass::evenStep(void){
+    float *a = f.data();
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    float omega = 1.0/tau, inv = 1.0/latticeScale;
+    parallelFor(N-2, 8, kLbmThreads, [&](int begin, int end){
+        for(int j = begin + 1; j < end + 1; j++){
+            int i = 1;
+#ifdef __AVX2__
+            for(; i + 8 <= N-1; i += 8)
+                evenCells<lane8>(a, size, i + j * stride, omega, inv, vX, vY);
+#endif
+            for(; i < N-1; i++)
+                evenCells<float>(a, size, i + j * stride, omega, inv, vX, vY);
+        }
+    });
+}
+
+void LBMFluidClass::oddStep(void){
+    float *a = f.data();
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    float omega = 1.0/tau, inv = 1.0/latticeScale;
+    int off[9];
+    for(int q = 0; q < 9; q++)
+        off[q] = cX[q] + cY[q] * stride;
+    /* a cell next to a wall takes what it sent to the wall in
+     * the even step back as the population coming from it
+     * (bounce back), and keeps what goes to the wall for the
+     * next even step in the slot of the opposite direction
+    */
+    auto wallCell = [&](int i, int j){
+        int idx = i + j * stride;
+        float g[9], ux, uy;
+        for(int q = 0; q < 9; q++){
+            int si = i - cX[q], sj = j - cY[q];
+            bool wall = si == 0 || si == N-1 || sj == 0 || sj == N-1;
+            g[q] = wall ? a[q * size + idx] : a[opp[q] * size + idx - off[q]];
+        }
+        collide(g, omega, ux, uy);
+        for(int q = 0; q < 9; q++){
+            int di = i + cX[q], dj = j + cY[q];
+            bool wall = di == 0 || di == N-1 || dj == 0 || dj == N-1;
+            if(wall)
+                a[opp[q] * size + idx] = g[q];
+            else
+                a[q * size + idx + off[q]] = g[q];
+        }
+        vX[idx] = ux * inv;
+        vY[idx] = uy * inv;
+    };
+    parallelFor(N-2, 8, kLbmThreads, [&](int begin, int end){
+        for(int j = begin + 1; j < end + 1; j++){
+            if(j == 1 || j == N-2){
+                for(int i = 1; i < N-1; i++)
+                    wallCell(i, j);
+                continue;
+            }
+            wallCell(1, j);
+            int i = 2;
+#ifdef __AVX2__
+            for(; i + 8 <= N-2; i += 8)
+                oddCells<lane8>(a, size, i + j * stride, off, omega, inv, vX, vY);
+#endif
+            for(; i < N-2; i++)
+                oddCells<float>(a, size, i + j * stride, off, omega, inv, vX, vY);
+            wallCell(N-2, j);
+        }
+    });
+}
+
+void LBMFluidClass::addDensitySource(int i, int j, float amount){
+    grid.addDensitySource(i, j, amount);
+}
+
+void LBMFluidClass::addVelocitySource(int i, int j, float amountX, float amountY){
+    /* added to the populations at the start of the next step
+    */
+    int idx = i + j * stride;
+    grid.getComponent(force, VELOCITY_X)[idx] += amountX;
+    grid.getComponent(force, VELOCITY_Y)[idx] += amountY;
+}
+
+void LBMFluidClass::velocityStep(void){
+    grid.dt = dt;
+    /* the fastest cell once the sources are added
+    */
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    float *fX = grid.getComponent(force, VELOCITY_X);
+    float *fY = grid.getComponent(force, VELOCITY_Y);
+    float vMax = 0.0;
+    for(int j = 1; j < N-1; j++){
+        for(int i = 1; i < N-1; i++){
+            int idx = i + j * stride;
+            vMax = std::max(vMax, std::max(fabsf(vX[idx] + fX[idx]), fabsf(vY[idx] + fY[idx])));
+        }
+    }
+    rescale(vMax);
+    applyForces();
+    for(int s = 0; s < substeps; s++){
+        if(odd)
+            oddStep();
+        else
+            evenStep();
+        odd = !odd;
+    }
+    grid.setBoundaries(VELOCITY_X, vX);
+    grid.setBoundaries(VELOCITY_Y, vY);
+}
+
+void LBMFluidClass::transportDye(float *d, const float *vel, int step, float courant){
+    /* flux through the face between cell c and c + step, 0 on
+     * the faces to the walls
+    */
+    float *out = flux.data();
+    int last = N-2;
+    parallelFor(N-2, 8, kLbmThreads, [&](int begin, int end){
+        for(int j = begin + 1; j < end + 1; j++){
+            for(int i = 1; i < N-1; i++){
+                int c = i + j * stride;
+                bool wall = (step == 1) ? i == last : j == last;
+                if(wall){
+                    out[c] = 0.0;
+                    continue;
+                }
+                /* cells moved per sub step through the face, and
+                 * the value on the face from the cell upwind of
+                 * it, with its slope limited (minmod) so no new
+                 * extremes appear
+                */
+                float cf = 0.5 * (vel[c] + vel[c + step]) * courant;
+                int up = (cf > 0.0) ? c : c + step;
+                float back = d[up] - d[up - step];
+                float ahead = d[up + step] - d[up];
+                float slope = (back * ahead > 0.0) ?
+                              (fabsf(back) < fabsf(ahead) ? back : ahead) : 0.0;
+                float face = d[up] + ((cf > 0.0) ? 0.5 : -0.5) * (1 - fabsf(cf)) * slope;
+                out[c] = cf * face;
+            }
+        }
+    });
+    parallelFor(N-2, 8, kLbmThreads, [&](int begin, int end){
+        for(int j = begin + 1; j < end + 1; j++){
+            for(int i = 1; i < N-1; i++){
+                int c = i + j * stride;
+                bool first = (step == 1) ? i == 1 : j == 1;
+                d[c] -= out[c] - (first ? 0.0f : out[c - step]);
+            }
+        }
+    });
+    grid.setBoundaries(DENSITY, d);
+}
+
+void LBMFluidClass::densityStep(void){
+    /* the lattice velocity is not exactly divergence free, so
+     * the dye moves in flux form: what leaves a cell goes to
+     * its neighbour and the total only changes by the sources
+    */
+    grid.dt = dt;
+    if(dDiff > 0.0){
+        grid.diffuse(DENSITY, grid.dCurr.data(), grid.dPrev.data(), dDiff);
+        grid.dCurr.swap(grid.dPrev);
+    }
+    float *d = grid.dPrev.data();
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    /* half a cell per sub step and direction at most, a cell
+     * can lose through two faces of a sweep and stays positive
+    */
+    float cells = grid.maxVelocity() * dt * (N-2);
+    int steps = 1;
+    if(cells > 0.5)
+        steps = std::min((int)ceilf(cells / 0.5), 2 * kLbmMaxSubsteps);
+    float courant = dt * (N-2) / steps;
+    grid.setBoundaries(DENSITY, d);
+    for(int s = 0; s < steps; s++){
+        /* x then y, the other way round on the next sub step
+        */
+        bool xFirst = (s % 2) == 0;
+        transportDye(d, xFirst ? vX : vY, xFirst ? 1 : stride, courant);
+        transportDye(d, xFirst ? vY : vX, xFirst ? stride : 1, courant);
+    }
+}
+
+void LBMFluidClass::simulationStep(void){
+    velocityStep();
+    densityStep();
+}
+
+float LBMFluidClass::maxVelocity(void){
+    return grid.maxVelocity();
+}
+
+void LBMFluidClass::frameStep(float frameDt){
+    dt = frameDt;
+    simulationStep();
+}
+
+float LBMFluidClass::getDensity(int i, int j){
+    return grid.getDensity(i, j);
+}
+
+float LBMFluidClass::getVelocity(attribute atType, int i, int j){
+    return grid.getComponent(grid.vCurr, atType)[i + j * stride];
+}
+
+int LBMFluidClass::getSubsteps(void){
+    return substeps;
+}
+
+size_t LBMFluidClass::getMemoryUsage(void){
+    return grid.getMemoryUsage() + (f.count() + force.count() + flux.count()) * sizeof(float);
+}
@@ -0,0 +1,329 @@
+#include "../../Include/Simulation/MACFluid.h"
+#include "../../Include/Control/Constants.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h> /* for memcpy
+*/
+#include <algorithm>
+#include <iostream>
+
+MACFluidClass::MACFluidClass(int _N, float _dDiff, float _vDiff, float _dt){
+    N = _N;
+    assert((N+2) % 2 == 0);
+    dDiff = _dDiff;
+    vDiff = _vDiff;
+    dt = _dt;
+    stride = padStrides ? FluidClass::paddedStride(N) : N;
+    uStride = padStrides ? FluidClass::paddedStride(N+1) : N+1;
+    vStride = stride;
+    /* 2 density fields, divergence and pressure, 2 u fields
+     * (N rows of N+1 faces) and 2 v fields (N+1 rows of N faces)
+    */
+    size_t bytes = 4 * ArenaClass::align(N * stride * sizeof(float)) +
+                   2 * ArenaClass::align(N * uStride * sizeof(float)) +
+                   2 * ArenaClass::align((N+1) * vStride * sizeof(float));
+    if(!arena.reserve(bytes, useHugePages)){
+        std::cout << "[ERROR] Unable to allocate " << bytes << " bytes for the fields"
+                  << std::endl;
+        assert(false);
+    }
+    dCurr = FieldClass<float>(arena, N, stride, 1);
+    dPrev = FieldClass<float>(arena, N, stride, 1);
+    div = FieldClass<float>(arena, N, stride, 1);
+    p = FieldClass<float>(arena, N, stride, 1);
+    u = FieldClass<float>(arena, N, uStride, 1);
+    uPrev = FieldClass<float>(arena, N, uStride, 1);
+    v = FieldClass<float>(arena, N+1, vStride, 1);
+    vPrev = FieldClass<float>(arena, N+1, vStride, 1);
+}
+
+MACFluidClass::~MACFluidClass(void){
+}
+
+int MACFluidClass::getStride(attribute atType){
+    if(atType == VELOCITY_X)
+        return uStride;
+    if(atType == VELOCITY_Y)
+        return vStride;
+    return stride;
+}
+
+int MACFluidClass::getIdx(attribute atType, int i, int j){
+    return i + (j * getStride(atType));
+}
+
+void MACFluidClass::getInterior(attribute atType, int &i0, int &i1, int &j0, int &j1){
+    /* the faces on the walls (u at i = 1 and i = N-1, v at
+     * j = 1 and j = N-1) are not unknowns
+    */
+    i0 = (atType == VELOCITY_X) ? 2 : 1;
+    j0 = (atType == VELOCITY_Y) ? 2 : 1;
+    i1 = N-2;
+    j1 = N-2;
+}
+
+void MACFluidClass::setBoundaries(attribute atType, float *arr){
+    if(atType == VELOCITY_X){
+        for(int j = 0; j < N; j++){
+            arr[getIdx(atType, 0, j)] = 0.0;
+            arr[getIdx(atType, 1, j)] = 0.0;
+            arr[getIdx(atType, N-1, j)] = 0.0;
+            arr[getIdx(atType, N, j)] = 0.0;
+        }
+        for(int i = 2; i < N-1; i++){
+            arr[getIdx(atType, i, 0)] = arr[getIdx(atType, i, 1)];
+            arr[getIdx(atType, i, N-1)] = arr[getIdx(atType, i, N-2)];
+        }
+        return;
+    }
+    if(atType == VELOCITY_Y){
+        for(int i = 0; i < N; i++){
+            arr[getIdx(atType, i, 0)] = 0.0;
+            arr[getIdx(atType, i, 1)] = 0.0;
+            arr[getIdx(atType, i, N-1)] = 0.0;
+            arr[getIdx(atType, i, N)] = 0.0;
+        }
+        for(int j = 2; j < N-1; j++){
+            arr[getIdx(atType, 0, j)] = arr[getIdx(atType, 1, j)];
+            arr[getIdx(atType, N-1, j)] = arr[getIdx(atType, N-2, j)];
+        }
+        return;
+    }
+    /* density and pressure, continuity at the walls
+    */
+    for(int i = 1; i < N-1; i++){
+        arr[getIdx(atType, i, 0)] = arr[getIdx(atType, i, 1)];
+        arr[getIdx(atType, i, N-1)] = arr[getIdx(atType, i, N-2)];
+    }
+    for(int j = 1; j < N-1; j++){
+        arr[getIdx(atType, 0, j)] = arr[getIdx(atType, 1, j)];
+        arr[getIdx(atType, N-1, j)] = arr[getIdx(atType, N-2, j)];
+    }
+    arr[getIdx(atType, 0, 0)] =
+        0.5 * (arr[getIdx(atType, 1, 0)] + arr[getIdx(atType, 0, 1)]);
+    arr[getIdx(atType, N-1, 0)] =
+        0.5 * (arr[getIdx(atType, N-2, 0)] + arr[getIdx(atType, N-1, 1)]);
+    arr[getIdx(atType, 0, N-1)] =
+        0.5 * (arr[getIdx(atType, 1, N-1)] + arr[getIdx(atType, 0, N-2)]);
+    arr[getIdx(atType, N-1, N-1)] =
+        0.5 * (arr[getIdx(atType, N-2, N-1)] + arr[getIdx(atType, N-1, N-2)]);
+}
+
+float MACFluidClass::sample(attribute atType, float *arr, float x, float y){
+    /* position in units of the field's own points, u(i,j) is
+     * at (i - 0.5, j) and v(i,j) at (i, j - 0.5). The clamp
+     * keeps the 4 surrounding points inside the field, for
+     * the normal component the wall faces are the limit
+    */
+    float fX = x, fY = y;
+    float loX = 0.5, hiX = (N-2) + 0.5;
+    float loY = 0.5, hiY = (N-2) + 0.5;
+    if(atType == VELOCITY_X){
+        fX += 0.5;
+        loX = 1.0;
+        hiX = N-1;
+    }
+    else if(atType == VELOCITY_Y){
+        fY += 0.5;
+        loY = 1.0;
+        hiY = N-1;
+    }
+    fX = std::min(std::max(fX, loX), hiX);
+    fY = std::min(std::max(fY, loY), hiY);
+
+    int i0 = (int)fX;
+    int i1 = i0 + 1;
+    int j0 = (int)fY;
+    int j1 = j0 + 1;
+    float s1 = fX - i0;
+    float s0 = 1.0 - s1;
+    float t1 = fY - j0;
+    float t0 = 1.0 - t1;
+    return s0 * (t0 * arr[getIdx(atType, i0, j0)] + t1 * arr[getIdx(atType, i0, j1)]) +
+           s1 * (t0 * arr[getIdx(atType, i1, j0)] + t1 * arr[getIdx(atType, i1, j1)]);
+}
+
+void MACFluidClass::velocityAt(float *velU, float *velV, float x, float y, float &vx, float &vy){
+    vx = sample(VELOCITY_X, velU, x, y);
+    vy = sample(VELOCITY_Y, velV, x, y);
+}
+
+void MACFluidClass::addDensitySource(int i, int j, float amount){
+    dPrev[getIdx(DENSITY, i, j)] += amount;
+}
+
+void MACFluidClass::addVelocitySource(int i, int j, float amountX, float amountY){
+    u[getIdx(VELOCITY_X, i, j)] += amountX;
+    u[getIdx(VELOCITY_X, i+1, j)] += amountX;
+    v[getIdx(VELOCITY_Y, i, j)] += amountY;
+    v[getIdx(VELOCITY_Y, i, j+1)] += amountY;
+}
+
+void MACFluidClass::diffuse(attribute atType, float *curr, float *prev, float diff){
+    float k = dt * diff * (N-2) * (N-2);
+    int i0, i1, j0, j1;
+    getInterior(atType, i0, i1, j0, j1);
+    if(k == 0.0){
+        int rows = (atType == VELOCITY_Y) ? N+1 : N;
+        memcpy(curr, prev, rows * getStride(atType) * sizeof(float));
+        setBoundaries(atType, curr);
+    }
+    else if(k < kExplicitLimit){
+        int row = getStride(atType);
+        for(int j = j0; j <= j1; j++){
+            for(int i = i0; i <= i1; i++){
+                int idx = getIdx(atType, i, j);
+                float s = prev[idx - 1] + prev[idx + 1] + prev[idx - row] + prev[idx + row];
+                curr[idx] = prev[idx] + k * (s - 4 * prev[idx]);
+            }
+        }
+        setBoundaries(atType, curr);
+    }
+    else
+        iterSolve(atType, curr, prev, k, kIter);
+}
+
+void MACFluidClass::iterSolve(attribute atType, float *curr, float *prev, float k, int numIter){
+    int i0, i1, j0, j1;
+    getInterior(atType, i0, i1, j0, j1);
+    int row = getStride(atType);
+    float denom = (atType == CLEAR_DIVERGENCE) ? 4 : (1 + 4 * k);
+    while(numIter != 0){
+        for(int j = j0; j <= j1; j++){
+            for(int i = i0; i <= i1; i++){
+                int idx = getIdx(atType, i, j);
+                float s = curr[idx - 1] + curr[idx + 1] + curr[idx - row] + curr[idx + row];
+                curr[idx] = (prev[idx] + (k * s))/denom;
+            }
+        }
+        setBoundaries(atType, curr);
+        numIter--;
+    }
+}
+
+void MACFluidClass::advection(attribute atType, float *curr, float *prev, float *velU, float *velV){
+    float dT = dt * (N-2);
+    /* offset of the field's points from the cell centers
+    */
+    float oX = (atType == VELOCITY_X) ? -0.5 : 0.0;
+    float oY = (atType == VELOCITY_Y) ? -0.5 : 0.0;
+    int i0, i1, j0, j1;
+    getInterior(atType, i0, i1, j0, j1);
+    for(int j = j0; j <= j1; j++){
+        for(int i = i0; i <= i1; i++){
+            float x = i + oX;
+            float y = j + oY;
+            float vx, vy;
+            velocityAt(velU, velV, x, y, vx, vy);
+            curr[getIdx(atType, i, j)] = sample(atType, prev, x - dT * vx, y - dT * vy);
+        }
+    }
+    setBoundaries(atType, curr);
+}
+
+void MACFluidClass::clearDivergence(float *velU, float *velV){
+    /* in cell units, with h = 1/(N-2)
+     *      (sum of 4 neighbours of p - 4p)/h^2 = div
+     *      div = (u(i+1,j) - u(i,j) + v(i,j+1) - v(i,j))/h
+     * so p = (sum of 4 neighbours - h * (du + dv))/4, which is
+     * iterSolve with k = 1 and prev = -h * (du + dv)
+    */
+    float h = 1.0 / (N-2);
+    float *d = div.data();
+    float *pr = p.data();
+    for(int j = 1; j < N-1; j++){
+        for(int i = 1; i < N-1; i++){
+            int idx = getIdx(DENSITY, i, j);
+            d[idx] = -h * (velU[getIdx(VELOCITY_X, i+1, j)] - velU[getIdx(VELOCITY_X, i, j)] +
+                           velV[getIdx(VELOCITY_Y, i, j+1)] - velV[getIdx(VELOCITY_Y, i, j)]);
+            pr[idx] = 0;
+        }
+    }
+    setBoundaries(CLEAR_DIVERGENCE, d);
+    setBoundaries(CLEAR_DIVERGENCE, pr);
+
+    iterSolve(CLEAR_DIVERGENCE, pr, d, 1, kIter);
+    /* the gradient across every interior face, the wall faces
+     * stay 0
+    */
+    for(int j = 1; j < N-1; j++){
+        for(int i = 2; i < N-1; i++){
+            velU[getIdx(VELOCITY_X, i, j)] -= (N-2) * (pr[getIdx(DENSITY, i, j)] -
+                                                       pr[getIdx(DENSITY, i-1, j)]);
+        }
+    }
+    for(int j = 2; j < N-1; j++){
+        for(int i = 1; i < N-1; i++){
+            velV[getIdx(VELOCITY_Y, i, j)] -= (N-2) * (pr[getIdx(DENSITY, i, j)] -
+                                                       pr[getIdx(DENSITY, i, j-1)]);
+        }
+    }
+    setBoundaries(VELOCITY_X, velU);
+    setBoundaries(VELOCITY_Y, velV);
+}
+
+float MACFluidClass::maxDivergence(float *velU, float *velV){
+    float maxDiv = 0.0;
+    for(int j = 1; j < N-1; j++){
+        for(int i = 1; i < N-1; i++){
+            float d = velU[getIdx(VELOCITY_X, i+1, j)] - velU[getIdx(VELOCITY_X, i, j)] +
+                      velV[getIdx(VELOCITY_Y, i, j+1)] - velV[getIdx(VELOCITY_Y, i, j)];
+            maxDiv = std::max(maxDiv, fabsf(d) * (N-2));
+        }
+    }
+    return maxDiv;
+}
+
+void MACFluidClass::densityStep(void){
+    diffuse(DENSITY, dCurr.data(), dPrev.data(), dDiff);
+    advection(DENSITY, dPrev.data(), dCurr.data(), u.data(), v.data());
+}
+
+void MACFluidClass::velocityStep(void){
+    /* same order as FluidClass, the sources are in u and v,
+     * the diffused and projected velocity in uPrev and vPrev
+     * is advected back into u and v
+    */
+    diffuse(VELOCITY_X, uPrev.data(), u.data(), vDiff);
+    diffuse(VELOCITY_Y, vPrev.data(), v.data(), vDiff);
+    clearDivergence(uPrev.data(), vPrev.data());
+
+    advection(VELOCITY_X, u.data(), uPrev.data(), uPrev.data(), vPrev.data());
+    advection(VELOCITY_Y, v.data(), vPrev.data(), uPrev.data(), vPrev.data());
+    clearDivergence(u.data(), v.data());
+}
+
+void MACFluidClass::simulationStep(void){
+    velocityStep();
+    densityStep();
+}
+
+float MACFluidClass::maxVelocity(void){
+    float vMax = 0.0;
+    for(int k = 0; k < N * uStride; k++)
+        vMax = std::max(vMax, fabsf(u[k]));
+    for(int k = 0; k < (N+1) * vStride; k++)
+        vMax = std::max(vMax, fabsf(v[k]));
+    return vMax;
+}
+
+void MACFluidClass::frameStep(float frameDt){
+    frameSubsteps(frameDt, N, cflTarget, kMaxSubsteps, [&]{
+        return maxVelocity();
+    }, [&](float step, float){
+        dt = step;
+        simulationStep();
+    });
+}
+
+float MACFluidClass::getDensity(int i, int j){
+    return dPrev[getIdx(DENSITY, i, j)];
+}
+
+size_t MACFluidClass::getMemoryUsage(void){
+    return arena.getUsed();
+}
+
+size_t MACFluidClass::getReservedMemory(void){
+    return arena.getCapacity();
+}
@@ -0,0 +1,94 @@
+#include "../../Include/Simulation/Obstacle.h"
+#include <math.h>
+#include <algorithm>
+
+float signedDistance(const obstacleShape &shape, float x, float y){
+    float dx = x - shape.x;
+    float dy = y - shape.y;
+    if(shape.type == SHAPE_CIRCLE)
+        return sqrtf(dx * dx + dy * dy) - shape.a;
+    /* box, distance to the outside of the edges (0 within
+     * their range) and to the nearest edge on the inside
+    */
+    float qx = fabsf(dx) - shape.a;
+    float qy = fabsf(dy) - shape.b;
+    float ox = std::max(qx, 0.0f);
+    float oy = std::max(qy, 0.0f);
+    return sqrtf(ox * ox + oy * oy) + std::min(std::max(qx, qy), 0.0f);
+}
+
+ObstacleClass::ObstacleClass(void){
+    n = words = 0;
+    numSolid = numFluid = 0;
+}
+
+ObstacleClass::ObstacleClass(int n) : n(n){
+    words = (n + 63)/64;
+    mask.assign(n * words, 0);
+    build();
+}
+
+ObstacleClass::~ObstacleClass(void){
+}
+
+void ObstacleClass::setSolid(int i, int j){
+    mask[j * words + (i >> 6)] |= (uint64_t)1 << (i & 63);
+}
+
+void ObstacleClass::clear(void){
+    std::fill(mask.begin(), mask.end(), 0);
+    build();
+}
+
+void ObstacleClass::rasterize(const obstacleShape &shape){
+    float h = 1.0/(n-2);
+    for(int j = 1; j < n-1; j++){
+        for(int i = 1; i < n-1; i++){
+            if(signedDistance(shape, (i - 0.5) * h, (j - 0.5) * h) <= 0.0)
+                setSolid(i, j);
+        }
+    }
+}
+
+void ObstacleClass::build(void){
+    rowSpans.assign(n+1, 0);
+    spanBegin.clear();
+    spanEnd.clear();
+    interface.clear();
+    numSolid = numFluid = 0;
+    for(int j = 0; j < n; j++){
+        rowSpans[j] = spanBegin.size();
+        if(j == 0 || j == n-1)
+            continue;
+        int i = 1;
+        while(i < n-1){
+            if(isSolid(i, j)){
+                /* the solid cells that a fluid neighbour reads,
+                 * the border cells are ghost cells themselves
+                 * (filled from this cell) so they do not count
+                */
+                int fluid = 0;
+                if(i > 1 && !isSolid(i-1, j))
+                    fluid |= 1;
+                if(i < n-2 && !isSolid(i+1, j))
+                    fluid |= 2;
+                if(j > 1 && !isSolid(i, j-1))
+                    fluid |= 4;
+                if(j < n-2 && !isSolid(i, j+1))
+                    fluid |= 8;
+                if(fluid != 0)
+                    interface.push_back({i, j, fluid});
+                numSolid++;
+                i++;
+                continue;
+            }
+            int begin = i;
+            while(i < n-1 && !isSolid(i, j))
+                i++;
+            spanBegin.push_back(begin);
+            spanEnd.push_back(i);
+            numFluid += i - begin;
+        }
+    }
+    rowSpans[n] = spanBegin.size();
+}
@@ -0,0 +1,86 @@
+#include "../../Include/Simulation/Parallel.h"
+
+/* set on the threads of the pool, and on the calling thread
+ * while it does its part of a run: a run from a job is done in
+ * place instead of waiting for workers that are busy with it
+*/
+static thread_local bool insideWorker = false;
+
+WorkerPoolClass::WorkerPoolClass(void){
+    job = NULL;
+    context = NULL;
+    active = pending = 0;
+    generation = 0;
+    stopping = false;
+    workers.reserve(kMaxWorkers);
+}
+
+WorkerPoolClass::~WorkerPoolClass(void){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+WorkerPoolClass &WorkerPoolClass::get(void){
+    static WorkerPoolClass pool;
+    return pool;
+}
+
+void WorkerPoolClass::workerLoop(int t, unsigned long seen){
+    insideWorker = true;
+    std::unique_lock<std::mutex> guard(lock);
+    while(true){
+        wake.wait(guard, [&]{
+            return stopping || generation != seen;
+        });
+        if(stopping)
+            return;
+        seen = generation;
+        /* a run with fewer threads than the pool has
+        */
+        if(t >= active)
+            continue;
+        guard.unlock();
+        job(context, t);
+        guard.lock();
+        if(--pending == 0)
+            done.notify_one();
+    }
+}
+
+void WorkerPoolClass::run(int count, void (*_job)(void *context, int t), void *_context){
+    count = std::min(count, kMaxWorkers);
+    if(count <= 1 || insideWorker){
+        for(int t = 0; t < count; t++)
+            _job(_context, t);
+        return;
+    }
+    std::lock_guard<std::mutex> turn(serial);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        /* worker t is thread t of a run, the new ones start
+         * from the current run so they take part in the next
+        */
+        while((int)workers.size() < count - 1){
+            int t = workers.size() + 1;
+            workers.emplace_back(&WorkerPoolClass::workerLoop, this, t, generation);
+        }
+        job = _job;
+        context = _context;
+        active = count;
+        pending = count - 1;
+        generation++;
+    }
+    wake.notify_all();
+    insideWorker = true;
+    _job(_context, 0);
+    insideWorker = false;
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&]{
+        return pending == 0;
+    });
+}
@@ -0,0 +1,292 @@
+#include "../../Include/Simulation/Particles.h"
+#include "../../Include/Simulation/Layout.h"
+#include "../../Include/Simulation/Parallel.h"
+#include "../../Include/Control/Constants.h"
+#include <math.h>
+#include <string.h> /* for memmove
+*/
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+ParticleClass::ParticleClass(int capacity, float lifetime) : capacity(capacity), lifetime(lifetime){
+    count = 0;
+    threads = kParticleThreads;
+    sortInterval = kParticleSortInterval;
+    unsorted = 0;
+    seed = 1;
+    x.resize(capacity);
+    y.resize(capacity);
+    age.resize(capacity);
+    sortX.resize(capacity);
+    sortY.resize(capacity);
+    sortAge.resize(capacity);
+    keys.resize(capacity);
+}
+
+ParticleClass::~ParticleClass(void){
+}
+
+float ParticleClass::random(void){
+    seed = seed * 1103515245u + 12345u;
+    return ((seed >> 8) & 0xffff) / 65536.0f;
+}
+
+int ParticleClass::emit(float cx, float cy, float r, int number){
+    number = std::min(number, capacity - count);
+    for(int k = 0; k < number; k++){
+        /* sqrt for an even spread over the area
+        */
+        float d = r * sqrtf(random());
+        float a = 2 * M_PI * random();
+        x[count] = cx + d * cosf(a);
+        y[count] = cy + d * sinf(a);
+        age[count] = 0.0;
+        count++;
+    }
+    return number;
+}
+
+void ParticleClass::clear(void){
+    count = 0;
+    unsorted = 0;
+}
+
+void ParticleClass::setThreads(int number){
+    threads = number;
+}
+
+void ParticleClass::setSortInterval(int steps){
+    sortInterval = steps;
+}
+
+/* bilinear velocity at (fX,fY), in cell units of the velocity
+ * grid and already clamped
+*/
+template<typename L>
+static inline void sampleVelocity(const float *vX, const float *vY, int row, float fX, float fY,
+                                  float &uX, float &uY){
+    int i0 = (int)fX;
+    int j0 = (int)fY;
+    float s1 = fX - i0;
+    float s0 = 1.0 - s1;
+    float t1 = fY - j0;
+    float t0 = 1.0 - t1;
+    int c00 = L::cell(i0, j0, row);
+    int c01 = L::nextJ(c00, row);
+    int c10 = L::nextI(c00, row);
+    int c11 = L::nextI(c01, row);
+    uX = s0 * (t0 * vX[c00] + t1 * vX[c01]) + s1 * (t0 * vX[c10] + t1 * vX[c11]);
+    uY = s0 * (t0 * vY[c00] + t1 * vY[c01]) + s1 * (t0 * vY[c10] + t1 * vY[c11]);
+}
+
+#ifdef __AVX2__
+template<typename L>
+static inline void sampleVelocity8(const float *vX, const float *vY, __m256i vRow, __m256 fX,
+                                   __m256 fY, __m256 &uX, __m256 &uY){
+    const __m256 vOne = _mm256_set1_ps(1.0);
+    __m256i i0 = _mm256_cvttps_epi32(fX);
+    __m256i j0 = _mm256_cvttps_epi32(fY);
+    __m256 s1 = _mm256_sub_ps(fX, _mm256_cvtepi32_ps(i0));
+    __m256 s0 = _mm256_sub_ps(vOne, s1);
+    __m256 t1 = _mm256_sub_ps(fY, _mm256_cvtepi32_ps(j0));
+    __m256 t0 = _mm256_sub_ps(vOne, t1);
+    __m256i c00 = L::cell8(i0, j0, vRow);
+    __m256i c01 = L::nextJ8(c00, vRow);
+    __m256i c10 = L::nextI8(c00, vRow);
+    __m256i c11 = L::nextI8(c01, vRow);
+    const float *v[2] = {vX, vY};
+    __m256 result[2];
+    for(int c = 0; c < 2; c++){
+        __m256 z0 = _mm256_add_ps(_mm256_mul_ps(t0, _mm256_i32gather_ps(v[c], c00, 4)),
+                                  _mm256_mul_ps(t1, _mm256_i32gather_ps(v[c], c01, 4)));
+        __m256 z1 = _mm256_add_ps(_mm256_mul_ps(t0, _mm256_i32gather_ps(v[c], c10, 4)),
+                                  _mm256_mul_ps(t1, _mm256_i32gather_ps(v[c], c11, 4)));
+        result[c] = _mm256_add_ps(_mm256_mul_ps(s0, z0), _mm256_mul_ps(s1, z1));
+    }
+    uX = result[0];
+    uY = result[1];
+}
+#endif
+
+template<typename L>
+int ParticleClass::advanceRange(int begin, int end, const ObstacleClass &solid, int n, int row,
+                                const float *vX, const float *vY, float dt,
+                                const particleDomain &domain){
+    /* a position p in the unit square is at p * (n-2) + 0.5 in
+     * cell units (cell i has its center at i). Sampling between
+     * 0.5 and n-1.5 reads the ghost cells at most, which hold
+     * the wall (or the wrapped around) values
+    */
+    float scale = n - 2;
+    float lo = 0.5, hi = n - 1.5;
+    /* where a particle can be after a step, a wall stops it,
+     * past an open side it is culled below. A periodic axis
+     * wraps around instead
+    */
+    bool wrapX = domain.periodic[0], wrapY = domain.periodic[2];
+    float minX = domain.open[0] ? -INFINITY : 0.0;
+    float maxX = domain.open[1] ? INFINITY : 1.0;
+    float minY = domain.open[2] ? -INFINITY : 0.0;
+    float maxY = domain.open[3] ? INFINITY : 1.0;
+    float half = 0.5 * dt;
+    float *pX = x.data(), *pY = y.data(), *pAge = age.data();
+
+    int k = begin;
+#ifdef __AVX2__
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vHalfCell = _mm256_set1_ps(0.5);
+    const __m256 vLo = _mm256_set1_ps(lo);
+    const __m256 vHi = _mm256_set1_ps(hi);
+    const __m256 vHalf = _mm256_set1_ps(half);
+    const __m256 vdt = _mm256_set1_ps(dt);
+    const __m256 vMinX = _mm256_set1_ps(minX);
+    const __m256 vMaxX = _mm256_set1_ps(maxX);
+    const __m256 vMinY = _mm256_set1_ps(minY);
+    const __m256 vMaxY = _mm256_set1_ps(maxY);
+    const __m256i vRow = _mm256_set1_epi32(row);
+    /* p - floor(p) on a periodic axis, the clamp on the others
+    */
+    auto limitX = [&](__m256 p){
+        return wrapX ? _mm256_sub_ps(p, _mm256_floor_ps(p)) :
+                       _mm256_min_ps(_mm256_max_ps(p, vMinX), vMaxX);
+    };
+    auto limitY = [&](__m256 p){
+        return wrapY ? _mm256_sub_ps(p, _mm256_floor_ps(p)) :
+                       _mm256_min_ps(_mm256_max_ps(p, vMinY), vMaxY);
+    };
+    auto toCell = [&](__m256 p){
+        return _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(p, vScale), vHalfCell),
+                                           vLo), vHi);
+    };
+    for(; k + 8 <= end; k += 8){
+        __m256 px = _mm256_loadu_ps(pX + k);
+        __m256 py = _mm256_loadu_ps(pY + k);
+        __m256 uX, uY;
+        sampleVelocity8<L>(vX, vY, vRow, toCell(px), toCell(py), uX, uY);
+        /* midpoint
+        */
+        __m256 mx = limitX(_mm256_add_ps(px, _mm256_mul_ps(vHalf, uX)));
+        __m256 my = limitY(_mm256_add_ps(py, _mm256_mul_ps(vHalf, uY)));
+        sampleVelocity8<L>(vX, vY, vRow, toCell(mx), toCell(my), uX, uY);
+        _mm256_storeu_ps(pX + k, limitX(_mm256_add_ps(px, _mm256_mul_ps(vdt, uX))));
+        _mm256_storeu_ps(pY + k, limitY(_mm256_add_ps(py, _mm256_mul_ps(vdt, uY))));
+        _mm256_storeu_ps(pAge + k, _mm256_add_ps(_mm256_loadu_ps(pAge + k), vdt));
+    }
+#endif
+    /* rest of the chunk (or the whole chunk without AVX2)
+    */
+    auto limit = [](float p, bool wrap, float pMin, float pMax){
+        return wrap ? p - floorf(p) : std::min(std::max(p, pMin), pMax);
+    };
+    for(; k < end; k++){
+        float uX, uY;
+        sampleVelocity<L>(vX, vY, row, std::min(std::max(pX[k] * scale + 0.5f, lo), hi),
+                          std::min(std::max(pY[k] * scale + 0.5f, lo), hi), uX, uY);
+        float mx = limit(pX[k] + half * uX, wrapX, minX, maxX);
+        float my = limit(pY[k] + half * uY, wrapY, minY, maxY);
+        sampleVelocity<L>(vX, vY, row, std::min(std::max(mx * scale + 0.5f, lo), hi),
+                          std::min(std::max(my * scale + 0.5f, lo), hi), uX, uY);
+        pX[k] = limit(pX[k] + dt * uX, wrapX, minX, maxX);
+        pY[k] = limit(pY[k] + dt * uY, wrapY, minY, maxY);
+        pAge[k] += dt;
+    }
+    /* cull, the ones that stay are packed to the front in
+     * the same order
+    */
+    bool checkSolid = !solid.isEmpty();
+    int kept = begin;
+    for(k = begin; k < end; k++){
+        if(lifetime > 0.0 && pAge[k] >= lifetime)
+            continue;
+        if(pX[k] < 0.0 || pX[k] > 1.0 || pY[k] < 0.0 || pY[k] > 1.0)
+            continue;
+        if(checkSolid){
+            int i = std::min((int)(pX[k] * scale) + 1, n-2);
+            int j = std::min((int)(pY[k] * scale) + 1, n-2);
+            if(solid.isSolid(i, j))
+                continue;
+        }
+        pX[kept] = pX[k];
+        pY[kept] = pY[k];
+        pAge[kept] = pAge[k];
+        kept++;
+    }
+    return kept - begin;
+}
+
+template<typename L>
+void ParticleClass::advance(const ObstacleClass &solid, int n, int row, const float *vX,
+                            const float *vY, float dt, const particleDomain &domain){
+    if(count == 0)
+        return;
+    if(sortInterval > 0 && ++unsorted >= sortInterval){
+        sort(n);
+        unsorted = 0;
+    }
+    int workers = workerCount(count, kParticlesPerThread, threads);
+    /* whole groups of 8 per chunk, only the last chunk has a
+     * scalar tail
+    */
+    int chunk = ((count + workers - 1)/workers + 7)/8 * 8;
+    int kept[kMaxWorkers];
+    auto move = [&](int t){
+        int begin = std::min(t * chunk, count);
+        int end = std::min(begin + chunk, count);
+        kept[t] = advanceRange<L>(begin, end, solid, n, row, vX, vY, dt, domain);
+    };
+    parallelRun(workers, move);
+    /* close the gaps the culled particles left between the
+     * chunks
+    */
+    int total = kept[0];
+    for(int t = 1; t < workers; t++){
+        int begin = std::min(t * chunk, count);
+        if(begin != total && kept[t] > 0){
+            memmove(x.data() + total, x.data() + begin, kept[t] * sizeof(float));
+            memmove(y.data() + total, y.data() + begin, kept[t] * sizeof(float));
+            memmove(age.data() + total, age.data() + begin, kept[t] * sizeof(float));
+        }
+        total += kept[t];
+    }
+    count = total;
+}
+
+void ParticleClass::sort(int n){
+    float scale = n - 2;
+    int blocks = (n + 3)/4;
+    /* the counting sort reuses its buffers, assign only
+     * allocates when the grid grows
+    */
+    bins.assign(blocks * blocks + 1, 0);
+    for(int k = 0; k < count; k++){
+        int i = std::min(std::max((int)(x[k] * scale + 0.5f), 0), n-1);
+        int j = std::min(std::max((int)(y[k] * scale + 0.5f), 0), n-1);
+        keys[k] = (j >> 2) * blocks + (i >> 2);
+        bins[keys[k] + 1]++;
+    }
+    for(int b = 0; b < blocks * blocks; b++)
+        bins[b+1] += bins[b];
+    for(int k = 0; k < count; k++){
+        int to = bins[keys[k]]++;
+        sortX[to] = x[k];
+        sortY[to] = y[k];
+        sortAge[to] = age[k];
+    }
+    x.swap(sortX);
+    y.swap(sortY);
+    age.swap(sortAge);
+}
+
+/* one advance per velocity layout, see Layout.h
+*/
+template void ParticleClass::advance<velocitySplit>(const ObstacleClass&, int, int, const float*,
+                                                    const float*, float, const particleDomain&);
+template void ParticleClass::advance<velocityInterleaved>(const ObstacleClass&, int, int,
+                                                          const float*, const float*, float,
+                                                          const particleDomain&);
+template void ParticleClass::advance<velocityTiled>(const ObstacleClass&, int, int, const float*,
+                                                    const float*, float, const particleDomain&);
+template void ParticleClass::advance<velocityZOrder>(const ObstacleClass&, int, int, const float*,
+                                                     const float*, float, const particleDomain&);
@@ -0,0 +1,157 @@
+#include "../../Include/Simulation/VorticityFluid.h"
+#include "../../Include/Control/Constants.h"
+#include <math.h>
+#include <algorithm>
+
+VorticityFluidClass::VorticityFluidClass(int _N, float _dDiff, float _vDiff, float _dt) :
+    grid(_N, _dDiff, _vDiff, _dt, 1){
+    N = _N;
+    dDiff = _dDiff;
+    vDiff = _vDiff;
+    dt = _dt;
+    vorticity = FieldClass<float>(N, grid.stride, 1);
+    vorticityNext = FieldClass<float>(N, grid.stride, 1);
+    psi = FieldClass<float>(N, grid.stride, 1);
+    force = FieldClass<float>(N, grid.stride, 1, grid.vCurr.count());
+    /* psi has to keep up with the vorticity from one solve per
+     * step, the Jacobi sweeps of chebyshev do that as well as
+     * the SOR default of the grid and have no dependency
+     * between the cells of a sweep
+    */
+    grid.setBackend(BACKEND_POISSON, CLEAR_DIVERGENCE, "chebyshev");
+}
+
+VorticityFluidClass::~VorticityFluidClass(void){
+}
+
+void VorticityFluidClass::addDensitySource(int i, int j, float amount){
+    grid.addDensitySource(i, j, amount);
+}
+
+void VorticityFluidClass::addVelocitySource(int i, int j, float amountX, float amountY){
+    /* turned into vorticity at the next step
+    */
+    int idx = i + j * grid.stride;
+    grid.getComponent(force, VELOCITY_X)[idx] += amountX;
+    grid.getComponent(force, VELOCITY_Y)[idx] += amountY;
+}
+
+void VorticityFluidClass::addSourceCurl(void){
+    /* same differences as the divergence of clearDivergence,
+     * w in the units of the velocity over the cell size 1/n
+    */
+    int n = grid.vN;
+    int row = grid.stride;
+    float *fX = grid.getComponent(force, VELOCITY_X);
+    float *fY = grid.getComponent(force, VELOCITY_Y);
+    float *w = vorticity.data();
+    for(int j = 1; j < n-1; j++){
+        for(int i = 1; i < n-1; i++){
+            int c = i + j * row;
+            w[c] += 0.5 * n * (fY[c + 1] - fY[c - 1] - fX[c + row] + fX[c - row]);
+        }
+    }
+    for(int k = 0; k < force.count(); k++)
+        force[k] = 0.0;
+    grid.setBoundaries(DENSITY, w);
+}
+
+void VorticityFluidClass::solveStreamfunction(void){
+    /*      4 psi(i,j) - (sum of the 4 neighbours) = w(i,j)/(n*n)
+     * psi of the last step is the starting guess, it changes
+     * little from one step to the next so the few iterations of
+     * the solver go much further than from 0
+    */
+    int n = grid.vN;
+    int row = grid.stride;
+    float *rhs = grid.vPrev.data();
+    const float *w = vorticity.data();
+    float scale = 1.0/(n * n);
+    for(int j = 1; j < n-1; j++){
+        for(int i = 1; i < n-1; i++)
+            rhs[i + j * row] = w[i + j * row] * scale;
+    }
+    grid.solvePoisson(psi.data(), rhs, true);
+}
+
+void VorticityFluidClass::velocityFromStreamfunction(void){
+    int n = grid.vN;
+    int row = grid.stride;
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    const float *p = psi.data();
+    for(int j = 1; j < n-1; j++){
+        for(int i = 1; i < n-1; i++){
+            int c = i + j * row;
+            vX[c] = 0.5 * n * (p[c + row] - p[c - row]);
+            vY[c] = -0.5 * n * (p[c + 1] - p[c - 1]);
+        }
+    }
+    grid.setBoundaries(VELOCITY_X, vX);
+    grid.setBoundaries(VELOCITY_Y, vY);
+}
+
+void VorticityFluidClass::velocityStep(void){
+    grid.dt = dt;
+    addSourceCurl();
+    if(vDiff > 0.0){
+        grid.diffuse(DENSITY, vorticityNext.data(), vorticity.data(), vDiff);
+        vorticity.swap(vorticityNext);
+    }
+    /* the only solve of the step, the velocity needs no
+     * projection
+    */
+    solveStreamfunction();
+    velocityFromStreamfunction();
+    float *vX = grid.getComponent(grid.vCurr, VELOCITY_X);
+    float *vY = grid.getComponent(grid.vCurr, VELOCITY_Y);
+    grid.advection(DENSITY, vorticityNext.data(), vorticity.data(), vX, vY);
+    vorticity.swap(vorticityNext);
+}
+
+void VorticityFluidClass::densityStep(void){
+    /* the grid holds the velocity of this step
+    */
+    grid.dt = dt;
+    grid.densityStep();
+}
+
+void VorticityFluidClass::simulationStep(void){
+    velocityStep();
+    densityStep();
+}
+
+float VorticityFluidClass::maxVelocity(void){
+    return grid.maxVelocity();
+}
+
+void VorticityFluidClass::frameStep(float frameDt){
+    frameSubsteps(frameDt, N, cflTarget, kMaxSubsteps, [&]{
+        return maxVelocity();
+    }, [&](float step, float){
+        dt = step;
+        simulationStep();
+    });
+}
+
+bool VorticityFluidClass::setBackends(const std::string &spec){
+    return grid.setBackends(spec);
+}
+
+float VorticityFluidClass::getDensity(int i, int j){
+    return grid.getDensity(i, j);
+}
+
+float VorticityFluidClass::getVelocity(attribute atType, int i, int j){
+    return grid.getComponent(grid.vCurr, atType)[i + j * grid.stride];
+}
+
+float VorticityFluidClass::getVorticity(int i, int j){
+    return vorticity[i + j * grid.stride];
+}
+
+size_t VorticityFluidClass::getMemoryUsage(void){
+    size_t fields = (vorticity.count() + vorticityNext.count() + psi.count() +
+                     force.count()) * sizeof(float);
+    return grid.getMemoryUsage() + fields;
+}